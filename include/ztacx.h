@@ -14,6 +14,8 @@
 #include <zephyr/shell/shell.h>
 #include <zephyr/sys/printk.h>
 #include <zephyr/sys/mutex.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/iterable_sections.h>
 
 #ifdef __main__
 LOG_MODULE_REGISTER(app, LOG_LEVEL_DBG);
@@ -31,12 +33,28 @@ struct ztacx_leaf;
 struct ztacx_leaf_class;
 
 #define ZTACX_INIT_PRIORITY 90
-#define ZTACX_CLASS_INIT_PRIORITY 91
 #define ZTACX_LEAF_INIT_PRIORITY 92
 #define ZTACX_APP_INIT_PRIORITY 94
 #define ZTACX_LEAF_START_PRIORITY 96
 #define ZTACX_APP_START_PRIORITY 98
 
+/** @brief Dependency name that stands for every other leaf */
+#define ZTACX_LEAF_DEPENDS_ALL "*"
+
+/**
+ * @brief Priority class of the work done by a leaf
+ *
+ * Each class is run by its own work queue thread (see
+ * CONFIG_ZTACX_WORK_QUEUES), so that eg a slow I2C transfer in a
+ * background sensor leaf does not delay real-time sampling.
+ */
+enum ztacx_work_class {
+	ZTACX_WORK_INTERACTIVE=0,
+	ZTACX_WORK_REALTIME,
+	ZTACX_WORK_BACKGROUND,
+	ZTACX_WORK_CLASS_MAX
+};
+
 /** @brief Ztacx leaf class callbacks
  *
  * This structure defines the lifecycle functions for each instance (leaf) of a leaf class.
@@ -60,25 +78,103 @@ struct ztacx_leaf_cb
 	int (*pre_sleep)(struct ztacx_leaf *leaf);
 	/** @brief A function called when resuming from sleep */
 	int (*post_sleep)(struct ztacx_leaf *leaf);
+	/** @brief The work queue that runs the leaf work of this class (default interactive) */
+	enum ztacx_work_class work_class;
 };
 
 struct ztacx_leaf_class {
 	const char *name;
-	struct ztacx_leaf_class *super;
-	struct ztacx_leaf_cb *cb;
+	const struct ztacx_leaf_class *super;
+	const struct ztacx_leaf_cb *cb;
+	/** @brief link in the list of classes registered at runtime */
 	sys_snode_t node;
 };
 
 struct ztacx_leaf
 {
 	const char *name;
-	struct ztacx_leaf_class *class;
+	const struct ztacx_leaf_class *class;
 	bool ready;
 	bool running;
 	void *context;
+	/** @brief NULL-terminated names of leaves that must init and start before this one */
+	const char *const *depends;
+	/** @brief progress through the current lifecycle phase */
+	uint8_t phase;
+	/** @brief link in the list of leaves registered at runtime */
 	sys_snode_t node;
 };
 
+#if CONFIG_ZTACX_WORK_STATS
+#define ZTACX_WORK_STATS_BUCKETS 16
+
+/**
+ * @brief Runtime statistics of a leaf work handler
+ *
+ * Durations are in cycles, times in kernel ticks.  Bucket n of the
+ * histogram counts runs that took less than 2^n microseconds (the last
+ * bucket counts everything longer).  A run is an overrun if the handler
+ * started more than one requested period late, or ran for longer than
+ * the requested period.
+ */
+struct ztacx_work_stats
+{
+	uint32_t runs;
+	uint32_t overruns;
+	uint32_t min_cycles;
+	uint32_t max_cycles;
+	uint64_t total_cycles;
+	uint32_t hist[ZTACX_WORK_STATS_BUCKETS];
+	uint32_t requested_ticks;
+	uint32_t period_ticks;
+	uint32_t max_late_ticks;
+	int64_t expected;
+	int64_t last_start;
+};
+#endif
+
+/**
+ * @brief A delayable work item owned by a leaf
+ *
+ * Embed this in a leaf context (or leaf module) in place of a bare
+ * k_work_delayable.  The work handler can then reach its leaf and
+ * context in constant time via @ref ztacx_leaf_work_leaf or
+ * @ref ZTACX_LEAF_WORK_CONTEXT, rather than searching the leaf list.
+ *
+ * A work item given a period by @ref ztacx_leaf_work_set_period is run by
+ * the shared periodic scheduler, and need not reschedule itself.
+ */
+struct ztacx_leaf_work
+{
+	struct k_work_delayable work;
+	struct ztacx_leaf *leaf;
+	uint8_t work_class;
+	uint32_t period_ticks;
+	uint32_t slack_ticks;
+	int64_t deadline;
+	sys_snode_t periodic_node;
+#if CONFIG_ZTACX_WORK_STATS
+	k_work_handler_t handler;
+	const char *name;
+	struct ztacx_work_stats stats;
+	struct ztacx_variable *stats_values;
+	sys_snode_t stats_node;
+#endif
+};
+
+static inline struct ztacx_leaf_work *ztacx_leaf_work_get(struct k_work *work)
+{
+	return CONTAINER_OF(k_work_delayable_from_work(work), struct ztacx_leaf_work, work);
+}
+
+static inline struct ztacx_leaf *ztacx_leaf_work_leaf(struct k_work *work)
+{
+	return work ? ztacx_leaf_work_get(work)->leaf : NULL;
+}
+
+#define ZTACX_LEAF_WORK_CONTEXT(_work) \
+	(ztacx_leaf_work_leaf(_work) ? ztacx_leaf_work_leaf(_work)->context : NULL)
+
 
 /**
  * @def ZTACX_CLASS_DEFINE
@@ -88,22 +184,20 @@ struct ztacx_leaf
  * @details This macro lets you define a leaf class, and register its callback functions
  *
  * The callback functions are called for each INSTANCE (if any) declared by ZTACX_LEAF_DEFINE, not for the class.
- * The function ztacx_class_register is called at startup for the class.
+ * The class is placed (const) in the ztacx_leaf_class iterable section,
+ * so needs no registration at startup.  Classes created at runtime are
+ * registered with ztacx_class_register.
  *
  * The instance init function should arrange for any interrupts or poll timers to be installed.
  *
  */
 #ifdef __main__
 #define ZTACX_CLASS_DEFINE(class_name,class_cb) \
-	struct ztacx_leaf_cb ztacx_class_cb_ ## class_name = ((struct ztacx_leaf_cb)(class_cb)); \
-	struct ztacx_leaf_class ztacx_class_ ## class_name = {.name=#class_name,.super=NULL,.cb=&ztacx_class_cb_ ## class_name}; \
-	int ztacx_class_init_ ## class_name (void) { return ztacx_class_register(&ztacx_class_ ## class_name); } \
-	SYS_INIT(ztacx_class_init_ ## class_name, APPLICATION, ZTACX_CLASS_INIT_PRIORITY);
+	const struct ztacx_leaf_cb ztacx_class_cb_ ## class_name = ((struct ztacx_leaf_cb)(class_cb)); \
+	const STRUCT_SECTION_ITERABLE(ztacx_leaf_class, ztacx_class_ ## class_name) = {.name=#class_name,.super=NULL,.cb=&ztacx_class_cb_ ## class_name};
 #define ZTACX_SUBCLASS_DEFINE(class_name, super_name , class_cb)				\
-	struct ztacx_leaf_cb ztacx_class_cb_ ## class_name = class_cb;	\
-	struct ztacx_leaf_class ztacx_class_ ## class_name = (struct ztacx_leaf_cb){.name=#class_name,.super=&ztacx_class_ ## super_name,.cb=&ztacx_class_cb_ ## class_name}; \
-	int ztacx_class_init_ ## class_name (void) { return ztacx_class_register(&ztacx_class_ ## class_name); } \
-	SYS_INIT(ztacx_class_init_ ## class_name, APPLICATION, ZTACX_CLASS_INIT_PRIORITY);
+	const struct ztacx_leaf_cb ztacx_class_cb_ ## class_name = ((struct ztacx_leaf_cb)(class_cb)); \
+	const STRUCT_SECTION_ITERABLE(ztacx_leaf_class, ztacx_class_ ## class_name) = {.name=#class_name,.super=&ztacx_class_ ## super_name,.cb=&ztacx_class_cb_ ## class_name};
 #define ZTACX_CLASS_AUTO_DEFINE(class_name) \
 	extern int ztacx_##class_name##_init(struct ztacx_leaf *leaf);	\
 	extern int ztacx_##class_name##_start(struct ztacx_leaf *leaf);	\
@@ -118,11 +212,11 @@ struct ztacx_leaf
 		.post_sleep = ztacx_##class_name##_post_sleep}))
 #else
 #define ZTACX_CLASS_DEFINE(class_name,_unused) \
-	extern struct ztacx_leaf_cb ztacx_class_cb ## class_name;	\
-	extern struct ztacx_leaf_class ztacx_class ## class_name
+	extern const struct ztacx_leaf_cb ztacx_class_cb_ ## class_name;	\
+	extern const struct ztacx_leaf_class ztacx_class_ ## class_name
 #define ZTACX_CLASS_AUTO_DEFINE(class_name) \
-	extern struct ztacx_leaf_cb ztacx_class_cb ## class_name;	\
-	extern struct ztacx_leaf_class ztacx_class ## class_name
+	extern const struct ztacx_leaf_cb ztacx_class_cb_ ## class_name;	\
+	extern const struct ztacx_leaf_class ztacx_class_ ## class_name
 #endif
 
 /**
@@ -130,25 +224,32 @@ struct ztacx_leaf
  *
  * @brief Define a "Leaf" (module) instance in the ztacx framework
  *
- * @details This macro lets you define a leaf instance,
- *          and schedule its init function to run at startup via SYS_INIT
+ * @details This macro lets you define a leaf instance, placed in the
+ *          ztacx_leaf iterable section.  The framework initialises and
+ *          then starts every leaf in the section at startup.
  *
- * The SYS_INIT 'dev' pointer is (ab)used to carry the leaf pointer
+ * Leaves are visited in order of name, so use ZTACX_LEAF_DEFINE_DEPENDS
+ * to name leaves that must be initialised and started before this one
+ * (ZTACX_LEAF_DEPENDS_ALL for all others).
+ *
+ * Leaves created at runtime are registered with ztacx_leaf_register.
  *
  */
 #ifdef __main__
 #define ZTACX_LEAF_DEFINE(class_name, leaf_name, context_ptr) \
-	struct ztacx_leaf ztacx_leaf_##class_name##_##leaf_name = {.name=#leaf_name,.class=&(ztacx_class_##class_name), .context=(void*)(context_ptr)}; \
-	int ztacx_leaf_init_##class_name##_##leaf_name(void) {return ztacx_leaf_sys_init(&ztacx_leaf_##class_name##_##leaf_name);} \
-	SYS_INIT(ztacx_leaf_init_##class_name##_##leaf_name, APPLICATION, ZTACX_LEAF_INIT_PRIORITY); \
-	int ztacx_leaf_start_##class_name##_##leaf_name(void) {return ztacx_leaf_sys_start(&ztacx_leaf_##class_name##_##leaf_name);} \
-	SYS_INIT(ztacx_leaf_start_##class_name##_##leaf_name, APPLICATION, ZTACX_LEAF_START_PRIORITY);
+	ZTACX_LEAF_DEFINE_FULL(class_name, leaf_name, context_ptr, NULL)
+#define ZTACX_LEAF_DEFINE_DEPENDS(class_name, leaf_name, context_ptr, ...) \
+	static const char *const ztacx_leaf_depends_##class_name##_##leaf_name[] = {__VA_ARGS__, NULL}; \
+	ZTACX_LEAF_DEFINE_FULL(class_name, leaf_name, context_ptr, ztacx_leaf_depends_##class_name##_##leaf_name)
+#define ZTACX_LEAF_DEFINE_FULL(class_name, leaf_name, context_ptr, depends_ptr) \
+	STRUCT_SECTION_ITERABLE(ztacx_leaf, ztacx_leaf_##class_name##_##leaf_name) = {.name=#leaf_name,.class=&(ztacx_class_##class_name), .context=(void*)(context_ptr), .depends=(depends_ptr)};
 #define ZTACX_LEAF_DEFINE_NOCONTEXT(class_name, leaf_name) ZTACX_LEAF_DEFINE(class_name, leaf_name, NULL)
 #define ZTACX_LEAF_DEFINE_AUTOCONTEXT(class_name, leaf_name) \
 	struct ztacx_##class_name##_context ztacx_##class_name##_##leaf_name##_context;	\
 	ZTACX_LEAF_DEFINE(class_name, leaf_name, &ztacx_##class_name##_##leaf_name##_context)
 #else
 #define ZTACX_LEAF_DEFINE(class_name, leaf_name, context_ptr) extern struct ztacx_leaf ztacx_leaf_##class_name##_##leaf_name
+#define ZTACX_LEAF_DEFINE_DEPENDS(class_name, leaf_name, context_ptr, ...) extern struct ztacx_leaf ztacx_leaf_##class_name##_##leaf_name
 #define ZTACX_LEAF_DEFINE_NOCONTEXT(class_name, leaf_name) extern struct ztacx_leaf ztacx_leaf_##class_name##_##leaf_name
 #define ZTACX_LEAF_DEFINE_AUTOCONTEXT(class_name, leaf_name) extern struct ztacx_leaf ztacx_leaf_##class_name##_##leaf_name
 #endif
@@ -170,6 +271,31 @@ enum ztacx_value_kind {
 };
 
 
+/**
+ * @brief A timestamped event, as queued by a ZTACX_VALUE_EVENT variable
+ */
+struct ztacx_event
+{
+	uint32_t event;
+	uint32_t timestamp_ms;
+};
+
+/**
+ * @brief Bounded queue of events behind a ZTACX_VALUE_EVENT variable
+ *
+ * Events are queued in order and never merged.  Posting to a full
+ * queue fails and is counted in overflows.  The msgq may be passed to
+ * k_poll (K_POLL_TYPE_MSGQ_DATA_AVAILABLE) to wait on several sources.
+ */
+struct ztacx_event_queue
+{
+	struct k_msgq msgq;
+	struct ztacx_event buf[CONFIG_ZTACX_EVENT_QUEUE_DEPTH];
+	atomic_t posted;
+	atomic_t overflows;
+	atomic_t unmatched;
+};
+
 /**
  * @brief a union holding a typed value
  */
@@ -182,21 +308,165 @@ union ztacx_value
 	int16_t val_int16;
 	int32_t val_int32;
 	int64_t val_int64;
-	struct k_event *val_event;
+	struct ztacx_event_queue *val_event;
+};
+
+struct ztacx_variable;
+struct ztacx_subscriber;
+
+/**
+ * @brief Callback for a change subscriber
+ *
+ * Called from the ztacx interactive work queue (the system work queue
+ * if CONFIG_ZTACX_WORK_QUEUES is off).  @a changes is the number of
+ * updates coalesced into this callback; read the variable for the
+ * latest value.
+ */
+typedef void (*ztacx_subscriber_cb_t)(struct ztacx_subscriber *sub, int changes);
+
+/**
+ * @brief A subscription to changes of a variable
+ *
+ * Any number of subscribers may watch one variable.  A burst of changes
+ * results in a single callback per subscriber, and no subscriber is
+ * called more often than its min_interval_ms.
+ */
+struct ztacx_subscriber
+{
+	struct k_work_delayable work;
+	struct ztacx_variable *variable;
+	ztacx_subscriber_cb_t cb;
+	uint32_t min_interval_ms;
+	int64_t last_run;
+	atomic_t changes;
+	void *user_data;
+	sys_snode_t node;
 };
 
 /**
  * @brief a named variable (a persistent setting or a state value)
+ *
+ * The name is not copied into RAM.  It points at a string constant
+ * (normally in flash), and per-instance copies made by
+ * @ref ztacx_variables_copy record the instance prefix separately, so
+ * that the full name is "<prefix>_<name>".  Use @ref ztacx_variable_name
+ * or @ref ztacx_variable_name_eq rather than reading name directly.
  */
 struct ztacx_variable
 {
-	char name[CONFIG_ZTACX_VALUE_NAME_MAX];
+	const char *name;
 	enum ztacx_value_kind kind;
 	union ztacx_value value;
 	struct k_work *on_change;
+	sys_slist_t subscribers;
 	sys_snode_t node;
+	atomic_t seq;
+	uint32_t hash;
+	struct ztacx_variable *hash_next;
+	const char *prefix;
+	uint16_t capacity;
 };
-int ztacx_values_register(sys_slist_t *list, struct sys_mutex *mutex, struct ztacx_variable *v, int count);
+
+/**
+ * @brief printf format and arguments for the full name of a variable
+ *
+ * eg <tt>LOG_INF("set " ZTACX_VARIABLE_NAME_FMT, ZTACX_VARIABLE_NAME_ARG(v));</tt>
+ */
+#define ZTACX_VARIABLE_NAME_FMT "%s%s%s"
+#define ZTACX_VARIABLE_NAME_ARG(_v) \
+	((_v)->prefix?(_v)->prefix:""), ((_v)->prefix?"_":""), (_v)->name
+
+/**
+ * @brief Declare fixed-capacity inline storage for a string variable
+ *
+ * Use in place of the value initialiser in a variable table, eg
+ * <tt>{"bus", ZTACX_VALUE_STRING, ZTACX_STRING_INLINE(16, "I2C_1")}</tt>.
+ * The buffer holds up to (_size-1) characters plus the terminator, and
+ * setting the variable copies into it rather than reallocating.  A
+ * value that does not fit is rejected with -E2BIG.
+ */
+#define ZTACX_STRING_INLINE(_size, _init) \
+	.value={.val_string=(char[_size]){_init}}, .capacity=(_size)
+
+/**
+ * @brief Define a static table of state variables
+ *
+ * eg <tt>static ZTACX_VARIABLES_DEFINE(battery_values) = {...};</tt>
+ *
+ * The table is placed in the ztacx_variable iterable section, and is
+ * indexed once at startup, so it need not be passed to
+ * @ref ztacx_variables_register.  Tables built at runtime (eg per
+ * instance copies) must still be registered.
+ */
+#define ZTACX_VARIABLES_DEFINE(_name) STRUCT_SECTION_ITERABLE_ARRAY(ztacx_variable, _name, )
+
+/**
+ * @brief Report filter for a variable fed from a sampled sensor
+ *
+ * Used with @ref ztacx_variable_publish.  The caller owns one of these
+ * per published variable and may adjust the limits at any time (eg from
+ * a setting); the remaining fields are state and start zeroed.
+ */
+struct ztacx_publish
+{
+	/** @brief minimum change from the last published value that is reported */
+	int32_t deadband;
+	/** @brief additional change required when the direction of change reverses */
+	int32_t hysteresis;
+	/** @brief suppress reports closer together than this (0 = no limit) */
+	uint32_t min_interval_ms;
+	/** @brief report the current sample at least this often (0 = never) */
+	uint32_t max_interval_ms;
+	int64_t last_report;
+	int64_t last_value;
+	int8_t direction;
+	bool primed;
+};
+
+/**
+ * @brief A set of variable updates applied as one
+ *
+ * Between @ref ztacx_batch_begin and @ref ztacx_batch_commit the value
+ * lock is held, so readers using @ref ztacx_variables_snapshot see
+ * either none or all of the batch, and change notifications are sent
+ * once per changed variable at commit.  Keep batches short, and do not
+ * block or log inside one.
+ */
+struct ztacx_batch
+{
+	k_spinlock_key_t key;
+	int count;
+	struct ztacx_variable *changed[CONFIG_ZTACX_BATCH_MAX];
+};
+
+/**
+ * @brief a hashed name index over a list of variables
+ *
+ * Variables are added to the index when they are registered, so that
+ * lookup by name does not need to walk (and strcmp) the whole list.
+ * Define one with ZTACX_VARIABLE_INDEX_DEFINE, with a power of two
+ * buckets of the order of the number of variables it will hold.
+ */
+struct ztacx_variable_index
+{
+	struct ztacx_variable **bucket;
+	uint32_t mask;
+};
+
+#define ZTACX_VARIABLE_INDEX_DEFINE(_name, _buckets)				\
+	BUILD_ASSERT(((_buckets) & ((_buckets)-1)) == 0,			\
+		     #_name " buckets must be a power of two");			\
+	static struct ztacx_variable *_name##_bucket[_buckets];			\
+	static struct ztacx_variable_index _name = {.bucket=_name##_bucket, .mask=(_buckets)-1}
+
+extern uint32_t ztacx_name_hash(const char *name);
+extern int ztacx_variable_name(const struct ztacx_variable *v, char *buf, size_t size);
+extern bool ztacx_variable_name_eq(const struct ztacx_variable *v, const char *name);
+extern void ztacx_variable_index_add(struct ztacx_variable_index *index, struct ztacx_variable *v);
+extern struct ztacx_variable *ztacx_variable_index_find(const struct ztacx_variable_index *index, const char *name);
+extern struct ztacx_variable *ztacx_variable_index_find_id(const struct ztacx_variable_index *index, uint32_t id);
+
+int ztacx_values_register(sys_slist_t *list, struct sys_mutex *mutex, struct ztacx_variable_index *index, struct ztacx_variable *v, int count);
 
 #define ZTACX_USE_VAR(n) static struct ztacx_variable *n=NULL
 #define ZTACX_USE(n) static struct ztacx_setting *n=NULL
@@ -249,6 +519,8 @@ extern uint16_t ztacx_variable_value_get_uint16(struct ztacx_variable *v);
 extern int16_t ztacx_variable_value_get_int16(struct ztacx_variable *v);
 extern int32_t ztacx_variable_value_get_int32(struct ztacx_variable *v);
 extern int64_t ztacx_variable_value_get_int64(struct ztacx_variable *v);
+extern const char *ztacx_variable_value_borrow_string(const struct ztacx_variable *v, atomic_val_t *token_r);
+extern bool ztacx_variable_value_borrow_valid(const struct ztacx_variable *v, atomic_val_t token);
 
 extern int ztacx_variable_value_set(struct ztacx_variable *v, const void *value);
 extern int ztacx_variable_value_set_string(struct ztacx_variable *v, const char *value);
@@ -259,16 +531,219 @@ extern int ztacx_variable_value_set_int16(struct ztacx_variable *v, int16_t valu
 extern int ztacx_variable_value_set_int32(struct ztacx_variable *v, int32_t value);
 extern int ztacx_variable_value_set_int64(struct ztacx_variable *v, int64_t value);
 extern int ztacx_variable_value_inc_int64(struct ztacx_variable *v);
+extern int ztacx_variable_publish(struct ztacx_variable *v, struct ztacx_publish *p, int64_t sample);
+
+extern void ztacx_batch_begin(struct ztacx_batch *b);
+extern int ztacx_batch_set(struct ztacx_batch *b, struct ztacx_variable *v, const void *value);
+extern int ztacx_batch_set_int32(struct ztacx_batch *b, struct ztacx_variable *v, int32_t value);
+extern int ztacx_batch_inc_int64(struct ztacx_batch *b, struct ztacx_variable *v);
+extern int ztacx_batch_publish(struct ztacx_batch *b, struct ztacx_variable *v, struct ztacx_publish *p, int64_t sample);
+extern void ztacx_batch_commit(struct ztacx_batch *b);
+extern int ztacx_variables_snapshot(struct ztacx_variable *const *vars, union ztacx_value *values_r, int count);
+extern void ztacx_event_queue_init(struct ztacx_event_queue *q);
 extern int ztacx_variable_value_set_event(struct ztacx_variable *v, uint32_t event);
 extern int ztacx_variable_value_post_event(struct ztacx_variable *v, uint32_t event);
+extern int ztacx_variable_value_get_event(struct ztacx_variable *v, struct ztacx_event *event_r, k_timeout_t timeout);
 extern uint32_t ztacx_variable_value_wait_event(struct ztacx_variable *v, uint32_t mask, k_timeout_t timeout);
 
 extern int ztacx_variable_ptr_set_onchange(struct ztacx_variable *v, struct k_work *work);
 extern int ztacx_variable_set_onchange(const char *name, struct k_work *work);
+extern int ztacx_variable_subscribe(struct ztacx_variable *v, struct ztacx_subscriber *sub, ztacx_subscriber_cb_t cb, uint32_t min_interval_ms);
+extern int ztacx_variable_unsubscribe(struct ztacx_subscriber *sub);
+extern void ztacx_variable_notify(struct ztacx_variable *v);
+
+/**
+ * @brief Typed handles to variables
+ *
+ * A handle wraps a variable pointer in a struct whose type names the
+ * kind of the variable, eg <tt>struct ztacx_var_int32</tt>.  Reading
+ * through a handle compiles to a direct load with no switch on the
+ * kind; setting goes through ztacx_variable_value_set_<kind>, so the
+ * value lock, sequence count and notification apply as for any other
+ * set, and a changed setting is marked for write-back.  Passing a
+ * handle of the wrong kind fails to compile.
+ *
+ * For an entry of a static table, declare its index with
+ * @ref ZTACX_TYPED_INDEX and the entry with @ref ZTACX_TYPED_ENTRY, and
+ * make the handle with @ref ZTACX_TYPED_VAR; a kind that differs from
+ * the index's is then a build error, eg
+ * <tt>enum { ZTACX_TYPED_INDEX(SETTING_THRESHOLD, int32) };</tt> ...
+ * <tt>{ ZTACX_TYPED_ENTRY(SETTING_THRESHOLD, int32, "threshold", 10) };</tt> ...
+ * <tt>threshold = ZTACX_TYPED_VAR(settings, SETTING_THRESHOLD, int32);</tt>
+ *
+ * A variable found by name can only be checked when the handle is made:
+ * <tt>ZTACX_USE_VAR_AS(threshold, int32);</tt> ...
+ * <tt>ZTACX_VAR_FIND_TYPED(threshold, int32);</tt>
+ *
+ * GET/SET are logged only if CONFIG_ZTACX_VARIABLE_DEBUG is enabled.
+ */
+#if CONFIG_ZTACX_VARIABLE_DEBUG
+#define ZTACX_VARIABLE_TRACE(_op, _v, _value)					\
+	LOG_DBG(_op " " ZTACX_VARIABLE_NAME_FMT " => %lld",			\
+		ZTACX_VARIABLE_NAME_ARG(_v), (long long)(_value))
+#else
+#define ZTACX_VARIABLE_TRACE(_op, _v, _value) do { } while (0)
+#endif
+
+#if CONFIG_ZTACX_LEAF_SETTINGS
+extern int ztacx_setting_mark_dirty(struct ztacx_variable *s);
+#define ZTACX_SETTING_WRITE_BACK(_v) (void)ztacx_setting_mark_dirty(_v)
+#else
+#define ZTACX_SETTING_WRITE_BACK(_v) do { } while (0)
+#endif
+
+/**
+ * @brief Declare an index of a static table entry along with its kind
+ *
+ * Expands to the index itself, and an alias of it that names the kind
+ * (<tt>_idx##_is_##_kind</tt>), through which the entry and its handle
+ * are declared.
+ */
+#define ZTACX_TYPED_INDEX(_idx, _kind) _idx, _idx##_is_##_kind = _idx
+
+/** @brief Initialise a static table entry of the kind declared for its index */
+#define ZTACX_TYPED_ENTRY(_idx, _kind, _name, _init) \
+	[_idx##_is_##_kind] = {_name, ZTACX_KIND_##_kind, {.val_##_kind=(_init)}}
+
+/** @brief Handle to a static table entry of the kind declared for its index */
+#define ZTACX_TYPED_VAR(_table, _idx, _kind) \
+	((struct ztacx_var_##_kind){&(_table)[_idx##_is_##_kind]})
+
+#define ZTACX_TYPED_VAR_DECLARE(_kind, _type, _KIND)				\
+	enum { ZTACX_KIND_##_kind = (_KIND) };					\
+	struct ztacx_var_##_kind {						\
+		struct ztacx_variable *v;					\
+	};									\
+	static inline struct ztacx_var_##_kind					\
+	ztacx_var_##_kind(struct ztacx_variable *v)				\
+	{									\
+		if (v && (v->kind != (_KIND))) {				\
+			LOG_ERR("Variable " ZTACX_VARIABLE_NAME_FMT " is not " #_kind, \
+				ZTACX_VARIABLE_NAME_ARG(v));			\
+			v = NULL;						\
+		}								\
+		return (struct ztacx_var_##_kind){v};				\
+	}									\
+	static inline _type ztacx_##_kind##_get(struct ztacx_var_##_kind h)	\
+	{									\
+		__ASSERT_NO_MSG(h.v);						\
+		_type value = *(volatile _type *)&h.v->value.val_##_kind;	\
+		ZTACX_VARIABLE_TRACE("GET", h.v, value);			\
+		return value;							\
+	}									\
+	static inline bool ztacx_##_kind##_set(struct ztacx_var_##_kind h, _type value) \
+	{									\
+		__ASSERT_NO_MSG(h.v);						\
+		ZTACX_VARIABLE_TRACE("SET", h.v, value);			\
+		if (*(volatile _type *)&h.v->value.val_##_kind == value) {	\
+			return false;						\
+		}								\
+		if (ztacx_variable_value_set_##_kind(h.v, value) != 0) {	\
+			return false;						\
+		}								\
+		ZTACX_SETTING_WRITE_BACK(h.v);					\
+		return true;							\
+	}
+
+ZTACX_TYPED_VAR_DECLARE(bool, bool, ZTACX_VALUE_BOOL)
+ZTACX_TYPED_VAR_DECLARE(byte, uint8_t, ZTACX_VALUE_BYTE)
+ZTACX_TYPED_VAR_DECLARE(uint16, uint16_t, ZTACX_VALUE_UINT16)
+ZTACX_TYPED_VAR_DECLARE(int16, int16_t, ZTACX_VALUE_INT16)
+ZTACX_TYPED_VAR_DECLARE(int32, int32_t, ZTACX_VALUE_INT32)
+
+/*
+ * 64-bit values cannot be loaded or stored in one access, so they keep
+ * the sequence-count protocol of ztacx_variable_value_get/set_int64.
+ */
+enum { ZTACX_KIND_int64 = ZTACX_VALUE_INT64 };
+
+struct ztacx_var_int64 {
+	struct ztacx_variable *v;
+};
+
+static inline struct ztacx_var_int64 ztacx_var_int64(struct ztacx_variable *v)
+{
+	if (v && (v->kind != ZTACX_VALUE_INT64)) {
+		LOG_ERR("Variable " ZTACX_VARIABLE_NAME_FMT " is not int64",
+			ZTACX_VARIABLE_NAME_ARG(v));
+		v = NULL;
+	}
+	return (struct ztacx_var_int64){v};
+}
+
+static inline int64_t ztacx_int64_get(struct ztacx_var_int64 h)
+{
+	__ASSERT_NO_MSG(h.v);
+	return ztacx_variable_value_get_int64(h.v);
+}
+
+static inline bool ztacx_int64_set(struct ztacx_var_int64 h, int64_t value)
+{
+	__ASSERT_NO_MSG(h.v);
+	if (ztacx_variable_value_get_int64(h.v) == value) {
+		return false;
+	}
+	if (ztacx_variable_value_set_int64(h.v, value) != 0) {
+		return false;
+	}
+	ZTACX_SETTING_WRITE_BACK(h.v);
+	return true;
+}
+
+#define ZTACX_USE_VAR_AS(n, kind) static struct ztacx_var_##kind n={NULL}
+
+#define ZTACX_VAR_FIND_TYPED(n, kind) if (!(n=ztacx_var_##kind(ztacx_variable_find(#n))).v) { \
+       LOG_ERR("APP ABORT Variable '"#n"' of kind "#kind" not found");  \
+       return -1;                                                       \
+       }
+#define ZTACX_SETTING_FIND_TYPED(n, kind) if (!(n=ztacx_var_##kind(ztacx_setting_find(#n))).v) { \
+       LOG_ERR("APP ABORT Setting '"#n"' of kind "#kind" not found");   \
+       return -1;                                                       \
+       }
 
 extern int ztacx_variables_register(struct ztacx_variable *v, int count);
 extern void ztacx_variables_show();
 
+/**
+ * @brief Binary snapshot frame produced by @ref ztacx_variables_encode
+ *
+ * The frame is a 4 byte header (magic, version, little-endian record
+ * count) followed by one record per variable: a little-endian 32-bit
+ * id (the hash of the variable name), a kind byte, a length byte, and
+ * the value in little-endian byte order (strings without terminator).
+ *
+ * A variable with history (see @ref ztacx_history_attach) is followed
+ * by one record of kind ZTACX_SNAPSHOT_KIND_HISTORY for each history
+ * block, oldest first, with the same id.  Its value is the 32-bit
+ * interval_ms and a block as in @ref ZTACX_HISTORY_MAGIC.  The record
+ * count includes these records.
+ */
+#define ZTACX_SNAPSHOT_MAGIC 0x5A
+#define ZTACX_SNAPSHOT_VERSION 2
+#define ZTACX_SNAPSHOT_HEADER_SIZE 4
+#define ZTACX_SNAPSHOT_RECORD_HEADER_SIZE 6
+#define ZTACX_SNAPSHOT_KIND_HISTORY 0x80
+
+typedef bool (*ztacx_variable_filter_t)(const struct ztacx_variable *v, void *arg);
+
+extern int ztacx_variables_encode(uint8_t *buf, size_t buf_max, ztacx_variable_filter_t filter, void *arg);
+extern int ztacx_variable_encode_record(uint8_t *buf, size_t buf_max, const struct ztacx_variable *v);
+extern int ztacx_variable_decode_record(struct ztacx_variable *v, const uint8_t *buf, size_t len);
+
+/**
+ * @brief Fold the id and kind of a variable into a schema hash
+ *
+ * A schema hash (starting from ZTACX_SCHEMA_INIT) identifies the set
+ * of variables in a stored image, so that a changed set is detected.
+ * Each variable is mixed on its own and XORed in, so the hash does not
+ * depend on the order in which the variables were registered.
+ */
+#define ZTACX_SCHEMA_INIT 2166136261U
+static inline uint32_t ztacx_schema_add(uint32_t schema, const struct ztacx_variable *v)
+{
+	return schema ^ ((v->hash ^ ((uint32_t)v->kind << 24)) * 16777619U);
+}
+
 
 // Functions for inspecting and modifying leaves (modules)
 //
@@ -280,15 +755,208 @@ extern int ztacx_leaf_start(const char *name);
 extern int ztacx_leaf_stop(const char *name);
 extern bool ztacx_leaf_is_ready(const char *name);
 extern bool ztacx_leaf_is_running(const char *name);
+
+extern void ztacx_leaf_work_init(struct ztacx_leaf *leaf, struct ztacx_leaf_work *lw, k_work_handler_t handler);
+extern void ztacx_leaf_work_init_named(struct ztacx_leaf *leaf, struct ztacx_leaf_work *lw, k_work_handler_t handler, const char *name);
+extern int ztacx_leaf_work_schedule(struct ztacx_leaf_work *lw, k_timeout_t delay);
+extern int ztacx_leaf_work_reschedule(struct ztacx_leaf_work *lw, k_timeout_t delay);
+extern int ztacx_leaf_work_cancel(struct ztacx_leaf_work *lw);
+extern struct k_work_q *ztacx_work_queue(enum ztacx_work_class work_class);
+extern int ztacx_leaf_work_set_period(struct ztacx_leaf_work *lw, uint32_t period_ms, uint32_t slack_ms);
+
+/**
+ * @brief Default slack allowed to a periodic leaf work item
+ *
+ * Work items whose windows overlap are run from a single wakeup, so
+ * more slack means fewer wakeups (and more jitter).
+ */
+#define ZTACX_PERIODIC_SLACK(_period_ms) \
+	((uint32_t)(((uint64_t)(_period_ms) * CONFIG_ZTACX_PERIODIC_SLACK_PERCENT) / 100))
 #if CONFIG_SHELL
 extern int ztacx_shell_cmd_register(struct shell_static_entry entry);
 #endif
 
+/**
+ * @brief Lifecycle phases recorded by the boot timing table
+ */
+enum ztacx_timing_phase {
+	ZTACX_TIMING_FRAMEWORK = 0,
+	ZTACX_TIMING_CLASS_REGISTER,
+	ZTACX_TIMING_LEAF_INIT,
+	ZTACX_TIMING_LEAF_START,
+	ZTACX_TIMING_SETTINGS_LOAD,
+	ZTACX_TIMING_RETAINED_RESTORE,
+	ZTACX_TIMING_APP_INIT,
+	ZTACX_TIMING_APP_START,
+	ZTACX_TIMING_PHASE_MAX
+};
+
+#if CONFIG_ZTACX_BOOT_TIMING
+extern int ztacx_timing_begin(enum ztacx_timing_phase phase, const char *name);
+extern void ztacx_timing_end(int slot, int rc);
+extern void ztacx_timing_reset(void);
+#if CONFIG_SHELL
+extern void ztacx_timing_show(const struct shell *shell, bool raw);
+#endif
+#else
+static inline int ztacx_timing_begin(enum ztacx_timing_phase phase, const char *name) { return -ENOTSUP; }
+static inline void ztacx_timing_end(int slot, int rc) {}
+static inline void ztacx_timing_reset(void) {}
+#endif
+
+/**
+ * @brief Time-series history of a numeric variable
+ *
+ * Attached to a variable by @ref ztacx_history_attach, a history
+ * samples it at a fixed interval into a ring of blocks.  Each block
+ * stores its first value and the zigzag varint deltas of the rest
+ * (timestamps are implicit from the interval), along with the count,
+ * min, max and sum of its samples, so that a window query only decodes
+ * the block at the edge of the window.
+ */
+struct ztacx_history;
+
+/**
+ * @brief Summary of a window of history
+ */
+struct ztacx_history_summary
+{
+	int count;
+	int32_t min;
+	int32_t max;
+	int32_t mean;
+	uint32_t first_ms;
+	uint32_t last_ms;
+};
+
+typedef void (*ztacx_history_cb_t)(uint32_t timestamp_ms, int32_t value, void *arg);
+
+/**
+ * @brief Binary history frame produced by @ref ztacx_history_encode
+ *
+ * A header (magic, version, little-endian 32-bit variable id as in
+ * @ref ZTACX_SNAPSHOT_MAGIC, 32-bit interval_ms, 16-bit block count)
+ * followed by each block from oldest to newest: 32-bit start_ms, 32-bit
+ * first value, 16-bit sample count, a length byte and that many bytes
+ * of zigzag LEB128 deltas.
+ */
+#define ZTACX_HISTORY_MAGIC 0x48
+#define ZTACX_HISTORY_VERSION 1
+
+#if CONFIG_ZTACX_HISTORY
+extern struct ztacx_history *ztacx_history_attach(struct ztacx_variable *v, uint32_t interval_ms, uint32_t depth);
+extern struct ztacx_history *ztacx_history_find(const char *name);
+extern int ztacx_history_window(struct ztacx_history *h, uint32_t window_ms, struct ztacx_history_summary *summary_r);
+extern int ztacx_history_foreach(struct ztacx_history *h, uint32_t window_ms, ztacx_history_cb_t cb, void *arg);
+extern int ztacx_history_encode(struct ztacx_history *h, uint8_t *buf, size_t buf_max);
+extern int ztacx_history_encode_records(const struct ztacx_variable *v, uint8_t *buf, size_t buf_max, int *count_r);
+#if CONFIG_SHELL
+extern int cmd_ztacx_history(const struct shell *shell, size_t argc, char **argv);
+#endif
+#else
+static inline struct ztacx_history *ztacx_history_attach(struct ztacx_variable *v, uint32_t interval_ms, uint32_t depth) { return NULL; }
+static inline struct ztacx_history *ztacx_history_find(const char *name) { return NULL; }
+static inline int ztacx_history_encode_records(const struct ztacx_variable *v, uint8_t *buf, size_t buf_max, int *count_r) { return 0; }
+#endif
+
+/**
+ * @brief Persistent counters
+ *
+ * A counter variable attached with @ref ztacx_counter_attach is
+ * incremented in RAM as usual, and checkpointed periodically to a
+ * wear-levelled journal in the counter_storage flash partition, from
+ * which it is recovered at boot.  After an unplanned reset it has lost
+ * at most the increments of one checkpoint interval.  A low-rate
+ * counter that must lose nothing is attached with ZTACX_COUNTER_EXACT
+ * and incremented with @ref ztacx_counter_increment, which writes it to
+ * the journal before returning.
+ */
+enum ztacx_counter_mode {
+	ZTACX_COUNTER_CHECKPOINT = 0,
+	ZTACX_COUNTER_EXACT,
+};
+
+#if CONFIG_ZTACX_COUNTER_JOURNAL
+extern int ztacx_counter_attach(struct ztacx_variable *v);
+extern int ztacx_counter_attach_mode(struct ztacx_variable *v, enum ztacx_counter_mode mode);
+extern int ztacx_counter_increment(struct ztacx_variable *v, int64_t delta);
+extern int ztacx_counter_checkpoint(void);
+#if CONFIG_ZTEST
+extern void ztacx_counter_reset(void);
+#endif
+#if CONFIG_SHELL
+extern int cmd_ztacx_counter(const struct shell *shell, size_t argc, char **argv);
+#endif
+#else
+static inline int ztacx_counter_attach(struct ztacx_variable *v) { return -ENOTSUP; }
+static inline int ztacx_counter_attach_mode(struct ztacx_variable *v, enum ztacx_counter_mode mode) { return -ENOTSUP; }
+static inline int ztacx_counter_increment(struct ztacx_variable *v, int64_t delta)
+{
+	if (v && (v->kind == ZTACX_VALUE_INT32)) {
+		return ztacx_variable_value_set_int32(v, ztacx_variable_value_get_int32(v) + (int32_t)delta);
+	}
+	return ztacx_variable_value_set_int64(v, ztacx_variable_value_get_int64(v) + delta);
+}
+static inline int ztacx_counter_checkpoint(void) { return -ENOTSUP; }
+#endif
+
+/**
+ * @brief Retained RAM image of settings and selected variables
+ *
+ * On the way into system off (see power_off) the settings and any
+ * variables passed to @ref ztacx_variable_retain are written as
+ * snapshot records to RAM that is not cleared at reset, with a CRC and
+ * a guard made from the build number and the names and kinds of the
+ * retained variables.  On wake the image is checked and restored
+ * before leaves start, and the ztacx settings stored in flash are
+ * ignored (other subsystems' settings still load).  The image is
+ * consumed by a restore, so a later reset starts fresh.
+ */
+#if CONFIG_ZTACX_RETAINED
+extern int ztacx_variable_retain(struct ztacx_variable *v);
+extern int ztacx_retained_save(void);
+extern int ztacx_retained_restore(void);
+extern bool ztacx_retained_settings_restored(void);
+extern void ztacx_retained_erase(void);
+#if CONFIG_SHELL
+extern void ztacx_retained_show(const struct shell *shell);
+#endif
+#else
+static inline int ztacx_variable_retain(struct ztacx_variable *v) { return -ENOTSUP; }
+static inline int ztacx_retained_save(void) { return -ENOTSUP; }
+static inline int ztacx_retained_restore(void) { return -ENOTSUP; }
+static inline bool ztacx_retained_settings_restored(void) { return false; }
+static inline void ztacx_retained_erase(void) {}
+#endif
+
+/**
+ * @brief Run an application init (or start) function via SYS_INIT, with boot timing
+ *
+ * Use in place of SYS_INIT(fn, APPLICATION, ZTACX_APP_INIT_PRIORITY).
+ */
+#define ZTACX_APP_INIT(fn) \
+	static int ztacx_app_init_##fn(void) {				\
+		int slot = ztacx_timing_begin(ZTACX_TIMING_APP_INIT, #fn); \
+		int rc = fn();						\
+		ztacx_timing_end(slot, rc);				\
+		return rc;						\
+	}								\
+	SYS_INIT(ztacx_app_init_##fn, APPLICATION, ZTACX_APP_INIT_PRIORITY)
+#define ZTACX_APP_START(fn) \
+	static int ztacx_app_start_##fn(void) {				\
+		int slot = ztacx_timing_begin(ZTACX_TIMING_APP_START, #fn); \
+		int rc = fn();						\
+		ztacx_timing_end(slot, rc);				\
+		return rc;						\
+	}								\
+	SYS_INIT(ztacx_app_start_##fn, APPLICATION, ZTACX_APP_START_PRIORITY)
+
 // Functions for the lifecycle of the whole ztacx framework
 // You probably won't need to call these directly
 extern int ztacx_class_register(struct ztacx_leaf_class *class);
-extern int ztacx_leaf_sys_init(struct ztacx_leaf *leaf);
-extern int ztacx_leaf_sys_start(struct ztacx_leaf *leaf);
+extern int ztacx_leaf_register(struct ztacx_leaf *leaf);
+extern int ztacx_leaf_run_init(struct ztacx_leaf *leaf);
+extern int ztacx_leaf_run_start(struct ztacx_leaf *leaf);
 extern int ztacx_pre_sleep(void);
 extern int ztacx_post_sleep(void);
 
@@ -16,6 +16,6 @@
 extern int ztacx_battery_init(struct ztacx_leaf *leaf);
 extern int ztacx_battery_start(struct ztacx_leaf *leaf);
 
-ZTACX_CLASS_DEFINE(battery, ((struct ztacx_leaf_cb){.init=&ztacx_battery_init,.start=&ztacx_battery_start}));
+ZTACX_CLASS_DEFINE(battery, ((struct ztacx_leaf_cb){.init=&ztacx_battery_init,.start=&ztacx_battery_start,.work_class=ZTACX_WORK_BACKGROUND}));
 ZTACX_LEAF_DEFINE(battery, battery, NULL);
 
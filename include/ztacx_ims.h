@@ -21,6 +21,6 @@
 extern int ztacx_ims_init(struct ztacx_leaf *leaf);
 extern int ztacx_ims_start(struct ztacx_leaf *leaf);
 
-ZTACX_CLASS_DEFINE(ims, ((struct ztacx_leaf_cb){.init=&ztacx_ims_init,.start=&ztacx_ims_start}));
+ZTACX_CLASS_DEFINE(ims, ((struct ztacx_leaf_cb){.init=&ztacx_ims_init,.start=&ztacx_ims_start,.work_class=ZTACX_WORK_REALTIME}));
 ZTACX_LEAF_DEFINE(ims, ims, NULL);
 
@@ -36,8 +36,8 @@ struct ztacx_kp_context
 	int settings_count;
 	struct ztacx_variable *values;
 	int values_count;
-	struct k_work_delayable scan;
-	struct k_event event;
+	struct ztacx_leaf_work scan;
+	struct ztacx_event_queue event;
 };
 
 extern struct ztacx_kp_context ztacx_kp_kp0_context;
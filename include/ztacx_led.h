@@ -8,8 +8,8 @@ struct ztacx_led_context
 	int settings_count;
 	struct ztacx_variable *values;
 	int values_count;
-	struct k_work_delayable ledoff;
-	struct k_work_delayable ledon;
+	struct ztacx_leaf_work ledoff;
+	struct ztacx_leaf_work ledon;
 };
 
 extern struct ztacx_led_context ztacx_led_led0_context;
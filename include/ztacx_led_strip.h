@@ -9,7 +9,8 @@ struct ztacx_led_strip_context
 	int settings_count;
 	struct ztacx_variable *values;
 	int values_count;
-	struct k_work_delayable refresh;
+	struct ztacx_leaf_work refresh;
+	int test_step;
 };
 
 extern struct ztacx_led_strip_context ztacx_led_strip_context;
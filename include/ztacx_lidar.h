@@ -16,6 +16,6 @@
 extern int ztacx_lidar_init(struct ztacx_leaf *leaf);
 extern int ztacx_lidar_start(struct ztacx_leaf *leaf);
 
-ZTACX_CLASS_DEFINE(lidar, ((struct ztacx_leaf_cb){.init=&ztacx_lidar_init,.start=&ztacx_lidar_start}));
+ZTACX_CLASS_DEFINE(lidar, ((struct ztacx_leaf_cb){.init=&ztacx_lidar_init,.start=&ztacx_lidar_start,.work_class=ZTACX_WORK_BACKGROUND}));
 ZTACX_LEAF_DEFINE(lidar, lidar, NULL);
 
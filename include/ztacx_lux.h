@@ -13,6 +13,6 @@
 extern int ztacx_lux_init(struct ztacx_leaf *leaf);
 extern int ztacx_lux_start(struct ztacx_leaf *leaf);
 
-ZTACX_CLASS_DEFINE(lux, ((struct ztacx_leaf_cb){.init=&ztacx_lux_init,.start=&ztacx_lux_start}));
+ZTACX_CLASS_DEFINE(lux, ((struct ztacx_leaf_cb){.init=&ztacx_lux_init,.start=&ztacx_lux_start,.work_class=ZTACX_WORK_BACKGROUND}));
 ZTACX_LEAF_DEFINE(lux, lux, NULL);
 
@@ -3,17 +3,30 @@
 
 extern int ztacx_settings_init(struct ztacx_leaf *leaf);
 extern int ztacx_settings_start(struct ztacx_leaf *leaf);
+extern int ztacx_settings_pre_sleep(struct ztacx_leaf *leaf);
 extern int ztacx_settings_load();
 
+extern sys_slist_t ztacx_settings;
+extern struct sys_mutex ztacx_settings_mutex;
+
 extern int ztacx_settings_register(struct ztacx_variable *s, int count);
+extern int ztacx_settings_register_leaf(struct ztacx_leaf *leaf, struct ztacx_variable *s, int count);
 extern int ztacx_settings_add_kind(
 	const char *name, enum ztacx_value_kind kind,
 	void *value, int value_len);
 
 extern struct ztacx_variable *ztacx_setting_find(const char *name);
 extern int ztacx_setting_set(struct ztacx_variable *s, const char *value);
+extern int ztacx_setting_mark_dirty(struct ztacx_variable *s);
+extern bool ztacx_setting_is_dirty(const struct ztacx_variable *s);
+extern int ztacx_setting_mark_saved(struct ztacx_variable *s);
+extern int ztacx_settings_commit(void);
+
+/** @brief Called from the settings work queue when a commit completes */
+typedef void (*ztacx_settings_done_cb_t)(int rc, void *user_data);
+extern int ztacx_settings_commit_async(ztacx_settings_done_cb_t cb, void *user_data);
 extern void ztacx_settings_show();
 
-ZTACX_CLASS_DEFINE(settings, ((struct ztacx_leaf_cb){.init=&ztacx_settings_init,.start=&ztacx_settings_start}));
-ZTACX_LEAF_DEFINE(settings, settings, NULL);
+ZTACX_CLASS_DEFINE(settings, ((struct ztacx_leaf_cb){.init=&ztacx_settings_init,.start=&ztacx_settings_start,.pre_sleep=&ztacx_settings_pre_sleep}));
+ZTACX_LEAF_DEFINE_DEPENDS(settings, settings, NULL, ZTACX_LEAF_DEPENDS_ALL);
 
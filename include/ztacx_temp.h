@@ -14,6 +14,6 @@
 extern int ztacx_temp_init(struct ztacx_leaf *leaf);
 extern int ztacx_temp_start(struct ztacx_leaf *leaf);
 
-ZTACX_CLASS_DEFINE(temp, ((struct ztacx_leaf_cb){.init=&ztacx_temp_init,.start=&ztacx_temp_start}));
+ZTACX_CLASS_DEFINE(temp, ((struct ztacx_leaf_cb){.init=&ztacx_temp_init,.start=&ztacx_temp_start,.work_class=ZTACX_WORK_BACKGROUND}));
 ZTACX_LEAF_DEFINE(temp, temp, NULL);
 #endif
@@ -204,9 +204,9 @@ static int app_init(void)
 	return 0;
 }
 
-static struct k_work connect_change_work;
+static struct ztacx_subscriber connect_change_sub;
 
-void connect_change(struct k_work *work) 
+void connect_change(struct ztacx_subscriber *sub, int changes) 
 {
 	connected = ztacx_variable_value_get_bool(bt_peripheral_connected);
 	
@@ -230,8 +230,7 @@ static int app_start(void)
 	}
 
 	LOG_INF("Registering connect hook");
-	k_work_init(&connect_change_work, connect_change);
-	ztacx_variable_ptr_set_onchange(bt_peripheral_connected, &connect_change_work);
+	ztacx_variable_subscribe(bt_peripheral_connected, &connect_change_sub, connect_change, 0);
 
 	LOG_INF("Registering advertising data");
 //	if (ztacx_bt_adv_register(ad, ARRAY_SIZE(ad), sd, ARRAY_SIZE(sd)) != 0) {
@@ -244,8 +243,8 @@ static int app_start(void)
 }
 
 
-SYS_INIT(app_init, APPLICATION, ZTACX_APP_INIT_PRIORITY);
-SYS_INIT(app_start, APPLICATION, ZTACX_APP_START_PRIORITY);
+ZTACX_APP_INIT(app_init);
+ZTACX_APP_START(app_start);
 
 
 int main(void)
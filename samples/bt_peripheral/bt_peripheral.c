@@ -69,7 +69,7 @@ static int app_init(void)
 #endif
 	return 0;
 }
-SYS_INIT(app_init, APPLICATION, ZTACX_APP_INIT_PRIORITY);
+ZTACX_APP_INIT(app_init);
 
 
 void main(void)
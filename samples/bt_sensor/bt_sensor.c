@@ -25,7 +25,7 @@ static struct ztacx_variable *ims_samples;
 static struct ztacx_variable *shock_threshold;
 static struct ztacx_variable *shock_alert;
 
-static struct ztacx_variable app_values[] = {
+static ZTACX_VARIABLES_DEFINE(app_values) = {
 	{"shock_threshold",ZTACX_VALUE_INT32,{.val_int32=CONFIG_APP_SHOCK_THRESHOLD}},
 	{"shock_alert",ZTACX_VALUE_BOOL,{.val_bool=false}}
 };
@@ -98,7 +98,6 @@ static int app_init(void)
 	printk("bt_sensor sample app_init\n");
 	LOG_INF("NOTICE bt_sensor sample Initialising app variables");
 
-	ztacx_variables_register(app_values, ARRAY_SIZE(app_values));
 	
 	ZTACX_SETTING_FIND(ims_read_interval_usec);
 	ZTACX_SETTING_FIND(ims_change_threshold);
@@ -118,10 +117,10 @@ static int app_init(void)
 	return 0;
 }
 
-static struct k_work peak_change_work;
-static struct k_work alert_clear_work;
+static struct ztacx_subscriber peak_change_sub;
+static struct ztacx_subscriber alert_clear_sub;
 
-void peak_change(struct k_work *work) 
+void peak_change(struct ztacx_subscriber *sub, int changes) 
 {
 	int64_t count = ztacx_variable_value_get_int64(ims_samples);
 	int32_t peak = ztacx_variable_value_get_int32(ims_peak_m);
@@ -138,7 +137,7 @@ void peak_change(struct k_work *work)
 	}
 }
 
-void alert_clear(struct k_work *work) 
+void alert_clear(struct ztacx_subscriber *sub, int changes) 
 {
 	if (ztacx_variable_value_get_bool(shock_alert)) {
 		LOG_INF("Shock alert was triggered");
@@ -150,7 +149,7 @@ void alert_clear(struct k_work *work)
 	ztacx_variable_value_set_int32(ims_peak_m, INT32_MAX);
 }
 
-static int app_start(const struct device *unused) 
+static int app_start(void) 
 {
 	printk("bt_sensor sample app_start\n");
 #if CONFIG_ZTACX_LEAF_BT_PERIPHERAL
@@ -162,17 +161,15 @@ static int app_start(const struct device *unused)
 	LOG_ERR("BT peripheral leaf is disabled");
 #endif
 
-	k_work_init(&peak_change_work, peak_change);
-	ztacx_variable_ptr_set_onchange(ims_peak_m, &peak_change_work);
-	k_work_init(&alert_clear_work, alert_clear);
-	ztacx_variable_ptr_set_onchange(shock_alert, &alert_clear_work);
+	ztacx_variable_subscribe(ims_peak_m, &peak_change_sub, peak_change, 0);
+	ztacx_variable_subscribe(shock_alert, &alert_clear_sub, alert_clear, 0);
 	
 	return 0;
 }
 
 
-SYS_INIT(app_init, APPLICATION, ZTACX_APP_INIT_PRIORITY);
-SYS_INIT(app_start, APPLICATION, ZTACX_APP_START_PRIORITY);
+ZTACX_APP_INIT(app_init);
+ZTACX_APP_START(app_start);
 
 
 void main(void)
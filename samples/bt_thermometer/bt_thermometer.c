@@ -98,8 +98,8 @@ static int app_start(void)
 	return 0;
 }
 
-SYS_INIT(app_init, APPLICATION, ZTACX_APP_INIT_PRIORITY);
-SYS_INIT(app_start, APPLICATION, ZTACX_APP_START_PRIORITY);
+ZTACX_APP_INIT(app_init);
+ZTACX_APP_START(app_start);
 
 
 void main(void)
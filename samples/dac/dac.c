@@ -103,5 +103,5 @@ static int app_init(void)
 	return 0;
 }
 
-SYS_INIT(app_init, APPLICATION, ZTACX_APP_INIT_PRIORITY);
+ZTACX_APP_INIT(app_init);
 
@@ -1,6 +1,8 @@
 #include "ztacx.h"
 #include <zephyr/bluetooth/bluetooth.h>
 #include <zephyr/drivers/hwinfo.h>
+#include <zephyr/sys/barrier.h>
+#include <zephyr/sys/byteorder.h>
 
 uint8_t device_id[16]="";
 int device_id_len = 0;
@@ -12,6 +14,7 @@ char device_id_short[7]="";
 static sys_slist_t ztacx_classes;
 static sys_slist_t ztacx_leaves;
 static sys_slist_t ztacx_variables;
+ZTACX_VARIABLE_INDEX_DEFINE(ztacx_variables_index, CONFIG_ZTACX_VARIABLE_INDEX_BUCKETS);
 
 const char *ztacx_value_kind_names[ZTACX_VALUE_MAX] = {
 	"ZTACX_VALUE_STRING",
@@ -26,6 +29,7 @@ const char *ztacx_value_kind_names[ZTACX_VALUE_MAX] = {
 
 
 static int ztacx_init(void) ;
+static void ztacx_work_queues_start(void);
 SYS_INIT(ztacx_init, APPLICATION, ZTACX_INIT_PRIORITY);
 
 bool ztacx_init_done = false;
@@ -33,6 +37,16 @@ bool ztacx_init_done = false;
 SYS_MUTEX_DEFINE(ztacx_registry_mutex);
 SYS_MUTEX_DEFINE(ztacx_variables_mutex);
 
+/*
+ * Serialises writers of variable values (never held across a
+ * blocking call).  Readers of int64 values do not take it, they retry
+ * against the per-variable sequence count instead (a seqlock).
+ */
+static struct k_spinlock ztacx_value_lock;
+
+/* Protects the subscriber list of every variable */
+static struct k_spinlock ztacx_subscriber_lock;
+
 #if CONFIG_SHELL
 #include <zephyr/shell/shell.h>
 
@@ -50,7 +64,11 @@ int cmd_ztacx_status(const struct shell *shell, size_t argc, char **argv);
 int cmd_ztacx_stop(const struct shell *shell, size_t argc, char **argv);
 int cmd_ztacx_start(const struct shell *shell, size_t argc, char **argv);
 int cmd_ztacx_settings(const struct shell *shell, size_t argc, char **argv);
+#if CONFIG_ZTACX_LEAF_SETTINGS
+extern sys_slist_t ztacx_settings;
+#endif
 int cmd_ztacx_value(const struct shell *shell, size_t argc, char **argv);
+int cmd_ztacx_top(const struct shell *shell, size_t argc, char **argv);
 struct ztacx_leaf *ztacx_leaf_get(const char *name);
 
 
@@ -68,7 +86,7 @@ SHELL_STATIC_SUBCMD_SET_CREATE(
 	SHELL_CMD_ARG(leaf, &m_sub_ztacx_set,
 		"Access dynamic commands defined by ztacx leaves.", cmd_dynamic_execute, 2, 0),
 	SHELL_CMD_ARG(boot, NULL,"Initialise the ztacx framework.", cmd_ztacx_boot,0,0),
-	SHELL_CMD_ARG(status, NULL,"Show status of ztacx leaves.", cmd_ztacx_status,0,0),
+	SHELL_CMD_ARG(status, NULL,"Show status of ztacx leaves [--timing|--timing-raw].", cmd_ztacx_status,1,1),
 	SHELL_CMD(init, NULL,"Initialise a leaf.", cmd_ztacx_init),
 	SHELL_CMD(stop, NULL,"Stop a leaf.", cmd_ztacx_stop),
 	SHELL_CMD(start, NULL,"Start a leaf.", cmd_ztacx_start),
@@ -76,6 +94,15 @@ SHELL_STATIC_SUBCMD_SET_CREATE(
 	SHELL_CMD(setting, NULL,"Show/edit persistent settings.", cmd_ztacx_settings),
 #endif
 	SHELL_CMD(value, NULL,"Show/edit status of runtime variables.", cmd_ztacx_value),
+#if CONFIG_ZTACX_WORK_STATS
+	SHELL_CMD_ARG(top, NULL,"Show runtime statistics of leaf work handlers [reset].", cmd_ztacx_top,1,1),
+#endif
+#if CONFIG_ZTACX_COUNTER_JOURNAL
+	SHELL_CMD_ARG(counter, NULL,"Show persistent counters [checkpoint].", cmd_ztacx_counter,1,1),
+#endif
+#if CONFIG_ZTACX_HISTORY
+	SHELL_CMD_ARG(history, NULL,"Show variable history [<name> [window_s|dump|encode|attach <interval_ms> <depth>]].", cmd_ztacx_history,1,4),
+#endif
 	SHELL_SUBCMD_SET_END
 	);
 SHELL_CMD_REGISTER(ztacx, &m_sub_ztacx,
@@ -86,6 +113,8 @@ SHELL_CMD_REGISTER(ztacx, &m_sub_ztacx,
 static int ztacx_init(void)
 {
 	LOG_INF("ztacx_init");
+	ztacx_timing_reset();
+	int timing = ztacx_timing_begin(ZTACX_TIMING_FRAMEWORK, "ztacx_init");
 	/*
 	 * Get the device ID
 	 */
@@ -114,13 +143,39 @@ static int ztacx_init(void)
 
 	if (sys_mutex_lock(&ztacx_registry_mutex, K_NO_WAIT) != 0) {
 		LOG_ERR("ztacx registry mutex is held, that's impossible");
+		ztacx_timing_end(timing, -EWOULDBLOCK);
 		return -EWOULDBLOCK;
 	}
 	sys_slist_init(&ztacx_classes);
 	sys_slist_init(&ztacx_leaves);
 	sys_mutex_unlock(&ztacx_registry_mutex);
 
+	/*
+	 * Static classes, leaves and variable tables are enumerated from
+	 * their sections, and need no registration; the variables need
+	 * only be indexed.  Record this walk as one "class register" entry
+	 * (result is the number of static classes), runtime registrations
+	 * get an entry each.
+	 */
+	int static_timing = ztacx_timing_begin(ZTACX_TIMING_CLASS_REGISTER, "static");
+	int static_classes;
+	int static_variables;
+
+	STRUCT_SECTION_COUNT(ztacx_leaf_class, &static_classes);
+	STRUCT_SECTION_COUNT(ztacx_variable, &static_variables);
+	STRUCT_SECTION_FOREACH(ztacx_variable, v) {
+		ztacx_variable_index_add(&ztacx_variables_index, v);
+	}
+	ztacx_timing_end(static_timing, static_classes);
+	if (static_variables > 2 * CONFIG_ZTACX_VARIABLE_INDEX_BUCKETS) {
+		LOG_WRN("%d variables in %d index buckets, raise CONFIG_ZTACX_VARIABLE_INDEX_BUCKETS",
+			static_variables, CONFIG_ZTACX_VARIABLE_INDEX_BUCKETS);
+	}
+
+	ztacx_work_queues_start();
+
 	ztacx_init_done=true;
+	ztacx_timing_end(timing, 0);
 	LOG_INF("ztacx_init OK");
 	return 0;
 }
@@ -129,28 +184,48 @@ static int ztacx_init(void)
 int ztacx_class_register(struct ztacx_leaf_class *class)
 {
 	LOG_INF("ztacx_class_register %s", class->name);
+	int timing = ztacx_timing_begin(ZTACX_TIMING_CLASS_REGISTER, class->name);
 	while (sys_mutex_lock(&ztacx_registry_mutex, K_MSEC(100)) != 0) {
 		LOG_WRN("ztacx registry mutex is held too long");
 	}
 	sys_slist_append(&ztacx_classes, &class->node);
 	sys_mutex_unlock(&ztacx_registry_mutex);
+	ztacx_timing_end(timing, 0);
 	LOG_DBG("ztacx_class_register %s OK", class->name);
 	return 0;
 }
 
-int ztacx_leaf_sys_init(struct ztacx_leaf *leaf)
+/**
+ * @brief Register and initialise a leaf created at runtime
+ *
+ * Leaves defined by ZTACX_LEAF_DEFINE are found in their section, and
+ * must not be registered.  The caller starts the leaf with
+ * @ref ztacx_leaf_run_start.
+ */
+int ztacx_leaf_register(struct ztacx_leaf *leaf)
 {
-	LOG_INF("ztacx_leaf_sys_init %s", leaf->name);
-	int rc = 0;
+	LOG_INF("ztacx_leaf_register %s", leaf->name);
 
-	LOG_INF("NOTICE >INIT %s/%s", leaf->class->name,
-		leaf->name);
 	while (sys_mutex_lock(&ztacx_registry_mutex, K_MSEC(100)) != 0) {
 		LOG_WRN("ztacx registry mutex is held too long");
 	}
 	sys_slist_append(&ztacx_leaves, &leaf->node);
 	sys_mutex_unlock(&ztacx_registry_mutex);
 	leaf->ready = leaf->running = false;
+
+	return ztacx_leaf_run_init(leaf);
+}
+
+/**
+ * @brief Invoke the init callback of a leaf
+ */
+int ztacx_leaf_run_init(struct ztacx_leaf *leaf)
+{
+	int rc = 0;
+	int timing = ztacx_timing_begin(ZTACX_TIMING_LEAF_INIT, leaf->name);
+
+	LOG_INF("NOTICE >INIT %s/%s", leaf->class->name,
+		leaf->name);
 	if (leaf->class->cb->init) {
 		rc = leaf->class->cb->init(leaf);
 
@@ -167,16 +242,20 @@ int ztacx_leaf_sys_init(struct ztacx_leaf *leaf)
 		LOG_INF("NOTICE <READY %s", leaf->name);
 		leaf->ready = true;
 	}
+	ztacx_timing_end(timing, rc);
 	return rc;
 }
 
-int ztacx_leaf_sys_start(struct ztacx_leaf *leaf)
+/**
+ * @brief Invoke the start callback of a leaf that is ready
+ */
+int ztacx_leaf_run_start(struct ztacx_leaf *leaf)
 {
-	LOG_INF("ztacx_leaf_sys_start %s", leaf->name);
 	int rc = 0;
 	if (!leaf->ready) {
 		return -ESRCH;
 	}
+	int timing = ztacx_timing_begin(ZTACX_TIMING_LEAF_START, leaf->name);
 	if (leaf->class->cb->start) {
 		LOG_INF("NOTICE >START %s/%s",
 			leaf->class->name, leaf->name);
@@ -196,9 +275,264 @@ int ztacx_leaf_sys_start(struct ztacx_leaf *leaf)
 		leaf->running=true;
 		LOG_INF("NOTICE <STARTED %s", leaf->name);
 	}
+	ztacx_timing_end(timing, rc);
 	return rc;
 }
 
+/*
+ * Leaf lifecycle
+ *
+ * Static leaves (defined by ZTACX_LEAF_DEFINE) live in the ztacx_leaf
+ * iterable section.  One SYS_INIT hook runs the init phase of every
+ * static leaf, and another the start phase, each leaf only after the
+ * leaves it depends on have completed the phase.  Leaves registered at
+ * runtime run their own lifecycle (see ztacx_leaf_register).
+ */
+enum ztacx_leaf_phase_state {
+	ZTACX_LEAF_PHASE_PENDING = 0,
+	ZTACX_LEAF_PHASE_RUNNING,
+	ZTACX_LEAF_PHASE_DONE,
+};
+
+typedef int (*ztacx_leaf_phase_fn_t)(struct ztacx_leaf *leaf);
+
+/**
+ * @brief Step through every leaf, static ones first, then those registered at runtime
+ */
+static struct ztacx_leaf *ztacx_leaf_next(struct ztacx_leaf *leaf)
+{
+	struct ztacx_leaf *first;
+	int count;
+
+	STRUCT_SECTION_GET(ztacx_leaf, 0, &first);
+	STRUCT_SECTION_COUNT(ztacx_leaf, &count);
+
+	if (!leaf) {
+		return count ? first : SYS_SLIST_PEEK_HEAD_CONTAINER(&ztacx_leaves, leaf, node);
+	}
+	if ((leaf >= first) && (leaf < first + count)) {
+		if (leaf + 1 < first + count) {
+			return leaf + 1;
+		}
+		return SYS_SLIST_PEEK_HEAD_CONTAINER(&ztacx_leaves, leaf, node);
+	}
+	return SYS_SLIST_PEEK_NEXT_CONTAINER(leaf, node);
+}
+
+#define ZTACX_LEAF_FOREACH(_leaf) \
+	for (_leaf = ztacx_leaf_next(NULL); _leaf; _leaf = ztacx_leaf_next(_leaf))
+
+static bool ztacx_variable_is_static(const struct ztacx_variable *v)
+{
+	struct ztacx_variable *first;
+	int count;
+
+	STRUCT_SECTION_GET(ztacx_variable, 0, &first);
+	STRUCT_SECTION_COUNT(ztacx_variable, &count);
+	return (v >= first) && (v < first + count);
+}
+
+/**
+ * @brief Step through every variable, static tables first, then those registered at runtime
+ */
+static struct ztacx_variable *ztacx_variable_next(struct ztacx_variable *v)
+{
+	struct ztacx_variable *first;
+	int count;
+
+	STRUCT_SECTION_GET(ztacx_variable, 0, &first);
+	STRUCT_SECTION_COUNT(ztacx_variable, &count);
+
+	if (!v) {
+		return count ? first : SYS_SLIST_PEEK_HEAD_CONTAINER(&ztacx_variables, v, node);
+	}
+	if (ztacx_variable_is_static(v)) {
+		if (v + 1 < first + count) {
+			return v + 1;
+		}
+		return SYS_SLIST_PEEK_HEAD_CONTAINER(&ztacx_variables, v, node);
+	}
+	return SYS_SLIST_PEEK_NEXT_CONTAINER(v, node);
+}
+
+#define ZTACX_VARIABLE_FOREACH(_v) \
+	for (_v = ztacx_variable_next(NULL); _v; _v = ztacx_variable_next(_v))
+
+static bool ztacx_leaf_depends_done(const struct ztacx_leaf *leaf)
+{
+	if (!leaf->depends) {
+		return true;
+	}
+	for (const char *const *dep = leaf->depends; *dep; dep++) {
+		bool all = (strcmp(*dep, ZTACX_LEAF_DEPENDS_ALL) == 0);
+		bool found = all;
+
+		STRUCT_SECTION_FOREACH(ztacx_leaf, other) {
+			if ((other == leaf) || (!all && (strcmp(other->name, *dep) != 0))) {
+				continue;
+			}
+			found = true;
+			if (other->phase != ZTACX_LEAF_PHASE_DONE) {
+				return false;
+			}
+		}
+		if (!found) {
+			LOG_WRN("Leaf %s depends on unknown leaf %s", leaf->name, *dep);
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Run any leaves still pending, after a dependency cycle stalled a phase
+ */
+static void ztacx_leaf_phase_break_cycle(ztacx_leaf_phase_fn_t fn)
+{
+	STRUCT_SECTION_FOREACH(ztacx_leaf, leaf) {
+		if (leaf->phase == ZTACX_LEAF_PHASE_PENDING) {
+			LOG_ERR("Leaf %s is in a dependency cycle, running it anyway", leaf->name);
+			leaf->phase = ZTACX_LEAF_PHASE_RUNNING;
+			(void)fn(leaf);
+			leaf->phase = ZTACX_LEAF_PHASE_DONE;
+		}
+	}
+}
+
+#if CONFIG_ZTACX_LEAF_PARALLEL_INIT
+/*
+ * Parallel leaf lifecycle
+ *
+ * A dispatcher, run once for the init phase and once for the start
+ * phase, hands each leaf whose dependencies have completed the phase to
+ * a pool of worker threads, and returns when every leaf has completed it.
+ */
+K_THREAD_STACK_ARRAY_DEFINE(ztacx_leaf_worker_stacks, CONFIG_ZTACX_LEAF_INIT_THREADS,
+			    CONFIG_ZTACX_LEAF_INIT_STACK_SIZE);
+static struct k_thread ztacx_leaf_workers[CONFIG_ZTACX_LEAF_INIT_THREADS];
+K_MSGQ_DEFINE(ztacx_leaf_queue, sizeof(struct ztacx_leaf *), 8, sizeof(void *));
+static K_SEM_DEFINE(ztacx_leaf_done, 0, K_SEM_MAX_LIMIT);
+static ztacx_leaf_phase_fn_t ztacx_leaf_phase_fn;
+
+static void ztacx_leaf_worker(void *p1, void *p2, void *p3)
+{
+	struct ztacx_leaf *leaf;
+
+	while (k_msgq_get(&ztacx_leaf_queue, &leaf, K_FOREVER) == 0) {
+		if (!leaf) {
+			// end of phase
+			return;
+		}
+		(void)ztacx_leaf_phase_fn(leaf);
+		leaf->phase = ZTACX_LEAF_PHASE_DONE;
+		k_sem_give(&ztacx_leaf_done);
+	}
+}
+
+static int ztacx_leaf_dispatch(const char *phase_name, ztacx_leaf_phase_fn_t fn)
+{
+	struct ztacx_leaf *leaf;
+	int in_flight = 0;
+
+	LOG_INF("NOTICE >%s leaves in parallel", phase_name);
+	ztacx_leaf_phase_fn = fn;
+	for (int i=0; i<CONFIG_ZTACX_LEAF_INIT_THREADS; i++) {
+		k_thread_create(&ztacx_leaf_workers[i], ztacx_leaf_worker_stacks[i],
+				K_THREAD_STACK_SIZEOF(ztacx_leaf_worker_stacks[i]),
+				ztacx_leaf_worker, NULL, NULL, NULL,
+				CONFIG_ZTACX_LEAF_INIT_THREAD_PRIORITY, 0, K_NO_WAIT);
+		k_thread_name_set(&ztacx_leaf_workers[i], "ztacx_leaf");
+	}
+
+	while (true) {
+		bool pending = false;
+
+		STRUCT_SECTION_FOREACH(ztacx_leaf, next) {
+			if (next->phase != ZTACX_LEAF_PHASE_PENDING) {
+				continue;
+			}
+			pending = true;
+			if (ztacx_leaf_depends_done(next)) {
+				next->phase = ZTACX_LEAF_PHASE_RUNNING;
+				k_msgq_put(&ztacx_leaf_queue, &next, K_FOREVER);
+				in_flight++;
+			}
+		}
+		if (in_flight == 0) {
+			if (pending) {
+				// nothing can make progress
+				ztacx_leaf_phase_break_cycle(fn);
+			}
+			break;
+		}
+		k_sem_take(&ztacx_leaf_done, K_FOREVER);
+		in_flight--;
+	}
+
+	for (int i=0; i<CONFIG_ZTACX_LEAF_INIT_THREADS; i++) {
+		leaf = NULL;
+		k_msgq_put(&ztacx_leaf_queue, &leaf, K_FOREVER);
+	}
+	for (int i=0; i<CONFIG_ZTACX_LEAF_INIT_THREADS; i++) {
+		k_thread_join(&ztacx_leaf_workers[i], K_FOREVER);
+	}
+	LOG_INF("NOTICE <%s leaves in parallel", phase_name);
+	return 0;
+}
+#endif
+
+/**
+ * @brief Run one lifecycle phase on every static leaf, in dependency order
+ */
+static int ztacx_leaf_phase(const char *phase_name, ztacx_leaf_phase_fn_t fn)
+{
+	STRUCT_SECTION_FOREACH(ztacx_leaf, leaf) {
+		leaf->phase = ZTACX_LEAF_PHASE_PENDING;
+	}
+#if CONFIG_ZTACX_LEAF_PARALLEL_INIT
+	return ztacx_leaf_dispatch(phase_name, fn);
+#else
+	bool pending;
+	bool progress;
+
+	do {
+		pending = progress = false;
+		STRUCT_SECTION_FOREACH(ztacx_leaf, leaf) {
+			if (leaf->phase != ZTACX_LEAF_PHASE_PENDING) {
+				continue;
+			}
+			if (!ztacx_leaf_depends_done(leaf)) {
+				pending = true;
+				continue;
+			}
+			leaf->phase = ZTACX_LEAF_PHASE_RUNNING;
+			(void)fn(leaf);
+			leaf->phase = ZTACX_LEAF_PHASE_DONE;
+			progress = true;
+		}
+	} while (pending && progress);
+
+	if (pending) {
+		ztacx_leaf_phase_break_cycle(fn);
+	}
+	return 0;
+#endif
+}
+
+static int ztacx_leaves_init(void)
+{
+	return ztacx_leaf_phase("INIT", ztacx_leaf_run_init);
+}
+SYS_INIT(ztacx_leaves_init, APPLICATION, ZTACX_LEAF_INIT_PRIORITY);
+
+static int ztacx_leaves_start(void)
+{
+	// on wake from system off, pick up where we left off before any
+	// leaf starts (the settings leaf has done so already, if present)
+	ztacx_retained_restore();
+	return ztacx_leaf_phase("START", ztacx_leaf_run_start);
+}
+SYS_INIT(ztacx_leaves_start, APPLICATION, ZTACX_LEAF_START_PRIORITY);
+
 #if CONFIG_SHELL
 /* comparison function for sorting shell commands with qsort */
 
@@ -213,7 +547,12 @@ int ztacx_shell_cmd_register(struct shell_static_entry entry)
 {
 	LOG_INF("ztacx_shell_cmd_register %s", entry.syntax);
 
+	// leaves may register commands concurrently (parallel init)
+	while (sys_mutex_lock(&ztacx_registry_mutex, K_MSEC(100)) != 0) {
+		LOG_WRN("ztacx registry mutex is held too long");
+	}
 	if (dynamic_cmd_cnt >= MAX_CMD_CNT) {
+		sys_mutex_unlock(&ztacx_registry_mutex);
 		LOG_ERR("Ztacx shell command table is full");
 		return -ENOMEM;
 	}
@@ -221,6 +560,7 @@ int ztacx_shell_cmd_register(struct shell_static_entry entry)
 
 	qsort(dynamic_cmd_table, dynamic_cmd_cnt,
 	      sizeof(struct shell_static_entry), shell_cmd_cmp);
+	sys_mutex_unlock(&ztacx_registry_mutex);
 
 	return 0;
 }
@@ -249,11 +589,20 @@ int cmd_ztacx_status(const struct shell *shell, size_t argc, char **argv)
 		shell_print(shell, "ztacx is not initialised");
 		return 0;
 	}
+#if CONFIG_ZTACX_BOOT_TIMING
+	if ((argc > 1) && (strcmp(argv[1], "--timing")==0)) {
+		ztacx_timing_show(shell, false);
+		return 0;
+	}
+	if ((argc > 1) && (strcmp(argv[1], "--timing-raw")==0)) {
+		ztacx_timing_show(shell, true);
+		return 0;
+	}
+#endif
 	shell_print(shell, "ztacx is initialised");
 
-	sys_slist_t *list = &ztacx_leaves;
 	struct ztacx_leaf *leaf;
-	SYS_SLIST_FOR_EACH_CONTAINER(list, leaf, node) {
+	ZTACX_LEAF_FOREACH(leaf) {
 		shell_print(shell, "%s: %s %s", (leaf->name), leaf->ready?"READY":"FAILED", leaf->running?"RUNNING":"STOPPED");
 	}
 
@@ -278,8 +627,12 @@ int cmd_ztacx_init(const struct shell *shell, size_t argc, char **argv)
 {
 	LOG_DBG("");
 	struct ztacx_leaf *leaf = ztacx_leaf_get(argv[1]);
+	if (!leaf) {
+		shell_print(shell, "No leaf named '%s'", argv[1]);
+		return -ENOENT;
+	}
 
-	int rc  = ztacx_leaf_sys_init(leaf);
+	int rc  = ztacx_leaf_run_init(leaf);
 	if (rc == 0) {
 		shell_print(shell, "started");
 	}
@@ -318,6 +671,16 @@ int cmd_ztacx_stop(const struct shell *shell, size_t argc, char **argv)
 	return rc;
 }
 
+static bool ztacx_variable_prefix_filter(const struct ztacx_variable *v, void *arg)
+{
+	const char *prefix = arg;
+
+	char name[CONFIG_ZTACX_VALUE_NAME_MAX];
+
+	ztacx_variable_name(v, name, sizeof(name));
+	return strncmp(name, prefix, strlen(prefix)) == 0;
+}
+
 /**
  * Implementation of the "ztacx value" CLI component
  */
@@ -327,11 +690,10 @@ int cmd_ztacx_value(const struct shell *shell, size_t argc, char **argv)
 
 	if ((argc == 1) ||
 	    ((argc >= 2) && ((strcmp(argv[1], "list")==0) || (strcmp(argv[1], "show")==0)))) {
-		sys_slist_t *list = &ztacx_variables;
 		struct ztacx_variable *s;
 		char desc[132];
 
-		SYS_SLIST_FOR_EACH_CONTAINER(list, s, node) {
+		ZTACX_VARIABLE_FOREACH(s) {
 			ztacx_variable_describe(desc,sizeof(desc), s);
 			shell_print(shell, "%s", desc);
 		}
@@ -357,13 +719,82 @@ int cmd_ztacx_value(const struct shell *shell, size_t argc, char **argv)
 			return -EINVAL;
 		}
 	}
-#if CONFIG_APP_RETENTION
+	else if (strcmp(argv[1], "dump")==0) {
+		static uint8_t frame[CONFIG_ZTACX_SNAPSHOT_SHELL_BUFFER];
+		const char *prefix = (argc > 2) ? argv[2] : NULL;
+		int len = ztacx_variables_encode(frame, sizeof(frame),
+						 prefix ? ztacx_variable_prefix_filter : NULL,
+						 (void *)prefix);
+		if (len < 0) {
+			shell_print(shell, "Snapshot encode failed (%d)", len);
+			return len;
+		}
+		shell_print(shell, "Snapshot of %d variables, %d bytes",
+			    (int)sys_get_le16(frame+2), len);
+		shell_hexdump(shell, frame, len);
+	}
+	else if (strcmp(argv[1], "bench")==0) {
+		static uint8_t frame[CONFIG_ZTACX_SNAPSHOT_SHELL_BUFFER];
+		struct ztacx_variable *s;
+		char desc[132];
+		int rounds = (argc > 2) ? atoi(argv[2]) : 100;
+		uint32_t start;
+		uint32_t describe_cycles;
+		uint32_t encode_cycles;
+		int text_len = 0;
+		int len = 0;
+
+		start = k_cycle_get_32();
+		for (int i=0; i<rounds; i++) {
+			text_len = 0;
+			ZTACX_VARIABLE_FOREACH(s) {
+				ztacx_variable_describe(desc,sizeof(desc), s);
+				text_len += strlen(desc);
+			}
+		}
+		describe_cycles = k_cycle_get_32() - start;
+
+		start = k_cycle_get_32();
+		for (int i=0; i<rounds; i++) {
+			len = ztacx_variables_encode(frame, sizeof(frame), NULL, NULL);
+		}
+		encode_cycles = k_cycle_get_32() - start;
+
+		shell_print(shell, "describe: %u us per table (%d bytes of text)",
+			    k_cyc_to_us_floor32(describe_cycles / MAX(rounds, 1)), text_len);
+		shell_print(shell, "encode:   %u us per table (%d bytes of frame)",
+			    k_cyc_to_us_floor32(encode_cycles / MAX(rounds, 1)), len);
+	}
+	else if (strcmp(argv[1], "ram")==0) {
+		struct ztacx_variable *s;
+		int count = 0;
+		int settings = 0;
+
+		ZTACX_VARIABLE_FOREACH(s) {
+			count++;
+		}
+#if CONFIG_ZTACX_LEAF_SETTINGS
+		settings = sys_slist_len(&ztacx_settings);
+#endif
+		// before names were kept in flash, each variable held a
+		// CONFIG_ZTACX_VALUE_NAME_MAX array in place of two pointers
+		shell_print(shell, "%d variables, %d settings, %u bytes each: %u bytes",
+			    count, settings, (unsigned)sizeof(struct ztacx_variable),
+			    (unsigned)((count + settings) * sizeof(struct ztacx_variable)));
+		shell_print(shell, "names in flash save %u bytes",
+			    (unsigned)((count + settings) *
+				       (CONFIG_ZTACX_VALUE_NAME_MAX - 2 * sizeof(const char *))));
+	}
+#if CONFIG_ZTACX_RETAINED
+	else if (strcmp(argv[1], "retained")==0) {
+		ztacx_retained_show(shell);
+	}
 	else if (strcmp(argv[1], "unretain")==0) {
-		retained_erase();
+		ztacx_retained_erase();
 	}
 #endif
 	else {
-		shell_print(shell, "ztacx value <list|get|set|unretain>\n");
+		shell_print(shell, "ztacx value <list|get|set|dump|bench|ram|retained|unretain>\n");
 	}
 
 	return 0;
@@ -374,95 +805,895 @@ int cmd_ztacx_value(const struct shell *shell, size_t argc, char **argv)
 
 void ztacx_variables_show()
 {
-	sys_slist_t *list = &ztacx_variables;
 	struct ztacx_variable *s;
 	char desc[132];
 	LOG_INF("Current runtime values:");
-	SYS_SLIST_FOR_EACH_CONTAINER(list, s, node) {
+	ZTACX_VARIABLE_FOREACH(s) {
 		ztacx_variable_describe(desc,sizeof(desc), s);
 		LOG_INF("    %s", desc);
 	}
 }
 
-struct ztacx_variable *ztacx_variables_copy(struct ztacx_variable *dst, const struct ztacx_variable *src, int count, const char *prefix)
+/**
+ * Encode one variable as a snapshot record, with the value lock held
+ */
+static int ztacx_variable_encode(uint8_t *buf, size_t buf_max, const struct ztacx_variable *v)
 {
-	int size = count * sizeof(struct ztacx_variable);
-	if (!dst) return NULL;
-
-	memcpy(dst, src, size);
+	uint8_t *p = buf + ZTACX_SNAPSHOT_RECORD_HEADER_SIZE;
+	int len;
 
-	if (prefix != NULL) {
-		// prepend supplied prefix to each variable name
-		for (int i=0; i<count; i++) {
-			int prefix_len = strlen(prefix);
-			int name_len = strlen(dst[i].name);
-			if (name_len + prefix_len >= (CONFIG_ZTACX_VALUE_NAME_MAX)) {
-				LOG_ERR("Name overflow for %s_ + %s",
-					prefix, dst[i].name);
-				continue;
-			}
-			memmove(dst[i].name+prefix_len+1, dst[i].name, name_len);
-			memcpy(dst[i].name, prefix, prefix_len);
-			dst[i].name[prefix_len]='_';
-		}
+	switch (v->kind) {
+	case ZTACX_VALUE_STRING:
+		len = v->value.val_string ? strlen(v->value.val_string) : 0;
+		len = MIN(len, UINT8_MAX);
+		break;
+	case ZTACX_VALUE_BOOL:
+	case ZTACX_VALUE_BYTE:
+		len = 1;
+		break;
+	case ZTACX_VALUE_UINT16:
+	case ZTACX_VALUE_INT16:
+		len = 2;
+		break;
+	case ZTACX_VALUE_INT32:
+		len = 4;
+		break;
+	case ZTACX_VALUE_INT64:
+		len = 8;
+		break;
+	default:
+		// events have no value to snapshot
+		return 0;
 	}
-
-	return dst;
-}
-
-struct ztacx_variable *ztacx_variables_dup(const struct ztacx_variable *v, int count, const char *prefix)
-{
-	int size = count * sizeof(struct ztacx_variable);
-	struct ztacx_variable *result = malloc(size);
-	if (!result) return NULL;
-	return ztacx_variables_copy(result, v, count, prefix);
-}
-
-struct ztacx_leaf *ztacx_leaf_get(const char *name)
-{
-	sys_slist_t *list = &ztacx_leaves;
-	struct ztacx_leaf *leaf;
-
-	SYS_SLIST_FOR_EACH_CONTAINER(list, leaf, node) {
-		if (strcmp(leaf->name, name)==0) {
-			return leaf;
-		}
+	if (ZTACX_SNAPSHOT_RECORD_HEADER_SIZE + len > buf_max) {
+		return -ENOSPC;
 	}
-	return NULL;
-}
 
-struct ztacx_leaf *ztacx_leaf_find(const char *class, void *compare, ztacx_leaf_find_cb_t cb)
-{
-	sys_slist_t *list = &ztacx_leaves;
-	struct ztacx_leaf *leaf;
+	sys_put_le32(v->hash, buf);
+	buf[4] = (uint8_t)v->kind;
+	buf[5] = (uint8_t)len;
 
-	SYS_SLIST_FOR_EACH_CONTAINER(list, leaf, node) {
-		if (class && (strcmp(leaf->class->name, class) != 0)) {
-			// does not match the class filter
-			continue;
-		}
-		if (cb(leaf, compare) == 0) {
-			return leaf;
-		}
+	switch (v->kind) {
+	case ZTACX_VALUE_STRING:
+		memcpy(p, v->value.val_string, len);
+		break;
+	case ZTACX_VALUE_BOOL:
+		*p = v->value.val_bool;
+		break;
+	case ZTACX_VALUE_BYTE:
+		*p = v->value.val_byte;
+		break;
+	case ZTACX_VALUE_UINT16:
+		sys_put_le16(v->value.val_uint16, p);
+		break;
+	case ZTACX_VALUE_INT16:
+		sys_put_le16((uint16_t)v->value.val_int16, p);
+		break;
+	case ZTACX_VALUE_INT32:
+		sys_put_le32((uint32_t)v->value.val_int32, p);
+		break;
+	default:
+		sys_put_le64((uint64_t)v->value.val_int64, p);
+		break;
 	}
-	return NULL;
+	return ZTACX_SNAPSHOT_RECORD_HEADER_SIZE + len;
 }
 
-int ztacx_leaf_start(const char *name)
+/**
+ * @brief Encode one variable as a snapshot record (see @ref ZTACX_SNAPSHOT_MAGIC)
+ *
+ * @return the record length, 0 if the variable has no value to encode,
+ * or -ENOSPC if the buffer is too small
+ */
+int ztacx_variable_encode_record(uint8_t *buf, size_t buf_max, const struct ztacx_variable *v)
 {
-	struct ztacx_leaf *leaf = ztacx_leaf_get(name);
-	if (!name) return -ENOENT;
-	int rc=0;
+	k_spinlock_key_t key = k_spin_lock(&ztacx_value_lock);
+	int rc = ztacx_variable_encode(buf, buf_max, v);
 
-
-	if (leaf->class->cb->start) {
-		rc = leaf->class->cb->start(leaf);
-	}
-	if (rc == 0) leaf->running=true;
+	k_spin_unlock(&ztacx_value_lock, key);
 	return rc;
 }
 
-int ztacx_leaf_stop(const char *name)
+/**
+ * @brief Restore the value of a variable from a snapshot record
+ *
+ * The record must carry the id (name hash) and kind of the variable.
+ *
+ * @return the record length, or a negative error code
+ */
+int ztacx_variable_decode_record(struct ztacx_variable *v, const uint8_t *buf, size_t len)
+{
+	const uint8_t *p = buf + ZTACX_SNAPSHOT_RECORD_HEADER_SIZE;
+	int value_len;
+	union ztacx_value value;
+	char string[UINT8_MAX+1];
+	int rc;
+
+	if (len < ZTACX_SNAPSHOT_RECORD_HEADER_SIZE) {
+		return -EINVAL;
+	}
+	value_len = buf[5];
+	if ((ZTACX_SNAPSHOT_RECORD_HEADER_SIZE + value_len > len) ||
+	    (sys_get_le32(buf) != v->hash) || (buf[4] != v->kind)) {
+		return -EINVAL;
+	}
+
+	switch (v->kind) {
+	case ZTACX_VALUE_STRING:
+		memcpy(string, p, value_len);
+		string[value_len] = '\0';
+		rc = ztacx_variable_value_set(v, string);
+		break;
+	case ZTACX_VALUE_BOOL:
+		value.val_bool = (value_len == 1) && *p;
+		rc = ztacx_variable_value_set(v, &value.val_bool);
+		break;
+	case ZTACX_VALUE_BYTE:
+		value.val_byte = *p;
+		rc = (value_len == 1) ? ztacx_variable_value_set(v, &value.val_byte) : -EINVAL;
+		break;
+	case ZTACX_VALUE_UINT16:
+		value.val_uint16 = sys_get_le16(p);
+		rc = (value_len == 2) ? ztacx_variable_value_set(v, &value.val_uint16) : -EINVAL;
+		break;
+	case ZTACX_VALUE_INT16:
+		value.val_int16 = (int16_t)sys_get_le16(p);
+		rc = (value_len == 2) ? ztacx_variable_value_set(v, &value.val_int16) : -EINVAL;
+		break;
+	case ZTACX_VALUE_INT32:
+		value.val_int32 = (int32_t)sys_get_le32(p);
+		rc = (value_len == 4) ? ztacx_variable_value_set(v, &value.val_int32) : -EINVAL;
+		break;
+	case ZTACX_VALUE_INT64:
+		value.val_int64 = (int64_t)sys_get_le64(p);
+		rc = (value_len == 8) ? ztacx_variable_value_set(v, &value.val_int64) : -EINVAL;
+		break;
+	default:
+		rc = -EINVAL;
+		break;
+	}
+	return (rc < 0) ? rc : (ZTACX_SNAPSHOT_RECORD_HEADER_SIZE + value_len);
+}
+
+/**
+ * @brief Encode the registered variables as a compact binary snapshot
+ *
+ * Writes a frame as described at @ref ZTACX_SNAPSHOT_MAGIC, in a single
+ * pass with no allocation.  Each record is read under the value lock,
+ * which is dropped between records (and never held across the filter),
+ * so a batch committed during the walk may be seen in part.  A variable
+ * with history is followed by its history blocks.
+ *
+ * @param filter if not NULL, only variables for which it returns true are encoded
+ * @return the frame length, or -ENOSPC if the buffer is too small
+ */
+int ztacx_variables_encode(uint8_t *buf, size_t buf_max, ztacx_variable_filter_t filter, void *arg)
+{
+	struct ztacx_variable *v;
+	size_t pos = ZTACX_SNAPSHOT_HEADER_SIZE;
+	int count = 0;
+	int rc = 0;
+
+	if (buf_max < ZTACX_SNAPSHOT_HEADER_SIZE) {
+		return -ENOSPC;
+	}
+
+	ZTACX_VARIABLE_FOREACH(v) {
+		if (filter && !filter(v, arg)) {
+			continue;
+		}
+		rc = ztacx_variable_encode_record(buf + pos, buf_max - pos, v);
+		if (rc < 0) {
+			break;
+		}
+		if (rc > 0) {
+			pos += rc;
+			count++;
+		}
+		rc = ztacx_history_encode_records(v, buf + pos, buf_max - pos, &count);
+		if (rc < 0) {
+			break;
+		}
+		pos += rc;
+	}
+	if (rc < 0) {
+		return rc;
+	}
+
+	buf[0] = ZTACX_SNAPSHOT_MAGIC;
+	buf[1] = ZTACX_SNAPSHOT_VERSION;
+	sys_put_le16(count, buf+2);
+	return pos;
+}
+
+/**
+ * @brief Copy a template table of variables for one instance of a leaf
+ *
+ * The prefix is not copied, it must outlive the copies (a leaf name will do).
+ */
+struct ztacx_variable *ztacx_variables_copy(struct ztacx_variable *dst, const struct ztacx_variable *src, int count, const char *prefix)
+{
+	int size = count * sizeof(struct ztacx_variable);
+	if (!dst) return NULL;
+
+	memcpy(dst, src, size);
+
+	if (prefix != NULL) {
+		// the names stay in flash, each copy records the prefix
+		for (int i=0; i<count; i++) {
+			dst[i].prefix = prefix;
+		}
+	}
+
+	// each instance of an inline string needs its own buffer
+	for (int i=0; i<count; i++) {
+		if ((dst[i].kind != ZTACX_VALUE_STRING) || !dst[i].capacity) {
+			continue;
+		}
+		char *buf = malloc(dst[i].capacity);
+		if (!buf) {
+			LOG_ERR("No memory for inline string " ZTACX_VARIABLE_NAME_FMT,
+				ZTACX_VARIABLE_NAME_ARG(&dst[i]));
+			// give back the buffers of the copies made so far
+			while (i-- > 0) {
+				if ((dst[i].kind == ZTACX_VALUE_STRING) && dst[i].capacity) {
+					free(dst[i].value.val_string);
+					dst[i].value.val_string = NULL;
+				}
+			}
+			return NULL;
+		}
+		memcpy(buf, src[i].value.val_string, dst[i].capacity);
+		dst[i].value.val_string = buf;
+	}
+
+	return dst;
+}
+
+struct ztacx_variable *ztacx_variables_dup(const struct ztacx_variable *v, int count, const char *prefix)
+{
+	int size = count * sizeof(struct ztacx_variable);
+	struct ztacx_variable *result = malloc(size);
+	if (!result) return NULL;
+	if (!ztacx_variables_copy(result, v, count, prefix)) {
+		free(result);
+		return NULL;
+	}
+	return result;
+}
+
+struct ztacx_leaf *ztacx_leaf_get(const char *name)
+{
+	struct ztacx_leaf *leaf;
+
+	ZTACX_LEAF_FOREACH(leaf) {
+		if (strcmp(leaf->name, name)==0) {
+			return leaf;
+		}
+	}
+	return NULL;
+}
+
+struct ztacx_leaf *ztacx_leaf_find(const char *class, void *compare, ztacx_leaf_find_cb_t cb)
+{
+	struct ztacx_leaf *leaf;
+
+	ZTACX_LEAF_FOREACH(leaf) {
+		if (class && (strcmp(leaf->class->name, class) != 0)) {
+			// does not match the class filter
+			continue;
+		}
+		if (cb(leaf, compare) == 0) {
+			return leaf;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Work queues
+ *
+ * Leaf work runs on the queue of its leaf's work class.  Until the
+ * queues are started (and if CONFIG_ZTACX_WORK_QUEUES is off) every
+ * class maps to the system work queue.
+ */
+static const char *ztacx_work_class_names[ZTACX_WORK_CLASS_MAX] = {
+	"interactive",
+	"realtime",
+	"background",
+};
+
+#if CONFIG_ZTACX_WORK_QUEUES
+K_THREAD_STACK_DEFINE(ztacx_workq_interactive_stack, CONFIG_ZTACX_WORKQ_INTERACTIVE_STACK_SIZE);
+K_THREAD_STACK_DEFINE(ztacx_workq_realtime_stack, CONFIG_ZTACX_WORKQ_REALTIME_STACK_SIZE);
+K_THREAD_STACK_DEFINE(ztacx_workq_background_stack, CONFIG_ZTACX_WORKQ_BACKGROUND_STACK_SIZE);
+static struct k_work_q ztacx_work_queues[ZTACX_WORK_CLASS_MAX];
+static bool ztacx_work_queues_started;
+#endif
+
+static void ztacx_work_queues_start(void)
+{
+#if CONFIG_ZTACX_WORK_QUEUES
+	static const char *thread_names[ZTACX_WORK_CLASS_MAX] = {
+		"ztacx_interactive",
+		"ztacx_realtime",
+		"ztacx_background",
+	};
+	k_thread_stack_t *stacks[ZTACX_WORK_CLASS_MAX] = {
+		ztacx_workq_interactive_stack,
+		ztacx_workq_realtime_stack,
+		ztacx_workq_background_stack,
+	};
+	const size_t stack_sizes[ZTACX_WORK_CLASS_MAX] = {
+		K_THREAD_STACK_SIZEOF(ztacx_workq_interactive_stack),
+		K_THREAD_STACK_SIZEOF(ztacx_workq_realtime_stack),
+		K_THREAD_STACK_SIZEOF(ztacx_workq_background_stack),
+	};
+	const int priorities[ZTACX_WORK_CLASS_MAX] = {
+		CONFIG_ZTACX_WORKQ_INTERACTIVE_PRIORITY,
+		CONFIG_ZTACX_WORKQ_REALTIME_PRIORITY,
+		CONFIG_ZTACX_WORKQ_BACKGROUND_PRIORITY,
+	};
+
+	if (ztacx_work_queues_started) {
+		return;
+	}
+	for (int i=0; i<ZTACX_WORK_CLASS_MAX; i++) {
+		struct k_work_queue_config cfg = {.name = thread_names[i]};
+		k_work_queue_start(&ztacx_work_queues[i], stacks[i], stack_sizes[i], priorities[i], &cfg);
+	}
+	ztacx_work_queues_started = true;
+#endif
+}
+
+/**
+ * @brief Get the work queue that runs work of a given class
+ */
+struct k_work_q *ztacx_work_queue(enum ztacx_work_class work_class)
+{
+#if CONFIG_ZTACX_WORK_QUEUES
+	if (ztacx_work_queues_started && (work_class < ZTACX_WORK_CLASS_MAX)) {
+		return &ztacx_work_queues[work_class];
+	}
+#endif
+	return &k_sys_work_q;
+}
+
+static struct k_work_q *ztacx_leaf_work_queue(const struct ztacx_leaf_work *lw)
+{
+	return ztacx_work_queue(lw->work_class);
+}
+
+#if CONFIG_ZTACX_WORK_STATS
+/*
+ * Leaf work statistics
+ *
+ * Leaf work handlers are called via a trampoline that times each run,
+ * and compares its start with the time the work was due (recorded when
+ * it was scheduled).  A summary of each work item is published every
+ * CONFIG_ZTACX_WORK_STATS_INTERVAL_MS as variables named
+ * <leaf>_<work>_<stat>, and shown by 'ztacx top'.
+ */
+enum ztacx_work_stat {
+	ZTACX_WORK_STAT_RUNS=0,
+	ZTACX_WORK_STAT_MIN,
+	ZTACX_WORK_STAT_MEAN,
+	ZTACX_WORK_STAT_MAX,
+	ZTACX_WORK_STAT_P99,
+	ZTACX_WORK_STAT_PERIOD,
+	ZTACX_WORK_STAT_LATE,
+	ZTACX_WORK_STAT_OVERRUNS,
+	ZTACX_WORK_STAT_MAX_
+};
+
+static const struct ztacx_variable ztacx_work_stats_template[ZTACX_WORK_STAT_MAX_] = {
+	{"runs", ZTACX_VALUE_INT32, {.val_int32=0}},
+	{"min_us", ZTACX_VALUE_INT32, {.val_int32=0}},
+	{"mean_us", ZTACX_VALUE_INT32, {.val_int32=0}},
+	{"max_us", ZTACX_VALUE_INT32, {.val_int32=0}},
+	{"p99_us", ZTACX_VALUE_INT32, {.val_int32=0}},
+	{"period_us", ZTACX_VALUE_INT32, {.val_int32=0}},
+	{"late_us", ZTACX_VALUE_INT32, {.val_int32=0}},
+	{"overruns", ZTACX_VALUE_INT32, {.val_int32=0}},
+};
+
+/*
+ * Per-queue latency is the lateness of each run of leaf work on the
+ * queue; backlog is the number of its leaf work items that are queued
+ * but not yet running, sampled at each statistics refresh.
+ */
+struct ztacx_work_queue_stats
+{
+	uint32_t runs;
+	uint64_t total_late_ticks;
+	uint32_t max_late_ticks;
+	uint32_t backlog;
+	uint32_t max_backlog;
+};
+
+enum ztacx_work_queue_stat {
+	ZTACX_WORK_QUEUE_STAT_BACKLOG=0,
+	ZTACX_WORK_QUEUE_STAT_LATENCY,
+	ZTACX_WORK_QUEUE_STAT_MAX_LATENCY,
+	ZTACX_WORK_QUEUE_STAT_MAX_
+};
+
+static ZTACX_VARIABLES_DEFINE(ztacx_work_queue_values) = {
+	{"workq_interactive_backlog", ZTACX_VALUE_INT32, {.val_int32=0}},
+	{"workq_interactive_latency_us", ZTACX_VALUE_INT32, {.val_int32=0}},
+	{"workq_interactive_max_latency_us", ZTACX_VALUE_INT32, {.val_int32=0}},
+	{"workq_realtime_backlog", ZTACX_VALUE_INT32, {.val_int32=0}},
+	{"workq_realtime_latency_us", ZTACX_VALUE_INT32, {.val_int32=0}},
+	{"workq_realtime_max_latency_us", ZTACX_VALUE_INT32, {.val_int32=0}},
+	{"workq_background_backlog", ZTACX_VALUE_INT32, {.val_int32=0}},
+	{"workq_background_latency_us", ZTACX_VALUE_INT32, {.val_int32=0}},
+	{"workq_background_max_latency_us", ZTACX_VALUE_INT32, {.val_int32=0}},
+};
+
+BUILD_ASSERT(ARRAY_SIZE(ztacx_work_queue_values) == ZTACX_WORK_CLASS_MAX * ZTACX_WORK_QUEUE_STAT_MAX_);
+
+static struct ztacx_work_queue_stats ztacx_work_queue_stats[ZTACX_WORK_CLASS_MAX];
+static sys_slist_t ztacx_works;
+static struct k_spinlock ztacx_work_stats_lock;
+static void ztacx_work_stats_refresh(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(ztacx_work_stats_work, ztacx_work_stats_refresh);
+
+static void ztacx_leaf_work_run(struct k_work *work)
+{
+	struct ztacx_leaf_work *lw = ztacx_leaf_work_get(work);
+	struct ztacx_work_stats *s = &lw->stats;
+	k_spinlock_key_t key = k_spin_lock(&ztacx_work_stats_lock);
+	int64_t now = k_uptime_ticks();
+	int64_t expected = s->expected;
+	uint32_t requested = s->requested_ticks;
+	uint32_t late = 0;
+
+	// the handler usually reschedules itself, which overwrites these
+	s->expected = 0;
+	if (expected && (now > expected)) {
+		late = now - expected;
+	}
+	if (s->last_start) {
+		s->period_ticks = now - s->last_start;
+	}
+	s->last_start = now;
+	k_spin_unlock(&ztacx_work_stats_lock, key);
+
+	uint32_t start = k_cycle_get_32();
+	lw->handler(work);
+	uint32_t cycles = k_cycle_get_32() - start;
+	uint32_t us = k_cyc_to_us_floor32(cycles);
+	int bucket = us ? MIN(32 - __builtin_clz(us), ZTACX_WORK_STATS_BUCKETS-1) : 0;
+
+	key = k_spin_lock(&ztacx_work_stats_lock);
+	s->runs++;
+	s->total_cycles += cycles;
+	s->min_cycles = MIN(s->min_cycles, cycles);
+	s->max_cycles = MAX(s->max_cycles, cycles);
+	s->hist[bucket]++;
+	s->max_late_ticks = MAX(s->max_late_ticks, late);
+	if (requested && ((late > requested) || (k_cyc_to_ticks_floor32(cycles) > requested))) {
+		s->overruns++;
+	}
+
+	struct ztacx_work_queue_stats *qs = &ztacx_work_queue_stats[lw->work_class];
+	qs->runs++;
+	qs->total_late_ticks += late;
+	qs->max_late_ticks = MAX(qs->max_late_ticks, late);
+	k_spin_unlock(&ztacx_work_stats_lock, key);
+}
+
+static void ztacx_leaf_work_expect_at(struct ztacx_leaf_work *lw, int64_t due, uint32_t period)
+{
+	k_spinlock_key_t key = k_spin_lock(&ztacx_work_stats_lock);
+	lw->stats.requested_ticks = period;
+	lw->stats.expected = due;
+	k_spin_unlock(&ztacx_work_stats_lock, key);
+}
+
+static void ztacx_leaf_work_expect(struct ztacx_leaf_work *lw, k_timeout_t delay)
+{
+	if (delay.ticks < 0) {
+		// K_FOREVER or an absolute timeout
+		return;
+	}
+	ztacx_leaf_work_expect_at(lw, k_uptime_ticks() + delay.ticks, delay.ticks);
+}
+
+/**
+ * @brief Sample the backlog of each queue (registry mutex held)
+ */
+static void ztacx_work_queue_sample(void)
+{
+	struct ztacx_leaf_work *lw;
+	uint32_t backlog[ZTACX_WORK_CLASS_MAX] = {0};
+
+	SYS_SLIST_FOR_EACH_CONTAINER(&ztacx_works, lw, stats_node) {
+		if (k_work_delayable_busy_get(&lw->work) & K_WORK_QUEUED) {
+			backlog[lw->work_class]++;
+		}
+	}
+
+	k_spinlock_key_t key = k_spin_lock(&ztacx_work_stats_lock);
+	for (int i=0; i<ZTACX_WORK_CLASS_MAX; i++) {
+		ztacx_work_queue_stats[i].backlog = backlog[i];
+		ztacx_work_queue_stats[i].max_backlog = MAX(ztacx_work_queue_stats[i].max_backlog, backlog[i]);
+	}
+	k_spin_unlock(&ztacx_work_stats_lock, key);
+}
+
+static void ztacx_work_queue_summary(enum ztacx_work_class wc, int32_t *values_r)
+{
+	k_spinlock_key_t key = k_spin_lock(&ztacx_work_stats_lock);
+	struct ztacx_work_queue_stats qs = ztacx_work_queue_stats[wc];
+	k_spin_unlock(&ztacx_work_stats_lock, key);
+
+	values_r[ZTACX_WORK_QUEUE_STAT_BACKLOG] = qs.backlog;
+	values_r[ZTACX_WORK_QUEUE_STAT_LATENCY] = qs.runs ? k_ticks_to_us_floor32(qs.total_late_ticks / qs.runs) : 0;
+	values_r[ZTACX_WORK_QUEUE_STAT_MAX_LATENCY] = k_ticks_to_us_floor32(qs.max_late_ticks);
+}
+
+static void ztacx_work_stats_clear(struct ztacx_work_stats *s)
+{
+	s->runs = s->overruns = 0;
+	s->min_cycles = UINT32_MAX;
+	s->max_cycles = 0;
+	s->total_cycles = 0;
+	s->max_late_ticks = 0;
+	memset(s->hist, 0, sizeof(s->hist));
+}
+
+/**
+ * @brief Reduce the statistics of a work item to the values that are published
+ */
+static void ztacx_work_stats_summary(struct ztacx_leaf_work *lw, int32_t *values_r)
+{
+	struct ztacx_work_stats s;
+	k_spinlock_key_t key = k_spin_lock(&ztacx_work_stats_lock);
+	s = lw->stats;
+	k_spin_unlock(&ztacx_work_stats_lock, key);
+
+	memset(values_r, 0, ZTACX_WORK_STAT_MAX_ * sizeof(int32_t));
+	values_r[ZTACX_WORK_STAT_RUNS] = s.runs;
+	values_r[ZTACX_WORK_STAT_OVERRUNS] = s.overruns;
+	values_r[ZTACX_WORK_STAT_PERIOD] = k_ticks_to_us_floor32(s.period_ticks);
+	values_r[ZTACX_WORK_STAT_LATE] = k_ticks_to_us_floor32(s.max_late_ticks);
+	if (!s.runs) {
+		return;
+	}
+	values_r[ZTACX_WORK_STAT_MIN] = k_cyc_to_us_floor32(s.min_cycles);
+	values_r[ZTACX_WORK_STAT_MEAN] = k_cyc_to_us_floor32(s.total_cycles / s.runs);
+	values_r[ZTACX_WORK_STAT_MAX] = k_cyc_to_us_floor32(s.max_cycles);
+
+	// upper bound of the histogram bucket holding the 99th percentile
+	uint32_t target = ((uint64_t)s.runs * 99 + 99) / 100;
+	uint32_t seen = 0;
+	for (int i=0; i<ZTACX_WORK_STATS_BUCKETS; i++) {
+		seen += s.hist[i];
+		if (seen >= target) {
+			values_r[ZTACX_WORK_STAT_P99] = MIN((1U << i), (uint32_t)values_r[ZTACX_WORK_STAT_MAX]);
+			break;
+		}
+	}
+}
+
+static void ztacx_work_stats_refresh(struct k_work *work)
+{
+	struct ztacx_leaf_work *lw;
+	int32_t values[ZTACX_WORK_STAT_MAX_];
+
+	if (sys_mutex_lock(&ztacx_registry_mutex, K_MSEC(100)) == 0) {
+		SYS_SLIST_FOR_EACH_CONTAINER(&ztacx_works, lw, stats_node) {
+			if (!lw->stats_values) {
+				continue;
+			}
+			ztacx_work_stats_summary(lw, values);
+
+			struct ztacx_batch batch;
+			ztacx_batch_begin(&batch);
+			for (int i=0; i<ZTACX_WORK_STAT_MAX_; i++) {
+				if (lw->stats_values[i].value.val_int32 != values[i]) {
+					ztacx_batch_set_int32(&batch, &lw->stats_values[i], values[i]);
+				}
+			}
+			ztacx_batch_commit(&batch);
+		}
+		ztacx_work_queue_sample();
+		sys_mutex_unlock(&ztacx_registry_mutex);
+	}
+
+	for (int wc=0; wc<ZTACX_WORK_CLASS_MAX; wc++) {
+		struct ztacx_variable *qv = &ztacx_work_queue_values[wc * ZTACX_WORK_QUEUE_STAT_MAX_];
+		struct ztacx_batch batch;
+
+		ztacx_work_queue_summary(wc, values);
+		ztacx_batch_begin(&batch);
+		for (int i=0; i<ZTACX_WORK_QUEUE_STAT_MAX_; i++) {
+			if (qv[i].value.val_int32 != values[i]) {
+				ztacx_batch_set_int32(&batch, &qv[i], values[i]);
+			}
+		}
+		ztacx_batch_commit(&batch);
+	}
+	k_work_schedule_for_queue(ztacx_work_queue(ZTACX_WORK_BACKGROUND), &ztacx_work_stats_work,
+				  K_MSEC(CONFIG_ZTACX_WORK_STATS_INTERVAL_MS));
+}
+
+/**
+ * @brief Register a work item for statistics, the first time it is initialised
+ */
+static void ztacx_work_stats_register(struct ztacx_leaf_work *lw)
+{
+	char prefix[CONFIG_ZTACX_VALUE_NAME_MAX];
+
+	while (sys_mutex_lock(&ztacx_registry_mutex, K_MSEC(100)) != 0) {
+		LOG_WRN("ztacx registry mutex is held too long");
+	}
+	if (sys_slist_find(&ztacx_works, &lw->stats_node, NULL)) {
+		sys_mutex_unlock(&ztacx_registry_mutex);
+		return;
+	}
+	ztacx_work_stats_clear(&lw->stats);
+	sys_slist_append(&ztacx_works, &lw->stats_node);
+	sys_mutex_unlock(&ztacx_registry_mutex);
+
+	snprintf(prefix, sizeof(prefix), "%s_%s", lw->leaf?lw->leaf->name:"ztacx", lw->name);
+	char *stats_prefix = strdup(prefix);
+	lw->stats_values = stats_prefix ?
+		ztacx_variables_dup(ztacx_work_stats_template, ZTACX_WORK_STAT_MAX_, stats_prefix) : NULL;
+	if (!lw->stats_values) {
+		free(stats_prefix);
+		LOG_ERR("No memory for statistics of %s", prefix);
+		return;
+	}
+	ztacx_variables_register(lw->stats_values, ZTACX_WORK_STAT_MAX_);
+	k_work_schedule_for_queue(ztacx_work_queue(ZTACX_WORK_BACKGROUND), &ztacx_work_stats_work,
+				  K_MSEC(CONFIG_ZTACX_WORK_STATS_INTERVAL_MS));
+}
+#endif
+
+/**
+ * @brief Initialise a delayable work item that belongs to a leaf
+ */
+void ztacx_leaf_work_init(struct ztacx_leaf *leaf, struct ztacx_leaf_work *lw, k_work_handler_t handler)
+{
+	ztacx_leaf_work_init_named(leaf, lw, handler, "work");
+}
+
+/**
+ * @brief Initialise a leaf work item, naming it for the runtime statistics
+ *
+ * Use this where a leaf owns more than one work item.
+ */
+void ztacx_leaf_work_init_named(struct ztacx_leaf *leaf, struct ztacx_leaf_work *lw, k_work_handler_t handler, const char *name)
+{
+	lw->leaf = leaf;
+	lw->work_class = (leaf && leaf->class && leaf->class->cb) ?
+		leaf->class->cb->work_class : ZTACX_WORK_INTERACTIVE;
+	if (lw->work_class >= ZTACX_WORK_CLASS_MAX) {
+		lw->work_class = ZTACX_WORK_INTERACTIVE;
+	}
+#if CONFIG_ZTACX_WORK_STATS
+	lw->handler = handler;
+	lw->name = name;
+	k_work_init_delayable(&lw->work, ztacx_leaf_work_run);
+	ztacx_work_stats_register(lw);
+#else
+	k_work_init_delayable(&lw->work, handler);
+#endif
+}
+
+int ztacx_leaf_work_schedule(struct ztacx_leaf_work *lw, k_timeout_t delay)
+{
+	int rc = k_work_schedule_for_queue(ztacx_leaf_work_queue(lw), &lw->work, delay);
+#if CONFIG_ZTACX_WORK_STATS
+	if (rc == 1) {
+		ztacx_leaf_work_expect(lw, delay);
+	}
+#endif
+	return rc;
+}
+
+int ztacx_leaf_work_reschedule(struct ztacx_leaf_work *lw, k_timeout_t delay)
+{
+	int rc = k_work_reschedule_for_queue(ztacx_leaf_work_queue(lw), &lw->work, delay);
+#if CONFIG_ZTACX_WORK_STATS
+	if (rc >= 0) {
+		ztacx_leaf_work_expect(lw, delay);
+	}
+#endif
+	return rc;
+}
+
+int ztacx_leaf_work_cancel(struct ztacx_leaf_work *lw)
+{
+	ztacx_leaf_work_set_period(lw, 0, 0);
+	return k_work_cancel_delayable(&lw->work);
+}
+
+/*
+ * Periodic scheduler
+ *
+ * Periodic leaf work items are kept on one list, each with an absolute
+ * deadline that advances by whole periods, so that the time taken by
+ * the handler (or by a late wakeup) does not accumulate as drift.
+ *
+ * A single delayable work is armed for the earliest time by which some
+ * item must run (its deadline plus its slack).  When that fires, every
+ * item whose deadline has passed is submitted, so that items whose
+ * windows overlap share one wakeup.
+ */
+static sys_slist_t ztacx_periodic_works;
+static struct k_spinlock ztacx_periodic_lock;
+static uint32_t ztacx_periodic_wakeups;
+static uint32_t ztacx_periodic_runs;
+static void ztacx_periodic_wake(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(ztacx_periodic_work, ztacx_periodic_wake);
+
+/**
+ * @brief Arm the scheduler for the earliest closing window (periodic lock held)
+ */
+static void ztacx_periodic_arm(int64_t now)
+{
+	struct ztacx_leaf_work *lw;
+	int64_t wake = INT64_MAX;
+
+	SYS_SLIST_FOR_EACH_CONTAINER(&ztacx_periodic_works, lw, periodic_node) {
+		wake = MIN(wake, lw->deadline + lw->slack_ticks);
+	}
+	if (wake == INT64_MAX) {
+		k_work_cancel_delayable(&ztacx_periodic_work);
+		return;
+	}
+	k_work_reschedule_for_queue(ztacx_work_queue(ZTACX_WORK_REALTIME), &ztacx_periodic_work,
+				    K_TICKS(MAX(wake - now, 0)));
+}
+
+static void ztacx_periodic_wake(struct k_work *work)
+{
+	struct ztacx_leaf_work *lw;
+	k_spinlock_key_t key = k_spin_lock(&ztacx_periodic_lock);
+	int64_t now = k_uptime_ticks();
+
+	ztacx_periodic_wakeups++;
+	SYS_SLIST_FOR_EACH_CONTAINER(&ztacx_periodic_works, lw, periodic_node) {
+		if (lw->deadline > now) {
+			continue;
+		}
+#if CONFIG_ZTACX_WORK_STATS
+		ztacx_leaf_work_expect_at(lw, lw->deadline, lw->period_ticks);
+#endif
+		k_work_schedule_for_queue(ztacx_leaf_work_queue(lw), &lw->work, K_NO_WAIT);
+		ztacx_periodic_runs++;
+
+		// advance by whole periods, skipping any that were missed entirely
+		lw->deadline += lw->period_ticks;
+		if (lw->deadline <= now) {
+			lw->deadline += ((now - lw->deadline) / lw->period_ticks + 1) * lw->period_ticks;
+		}
+	}
+	ztacx_periodic_arm(now);
+	k_spin_unlock(&ztacx_periodic_lock, key);
+}
+
+/**
+ * @brief Run a leaf work item periodically from the shared scheduler
+ *
+ * The first run is immediate.  The work may run up to slack_ms after
+ * each deadline.  Calling this again with the same values does nothing,
+ * so a handler may call it on each run to follow a period setting.  A
+ * period of zero stops periodic runs.
+ */
+int ztacx_leaf_work_set_period(struct ztacx_leaf_work *lw, uint32_t period_ms, uint32_t slack_ms)
+{
+	k_spinlock_key_t key = k_spin_lock(&ztacx_periodic_lock);
+	int64_t now = k_uptime_ticks();
+	uint32_t period = k_ms_to_ticks_ceil32(period_ms);
+	uint32_t slack = MIN(k_ms_to_ticks_floor32(slack_ms), period / 2);
+
+	if (period == 0) {
+		if (sys_slist_find_and_remove(&ztacx_periodic_works, &lw->periodic_node)) {
+			lw->period_ticks = 0;
+			ztacx_periodic_arm(now);
+		}
+		k_spin_unlock(&ztacx_periodic_lock, key);
+		return 0;
+	}
+
+	if (!sys_slist_find(&ztacx_periodic_works, &lw->periodic_node, NULL)) {
+		lw->deadline = now;
+		sys_slist_append(&ztacx_periodic_works, &lw->periodic_node);
+	}
+	else if ((period == lw->period_ticks) && (slack == lw->slack_ticks)) {
+		k_spin_unlock(&ztacx_periodic_lock, key);
+		return 0;
+	}
+	else {
+		// a shorter period takes effect without waiting out the old one
+		lw->deadline = MIN(lw->deadline, now + period);
+	}
+	lw->period_ticks = period;
+	lw->slack_ticks = slack;
+	ztacx_periodic_arm(now);
+	k_spin_unlock(&ztacx_periodic_lock, key);
+	return 0;
+}
+
+#if CONFIG_ZTACX_WORK_STATS && CONFIG_SHELL
+int cmd_ztacx_top(const struct shell *shell, size_t argc, char **argv)
+{
+	struct ztacx_leaf_work *lw;
+	int32_t values[ZTACX_WORK_STAT_MAX_];
+
+	if ((argc > 1) && (strcmp(argv[1], "reset")==0)) {
+		while (sys_mutex_lock(&ztacx_registry_mutex, K_MSEC(100)) != 0) {
+			LOG_WRN("ztacx registry mutex is held too long");
+		}
+		SYS_SLIST_FOR_EACH_CONTAINER(&ztacx_works, lw, stats_node) {
+			k_spinlock_key_t key = k_spin_lock(&ztacx_work_stats_lock);
+			ztacx_work_stats_clear(&lw->stats);
+			k_spin_unlock(&ztacx_work_stats_lock, key);
+		}
+		k_spinlock_key_t key = k_spin_lock(&ztacx_work_stats_lock);
+		memset(ztacx_work_queue_stats, 0, sizeof(ztacx_work_queue_stats));
+		k_spin_unlock(&ztacx_work_stats_lock, key);
+		sys_mutex_unlock(&ztacx_registry_mutex);
+		return 0;
+	}
+
+	shell_print(shell, "Periodic scheduler: %u wakeups for %u runs",
+		    ztacx_periodic_wakeups, ztacx_periodic_runs);
+	shell_print(shell, "%-12s %8s %8s %11s %10s %14s",
+		    "queue", "runs", "backlog", "max_backlog", "latency_us", "max_latency_us");
+	for (int wc=0; wc<ZTACX_WORK_CLASS_MAX; wc++) {
+		k_spinlock_key_t key = k_spin_lock(&ztacx_work_stats_lock);
+		struct ztacx_work_queue_stats qs = ztacx_work_queue_stats[wc];
+		k_spin_unlock(&ztacx_work_stats_lock, key);
+
+		ztacx_work_queue_summary(wc, values);
+		shell_print(shell, "%-12s %8u %8d %11u %10d %14d", ztacx_work_class_names[wc],
+			    qs.runs, values[ZTACX_WORK_QUEUE_STAT_BACKLOG], qs.max_backlog,
+			    values[ZTACX_WORK_QUEUE_STAT_LATENCY],
+			    values[ZTACX_WORK_QUEUE_STAT_MAX_LATENCY]);
+	}
+	shell_print(shell, "");
+	shell_print(shell, "%-20s %8s %8s %8s %8s %8s %9s %8s %8s",
+		    "work", "runs", "min_us", "mean_us", "max_us", "p99_us",
+		    "period_us", "late_us", "overruns");
+	while (sys_mutex_lock(&ztacx_registry_mutex, K_MSEC(100)) != 0) {
+		LOG_WRN("ztacx registry mutex is held too long");
+	}
+	SYS_SLIST_FOR_EACH_CONTAINER(&ztacx_works, lw, stats_node) {
+		char name[CONFIG_ZTACX_VALUE_NAME_MAX];
+
+		snprintf(name, sizeof(name), "%s/%s", lw->leaf?lw->leaf->name:"ztacx", lw->name);
+		ztacx_work_stats_summary(lw, values);
+		shell_print(shell, "%-20s %8d %8d %8d %8d %8d %9d %8d %8d", name,
+			    values[ZTACX_WORK_STAT_RUNS], values[ZTACX_WORK_STAT_MIN],
+			    values[ZTACX_WORK_STAT_MEAN], values[ZTACX_WORK_STAT_MAX],
+			    values[ZTACX_WORK_STAT_P99], values[ZTACX_WORK_STAT_PERIOD],
+			    values[ZTACX_WORK_STAT_LATE], values[ZTACX_WORK_STAT_OVERRUNS]);
+	}
+	sys_mutex_unlock(&ztacx_registry_mutex);
+	return 0;
+}
+#endif
+
+int ztacx_leaf_start(const char *name)
+{
+	struct ztacx_leaf *leaf = ztacx_leaf_get(name);
+	if (!name) return -ENOENT;
+	int rc=0;
+
+
+	if (leaf->class->cb->start) {
+		rc = leaf->class->cb->start(leaf);
+	}
+	if (rc == 0) leaf->running=true;
+	return rc;
+}
+
+int ztacx_leaf_stop(const char *name)
 {
 	struct ztacx_leaf *leaf = ztacx_leaf_get(name);
 	if (!name) return -ENOENT;
@@ -477,11 +1708,10 @@ int ztacx_leaf_stop(const char *name)
 
 int ztacx_pre_sleep(void)
 {
-	sys_slist_t *list = &ztacx_leaves;
 	struct ztacx_leaf *leaf;
 	int rc = 0;
 
-	SYS_SLIST_FOR_EACH_CONTAINER(list, leaf, node) {
+	ZTACX_LEAF_FOREACH(leaf) {
 		if (leaf->class->cb->pre_sleep) {
 			int err = leaf->class->cb->pre_sleep(leaf);
 			if (err != 0) {
@@ -494,11 +1724,10 @@ int ztacx_pre_sleep(void)
 
 int ztacx_post_sleep(void)
 {
-	sys_slist_t *list = &ztacx_leaves;
 	struct ztacx_leaf *leaf;
 	int rc = 0;
 
-	SYS_SLIST_FOR_EACH_CONTAINER(list, leaf, node) {
+	ZTACX_LEAF_FOREACH(leaf) {
 
 		if (leaf->class->cb->post_sleep) {
 			int err = leaf->class->cb->post_sleep(leaf);
@@ -524,17 +1753,145 @@ bool ztacx_leaf_is_running(const char *name)
 	return leaf->running;
 }
 
-int ztacx_values_register(sys_slist_t *list, struct sys_mutex *mutex, struct ztacx_variable *v, int count)
+/**
+ * @brief Hash a variable name (32-bit FNV-1a)
+ */
+static uint32_t ztacx_name_hash_update(uint32_t hash, const char *name)
+{
+	while (*name) {
+		hash ^= (uint8_t)*name++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+uint32_t ztacx_name_hash(const char *name)
+{
+	return ztacx_name_hash_update(2166136261U, name);
+}
+
+/**
+ * @brief Hash the full name of a variable, without composing it
+ */
+static uint32_t ztacx_variable_name_hash(const struct ztacx_variable *v)
+{
+	uint32_t hash = 2166136261U;
+
+	if (v->prefix) {
+		hash = ztacx_name_hash_update(hash, v->prefix);
+		hash = ztacx_name_hash_update(hash, "_");
+	}
+	return ztacx_name_hash_update(hash, v->name);
+}
+
+/**
+ * @brief Compose the full name of a variable into a buffer
+ *
+ * @return the length of the full name, as for snprintf
+ */
+int ztacx_variable_name(const struct ztacx_variable *v, char *buf, size_t size)
+{
+	return snprintf(buf, size, ZTACX_VARIABLE_NAME_FMT, ZTACX_VARIABLE_NAME_ARG(v));
+}
+
+/**
+ * @brief Compare the full name of a variable with a string
+ */
+bool ztacx_variable_name_eq(const struct ztacx_variable *v, const char *name)
+{
+	if (v->prefix) {
+		size_t prefix_len = strlen(v->prefix);
+
+		if ((strncmp(name, v->prefix, prefix_len) != 0) || (name[prefix_len] != '_')) {
+			return false;
+		}
+		name += prefix_len+1;
+	}
+	return strcmp(name, v->name) == 0;
+}
+
+/**
+ * @brief Add a variable to a name index
+ *
+ * The caller must hold the mutex that protects the list the index
+ * belongs to.  Lookups do not take the mutex, so the variable is
+ * appended at the tail of its bucket, and published only once it is
+ * fully linked, behind a full barrier for lookups on other CPUs.
+ *
+ * A name already in the index keeps resolving to the first variable
+ * registered under it; the later one is not indexed.
+ */
+void ztacx_variable_index_add(struct ztacx_variable_index *index, struct ztacx_variable *v)
+{
+	struct ztacx_variable **tail;
+	char name[CONFIG_ZTACX_VALUE_NAME_MAX];
+
+	v->hash = ztacx_variable_name_hash(v);
+	v->hash_next = NULL;
+	for (tail = &index->bucket[v->hash & index->mask]; *tail; tail = &(*tail)->hash_next) {
+		if (*tail == v) {
+			return;
+		}
+		if ((*tail)->hash != v->hash) {
+			continue;
+		}
+		ztacx_variable_name(v, name, sizeof(name));
+		if (ztacx_variable_name_eq(*tail, name)) {
+			LOG_WRN("Variable %s is already registered, the first one is kept", name);
+			return;
+		}
+	}
+	barrier_dmem_fence_full();
+	*tail = v;
+}
+
+/**
+ * @brief Look up a variable by name in a name index
+ */
+struct ztacx_variable *ztacx_variable_index_find(const struct ztacx_variable_index *index, const char *name)
+{
+	uint32_t hash = ztacx_name_hash(name);
+	struct ztacx_variable *v = index->bucket[hash & index->mask];
+
+	for (; v != NULL; v = v->hash_next) {
+		if ((v->hash == hash) && ztacx_variable_name_eq(v, name)) {
+			return v;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Look up a variable by id (name hash) in a name index
+ *
+ * For stored records, which carry the id rather than the name.
+ */
+struct ztacx_variable *ztacx_variable_index_find_id(const struct ztacx_variable_index *index, uint32_t id)
+{
+	struct ztacx_variable *v = index->bucket[id & index->mask];
+
+	for (; v != NULL; v = v->hash_next) {
+		if (v->hash == id) {
+			return v;
+		}
+	}
+	return NULL;
+}
+
+int ztacx_values_register(sys_slist_t *list, struct sys_mutex *mutex, struct ztacx_variable_index *index, struct ztacx_variable *v, int count)
 {
 	while (sys_mutex_lock(mutex, K_MSEC(500)) != 0) {
 		LOG_WRN("ztacx value list mutex is held too long");
 	}
 	for (int i=0; i<count; i++) {
-		LOG_INF("register %s %d/%d: %s kind=%d",
+		LOG_INF("register %s %d/%d: " ZTACX_VARIABLE_NAME_FMT " kind=%d",
 			(list==&ztacx_variables)?"variable":"setting",
-			i+1, count, v[i].name, (int)(v[i].kind));
+			i+1, count, ZTACX_VARIABLE_NAME_ARG(&v[i]), (int)(v[i].kind));
 		//LOG_HEXDUMP_INF(&(s[i].value), sizeof(s[i].value), "value dump");
 		sys_slist_append(list, &(v[i].node));
+		if (index) {
+			ztacx_variable_index_add(index, &v[i]);
+		}
 	}
 	sys_mutex_unlock(mutex);
 	return 0;
@@ -546,7 +1903,11 @@ int ztacx_values_register(sys_slist_t *list, struct sys_mutex *mutex, struct zta
 int ztacx_variables_register(struct ztacx_variable *s, int count)
 {
 	LOG_INF("%d", count);
-	return ztacx_values_register(&ztacx_variables, &ztacx_variables_mutex, s, count);
+	if ((count > 0) && ztacx_variable_is_static(s)) {
+		// defined by ZTACX_VARIABLES_DEFINE, already indexed at startup
+		return 0;
+	}
+	return ztacx_values_register(&ztacx_variables, &ztacx_variables_mutex, &ztacx_variables_index, s, count);
 }
 
 /**
@@ -557,225 +1918,663 @@ int ztacx_variables_register(struct ztacx_variable *s, int count)
 int ztacx_variable_describe(char *buf, int buf_max, const struct ztacx_variable *s)
 {
 	switch (s->kind) {
-	case ZTACX_VALUE_STRING:
-		snprintf(buf, buf_max, "%s=(string)[%s]", s->name, s->value.val_string?s->value.val_string:"[empty]");
+	case ZTACX_VALUE_STRING: {
+		int len = snprintf(buf, buf_max, ZTACX_VARIABLE_NAME_FMT "=(string)[", ZTACX_VARIABLE_NAME_ARG(s));
+		if ((len < 0) || (len + 2 >= buf_max)) {
+			break;
+		}
+		// copy the value under the value lock, then close the bracket
+		if ((ztacx_variable_value_get(s, buf+len, buf_max-len-1) != 0) ||
+		    (buf[len] == '\0')) {
+			strncpy(buf+len, "[empty]", buf_max-len-1);
+			buf[buf_max-2] = '\0';
+		}
+		strcat(buf, "]");
 		break;
+	}
 	case ZTACX_VALUE_BOOL:
-		snprintf(buf, buf_max, "%s=(bool)[%s]", s->name, s->value.val_bool?"true":"false");
+		snprintf(buf, buf_max, ZTACX_VARIABLE_NAME_FMT "=(bool)[%s]", ZTACX_VARIABLE_NAME_ARG(s), s->value.val_bool?"true":"false");
 		break;
 	case ZTACX_VALUE_BYTE:
-		snprintf(buf, buf_max, "%s=(byte)[%d]", s->name, (int)s->value.val_byte);
+		snprintf(buf, buf_max, ZTACX_VARIABLE_NAME_FMT "=(byte)[%d]", ZTACX_VARIABLE_NAME_ARG(s), (int)s->value.val_byte);
 		break;
 	case ZTACX_VALUE_UINT16:
-		snprintf(buf, buf_max, "%s=(uint16)[%d]", s->name, (int)s->value.val_uint16);
+		snprintf(buf, buf_max, ZTACX_VARIABLE_NAME_FMT "=(uint16)[%d]", ZTACX_VARIABLE_NAME_ARG(s), (int)s->value.val_uint16);
 		break;
 	case ZTACX_VALUE_INT16:
-		snprintf(buf, buf_max, "%s=(int16)[%d]", s->name, (int)s->value.val_int16);
+		snprintf(buf, buf_max, ZTACX_VARIABLE_NAME_FMT "=(int16)[%d]", ZTACX_VARIABLE_NAME_ARG(s), (int)s->value.val_int16);
 		break;
 	case ZTACX_VALUE_INT32:
-		snprintf(buf, buf_max, "%s=(int32)[%d]", s->name, (int)s->value.val_int32);
+		snprintf(buf, buf_max, ZTACX_VARIABLE_NAME_FMT "=(int32)[%d]", ZTACX_VARIABLE_NAME_ARG(s), (int)s->value.val_int32);
 		break;
 	case ZTACX_VALUE_INT64:
-		snprintf(buf, buf_max, "%s=(int64)[%ld]", s->name, (long)s->value.val_int64); // fixme lld?
+		snprintf(buf, buf_max, ZTACX_VARIABLE_NAME_FMT "=(int64)[%lld]", ZTACX_VARIABLE_NAME_ARG(s), (long long)ztacx_variable_value_get_int64((struct ztacx_variable *)s));
 		break;
+	case ZTACX_VALUE_EVENT: {
+		struct ztacx_event_queue *q = s->value.val_event;
+
+		if (!q) {
+			snprintf(buf, buf_max, ZTACX_VARIABLE_NAME_FMT "=(event)[none]", ZTACX_VARIABLE_NAME_ARG(s));
+			break;
+		}
+		snprintf(buf, buf_max, ZTACX_VARIABLE_NAME_FMT "=(event)[queued=%u posted=%d overflows=%d unmatched=%d]",
+			 ZTACX_VARIABLE_NAME_ARG(s), k_msgq_num_used_get(&q->msgq),
+			 (int)atomic_get(&q->posted), (int)atomic_get(&q->overflows),
+			 (int)atomic_get(&q->unmatched));
+		break;
+	}
 	default:
-		LOG_ERR("   %s=(unk)[%d]", s->name, (int)s->kind);
+		LOG_ERR("   " ZTACX_VARIABLE_NAME_FMT "=(unk)[%d]", ZTACX_VARIABLE_NAME_ARG(s), (int)s->kind);
 		return -EINVAL;
 	}
 	return 0;
 }
 
 
+/**
+ * Store a value into a variable without notifying, with the value lock held
+ *
+ * Handles every kind except heap-allocated strings, which need an
+ * allocation that cannot be made under the lock.
+ */
+static int ztacx_variable_value_store(struct ztacx_variable *v, const void *value)
+{
+	switch (v->kind) {
+	case ZTACX_VALUE_STRING: {
+		int size = strlen((const char *)value) + 1;
+
+		if (!v->capacity) {
+			return -EINVAL;
+		}
+		if (size > v->capacity) {
+			return -E2BIG;
+		}
+		atomic_inc(&v->seq);
+		memcpy(v->value.val_string, value, size);
+		atomic_inc(&v->seq);
+		break;
+	}
+	case ZTACX_VALUE_BOOL:
+		*(volatile bool *)&v->value.val_bool = *(bool *)value;
+		break;
+	case ZTACX_VALUE_BYTE:
+		*(volatile uint8_t *)&v->value.val_byte = *(uint8_t *)value;
+		break;
+	case ZTACX_VALUE_UINT16:
+		*(volatile uint16_t *)&v->value.val_uint16 = *(uint16_t *)value;
+		break;
+	case ZTACX_VALUE_INT16:
+		*(volatile int16_t *)&v->value.val_int16 = *(int16_t *)value;
+		break;
+	case ZTACX_VALUE_INT32:
+		*(volatile int32_t *)&v->value.val_int32 = *(int32_t *)value;
+		break;
+	case ZTACX_VALUE_INT64:
+		atomic_inc(&v->seq);
+		v->value.val_int64 = *(int64_t *)value;
+		atomic_inc(&v->seq);
+		break;
+	default:
+		return -EINVAL;
+	}
+	return 0;
+}
+
 /**
  * Store a value (from pointer) into a ztacx_variable
+ *
+ * Values of 32 bits or less are stored with a single aligned store, so
+ * concurrent readers always see either the old or the new value.  Wider
+ * values and strings are written under the value lock with the
+ * variable's sequence count odd, so that lock-free readers can detect
+ * and retry a torn read.
  */
 int ztacx_variable_value_set(struct ztacx_variable *setting, const void *value)
 {
-	int size;
+	k_spinlock_key_t key;
+	int rc = 0;
 
 	if (!value) return 0;
 
-	// TODO use a mutex for get/set operations
-
 	switch (setting->kind) {
 	case ZTACX_VALUE_STRING: {
-		size = strlen((const char *)value) + 1;
-		char *old = setting->value.val_string;
+		int size = strlen((const char *)value) + 1;
+		char *old;
+
+		if (setting->capacity) {
+			// inline storage: copy in place, never touch the heap
+			key = k_spin_lock(&ztacx_value_lock);
+			rc = ztacx_variable_value_store(setting, value);
+			k_spin_unlock(&ztacx_value_lock, key);
+			if (rc == -E2BIG) {
+				LOG_WRN("Value for " ZTACX_VARIABLE_NAME_FMT " exceeds capacity %d",
+					ZTACX_VARIABLE_NAME_ARG(setting), (int)setting->capacity);
+			}
+			break;
+		}
+
 		char *val_string = calloc(size, sizeof(char));
 		if (!val_string) {
 			return -ENOMEM;
 		}
 		strcpy(val_string, value);
+
+		key = k_spin_lock(&ztacx_value_lock);
+		atomic_inc(&setting->seq);
+		old = setting->value.val_string;
 		setting->value.val_string = val_string;
+		atomic_inc(&setting->seq);
+		k_spin_unlock(&ztacx_value_lock, key);
+
+		// readers copy strings while holding the lock, so the old
+		// buffer cannot still be in use here
 		if (old) {
 			free(old);
 		}
 		break;
 	}
+	case ZTACX_VALUE_INT64:
+		key = k_spin_lock(&ztacx_value_lock);
+		rc = ztacx_variable_value_store(setting, value);
+		k_spin_unlock(&ztacx_value_lock, key);
+		break;
+	case ZTACX_VALUE_EVENT:
+		// queuing the event notifies subscribers
+		return ztacx_variable_value_post_event(setting, *(const uint32_t *)value);
+	default:
+		rc = ztacx_variable_value_store(setting, value);
+		if (rc != 0) {
+			LOG_ERR("Unhandled setting kind %d", (int)setting->kind);
+		}
+		break;
+	}
+	if (rc != 0) {
+		return rc;
+	}
+	ztacx_variable_notify(setting);
+
+	return 0;
+}
+
+/**
+ * Store a value (from string) into a ztacx_variable
+ */
+int ztacx_variable_value_set_string(struct ztacx_variable *s, const char *value)
+{
+	if (!s) {
+		LOG_ERR("Attempt to set null variable (%s)", value);
+		return -EINVAL;
+	}
+	LOG_DBG(ZTACX_VARIABLE_NAME_FMT " (%s) <= [%s]", ZTACX_VARIABLE_NAME_ARG(s), ztacx_value_kind_names[s->kind], value);
+
+	int err = 0;
+
+	switch (s->kind) {
+	case ZTACX_VALUE_STRING:
+		err = ztacx_variable_value_set(s, value);
+		break;
+	case ZTACX_VALUE_BOOL: {
+		bool val_bool;
+		if ((strcmp(value,"true")==0) ||
+		    (strcmp(value,"on")==0) ||
+		    (strcmp(value,"1")==0)) {
+			val_bool = true;
+		}
+		else {
+			val_bool = false;
+		}
+		ztacx_variable_value_set(s, &val_bool);
+		break;
+	}
+	case ZTACX_VALUE_BYTE: {
+		uint8_t val_byte = atoi(value);
+		ztacx_variable_value_set(s, &val_byte);
+		break;
+	}
+	case ZTACX_VALUE_UINT16:
+	{
+		uint16_t val_uint16 = atoi(value);
+		ztacx_variable_value_set(s, &val_uint16);
+		break;
+	}
+	case ZTACX_VALUE_INT16: {
+		int16_t val_int16 = atoi(value);
+		ztacx_variable_value_set(s, &val_int16);
+		break;
+	}
+	case ZTACX_VALUE_INT32:
+	{
+		int32_t val_int32 = atoi(value);
+		ztacx_variable_value_set(s, &val_int32);
+		break;
+	}
+	case ZTACX_VALUE_INT64: {
+		int64_t val_int64 = atoi(value);// FIXME strtoull?
+		ztacx_variable_value_set(s, &val_int64);
+		break;
+	}
+	case ZTACX_VALUE_EVENT:
+		err = ztacx_variable_value_post_event(s, strtoul(value, NULL, 0));
+		break;
+	default:
+		LOG_ERR("Unhandled variable type %d", (int)s->kind);
+		err = -EINVAL;
+	}
+	if (err != 0) {
+		LOG_ERR("variable parse failed: %d", err);
+	}
+	return err;
+}
+
+int ztacx_variable_value_set_bool(struct ztacx_variable *v, bool value)
+{
+	if (v && (v->kind == ZTACX_VALUE_BOOL)) {
+		*(volatile bool *)&v->value.val_bool = value;
+		ztacx_variable_notify(v);
+		return 0;
+	}
+	return ztacx_variable_value_set(v, &value);
+}
+
+int ztacx_variable_value_set_byte(struct ztacx_variable *v, uint8_t value)
+{
+	if (v && (v->kind == ZTACX_VALUE_BYTE)) {
+		*(volatile uint8_t *)&v->value.val_byte = value;
+		ztacx_variable_notify(v);
+		return 0;
+	}
+	return ztacx_variable_value_set(v, &value);
+}
+
+int ztacx_variable_value_set_uint16(struct ztacx_variable *v, uint16_t value)
+{
+	if (v && (v->kind == ZTACX_VALUE_UINT16)) {
+		*(volatile uint16_t *)&v->value.val_uint16 = value;
+		ztacx_variable_notify(v);
+		return 0;
+	}
+	return ztacx_variable_value_set(v, &value);
+}
+
+int ztacx_variable_value_set_int16(struct ztacx_variable *v, int16_t value)
+{
+	if (v && (v->kind == ZTACX_VALUE_INT16)) {
+		*(volatile int16_t *)&v->value.val_int16 = value;
+		ztacx_variable_notify(v);
+		return 0;
+	}
+	return ztacx_variable_value_set(v, &value);
+}
+
+int ztacx_variable_value_set_int32(struct ztacx_variable *v, int32_t value)
+{
+	if (v && (v->kind == ZTACX_VALUE_INT32)) {
+		*(volatile int32_t *)&v->value.val_int32 = value;
+		ztacx_variable_notify(v);
+		return 0;
+	}
+	return ztacx_variable_value_set(v, &value);
+}
+
+int ztacx_variable_value_set_int64(struct ztacx_variable *v, int64_t value)
+{
+	return ztacx_variable_value_set(v, &value);
+}
+
+int ztacx_variable_value_inc_int64(struct ztacx_variable *v)
+{
+	k_spinlock_key_t key;
+
+	if (v->kind != ZTACX_VALUE_INT64) {
+		return -EINVAL;
+	}
+
+	// increment in place, so that concurrent increments are not lost
+	key = k_spin_lock(&ztacx_value_lock);
+	atomic_inc(&v->seq);
+	v->value.val_int64++;
+	atomic_inc(&v->seq);
+	k_spin_unlock(&ztacx_value_lock, key);
+
+	ztacx_variable_notify(v);
+	return 0;
+}
+
+/**
+ * Decide whether a sample passes a report filter
+ */
+static bool ztacx_publish_due(const struct ztacx_publish *p, int64_t sample, int64_t now)
+{
+	int64_t delta = sample - p->last_value;
+	int64_t since = now - p->last_report;
+	int64_t threshold = MAX(p->deadband, 1);
+	int8_t direction = (delta > 0) ? 1 : ((delta < 0) ? -1 : 0);
+
+	if (!p->primed) {
+		return true;
+	}
+	if (p->max_interval_ms && (since >= p->max_interval_ms)) {
+		return true;
+	}
+	if (direction && p->direction && (direction != p->direction)) {
+		threshold += p->hysteresis;
+	}
+	if (llabs(delta) < threshold) {
+		return false;
+	}
+	if (p->min_interval_ms && (since < p->min_interval_ms)) {
+		return false;
+	}
+	return true;
+}
+
+static void ztacx_publish_record(struct ztacx_publish *p, int64_t sample, int64_t now)
+{
+	int64_t delta = sample - p->last_value;
+
+	if (p->primed && (delta != 0)) {
+		p->direction = (delta > 0) ? 1 : -1;
+	}
+	p->last_value = sample;
+	p->last_report = now;
+	p->primed = true;
+}
+
+/**
+ * Convert a sample to the kind of a numeric variable and store it, with the value lock held
+ */
+static int ztacx_variable_store_sample(struct ztacx_variable *v, int64_t sample)
+{
+	union ztacx_value value;
+
+	switch (v->kind) {
 	case ZTACX_VALUE_BOOL:
-		setting->value.val_bool = *(bool *)value;
+		value.val_bool = (sample != 0);
 		break;
 	case ZTACX_VALUE_BYTE:
-		setting->value.val_byte = *(uint8_t *)value;
+		value.val_byte = (uint8_t)sample;
 		break;
 	case ZTACX_VALUE_UINT16:
-		setting->value.val_uint16 = *(uint16_t *)value;
+		value.val_uint16 = (uint16_t)sample;
 		break;
 	case ZTACX_VALUE_INT16:
-		setting->value.val_int16 = *(int16_t *)value;
+		value.val_int16 = (int16_t)sample;
 		break;
 	case ZTACX_VALUE_INT32:
-		setting->value.val_int32 = *(int32_t *)value;
+		value.val_int32 = (int32_t)sample;
 		break;
 	case ZTACX_VALUE_INT64:
-		setting->value.val_int64 = *(int64_t *)value;
+		value.val_int64 = sample;
 		break;
 	default:
-		LOG_ERR("Unhandled setting kind %d", (int)setting->kind);
 		return -EINVAL;
 	}
-	if (setting->on_change) {
-		LOG_DBG("Trigger on-change for %s", setting->name);
-		k_work_submit(setting->on_change);
-	}
-
-	return 0;
+	return ztacx_variable_value_store(v, &value);
 }
 
 /**
- * Store a value (from string) into a ztacx_variable
+ * @brief Publish a sensor sample to a numeric variable, subject to a report filter
+ *
+ * The first sample is always published.  After that a sample is
+ * published only if it differs from the last published value by at
+ * least the deadband (plus the hysteresis if the direction of change
+ * has reversed), and no sooner than min_interval_ms after the last
+ * report.  If max_interval_ms has elapsed the sample is published
+ * regardless of change.
+ *
+ * @return 1 if the variable was updated, 0 if the sample was filtered
+ * out, or a negative error code.
  */
-int ztacx_variable_value_set_string(struct ztacx_variable *s, const char *value)
+int ztacx_variable_publish(struct ztacx_variable *v, struct ztacx_publish *p, int64_t sample)
 {
-	if (!s) {
-		LOG_ERR("Attempt to set null variable (%s)", value);
-		return -EINVAL;
+	int64_t now = k_uptime_get();
+	k_spinlock_key_t key;
+	int rc;
+
+	if (!ztacx_publish_due(p, sample, now)) {
+		return 0;
 	}
-	LOG_DBG("%s (%s) <= [%s]", s->name, ztacx_value_kind_names[s->kind], value);
 
-	int err = 0;
+	key = k_spin_lock(&ztacx_value_lock);
+	rc = ztacx_variable_store_sample(v, sample);
+	k_spin_unlock(&ztacx_value_lock, key);
+	if (rc != 0) {
+		LOG_ERR("Cannot publish to " ZTACX_VARIABLE_NAME_FMT " of kind %d", ZTACX_VARIABLE_NAME_ARG(v), (int)v->kind);
+		return rc;
+	}
+	ztacx_publish_record(p, sample, now);
+	ztacx_variable_notify(v);
+	return 1;
+}
 
-	switch (s->kind) {
-	case ZTACX_VALUE_STRING:
-		ztacx_variable_value_set(s, value);
-		break;
-	case ZTACX_VALUE_BOOL: {
-		bool val_bool;
-		if ((strcmp(value,"true")==0) ||
-		    (strcmp(value,"on")==0) ||
-		    (strcmp(value,"1")==0)) {
-			val_bool = true;
-		}
-		else {
-			val_bool = false;
+/**
+ * @brief Start a batch of variable updates
+ *
+ * Takes the value lock, which is held until @ref ztacx_batch_commit.
+ */
+void ztacx_batch_begin(struct ztacx_batch *b)
+{
+	b->count = 0;
+	b->key = k_spin_lock(&ztacx_value_lock);
+}
+
+static int ztacx_batch_record(struct ztacx_batch *b, struct ztacx_variable *v)
+{
+	for (int i=0; i<b->count; i++) {
+		if (b->changed[i] == v) {
+			return 0;
 		}
-		ztacx_variable_value_set(s, &val_bool);
-		break;
-	}
-	case ZTACX_VALUE_BYTE: {
-		uint8_t val_byte = atoi(value);
-		ztacx_variable_value_set(s, &val_byte);
-		break;
-	}
-	case ZTACX_VALUE_UINT16:
-	{
-		uint16_t val_uint16 = atoi(value);
-		ztacx_variable_value_set(s, &val_uint16);
-		break;
-	}
-	case ZTACX_VALUE_INT16: {
-		int16_t val_int16 = atoi(value);
-		ztacx_variable_value_set(s, &val_int16);
-		break;
 	}
-	case ZTACX_VALUE_INT32:
-	{
-		int32_t val_int32 = atoi(value);
-		ztacx_variable_value_set(s, &val_int32);
-		break;
-	}
-	case ZTACX_VALUE_INT64: {
-		int64_t val_int64 = atoi(value);// FIXME strtoull?
-		ztacx_variable_value_set(s, &val_int64);
-		break;
-	}
-	default:
-		LOG_ERR("Unhandled variable type %d", (int)s->kind);
-		err = -EINVAL;
+	if (b->count >= CONFIG_ZTACX_BATCH_MAX) {
+		return -ENOSPC;
 	}
-	if (err != 0) {
-		LOG_ERR("variable parse failed: %d", err);
+	b->changed[b->count++] = v;
+	return 0;
+}
+
+/**
+ * @brief Store a value as part of a batch
+ *
+ * Heap-allocated strings cannot be set in a batch (only inline ones).
+ */
+int ztacx_batch_set(struct ztacx_batch *b, struct ztacx_variable *v, const void *value)
+{
+	int rc = ztacx_batch_record(b, v);
+
+	if (rc == 0) {
+		rc = ztacx_variable_value_store(v, value);
 	}
-	return err;
+	return rc;
 }
 
-int ztacx_variable_value_set_bool(struct ztacx_variable *v, bool value)
+int ztacx_batch_set_int32(struct ztacx_batch *b, struct ztacx_variable *v, int32_t value)
 {
-	return ztacx_variable_value_set(v, &value);
+	return ztacx_batch_set(b, v, &value);
 }
 
-int ztacx_variable_value_set_byte(struct ztacx_variable *v, uint8_t value)
+int ztacx_batch_inc_int64(struct ztacx_batch *b, struct ztacx_variable *v)
 {
-	return ztacx_variable_value_set(v, &value);
+	int rc;
+
+	if (v->kind != ZTACX_VALUE_INT64) {
+		return -EINVAL;
+	}
+	rc = ztacx_batch_record(b, v);
+	if (rc == 0) {
+		atomic_inc(&v->seq);
+		v->value.val_int64++;
+		atomic_inc(&v->seq);
+	}
+	return rc;
 }
 
-int ztacx_variable_value_set_uint16(struct ztacx_variable *v, uint16_t value)
+/**
+ * @brief Publish a sensor sample as part of a batch
+ *
+ * As for @ref ztacx_variable_publish, but the change is notified at commit.
+ */
+int ztacx_batch_publish(struct ztacx_batch *b, struct ztacx_variable *v, struct ztacx_publish *p, int64_t sample)
 {
-	return ztacx_variable_value_set(v, &value);
+	int64_t now = k_uptime_get();
+	int rc;
+
+	if (!ztacx_publish_due(p, sample, now)) {
+		return 0;
+	}
+	rc = ztacx_batch_record(b, v);
+	if (rc == 0) {
+		rc = ztacx_variable_store_sample(v, sample);
+	}
+	if (rc != 0) {
+		return rc;
+	}
+	ztacx_publish_record(p, sample, now);
+	return 1;
 }
 
-int ztacx_variable_value_set_int16(struct ztacx_variable *v, int16_t value)
+/**
+ * @brief Finish a batch, releasing the value lock and notifying each changed variable once
+ */
+void ztacx_batch_commit(struct ztacx_batch *b)
 {
-	return ztacx_variable_value_set(v, &value);
+	k_spin_unlock(&ztacx_value_lock, b->key);
+
+	for (int i=0; i<b->count; i++) {
+		ztacx_variable_notify(b->changed[i]);
+	}
+	b->count = 0;
 }
 
-int ztacx_variable_value_set_int32(struct ztacx_variable *v, int32_t value)
+/**
+ * @brief Read several variables consistently with respect to batches
+ *
+ * String values are returned as pointers, and are only stable for
+ * inline strings.
+ */
+int ztacx_variables_snapshot(struct ztacx_variable *const *vars, union ztacx_value *values_r, int count)
 {
-	return ztacx_variable_value_set(v, &value);
+	k_spinlock_key_t key = k_spin_lock(&ztacx_value_lock);
+
+	for (int i=0; i<count; i++) {
+		values_r[i] = vars[i]->value;
+	}
+	k_spin_unlock(&ztacx_value_lock, key);
+	return 0;
 }
 
-int ztacx_variable_value_set_int64(struct ztacx_variable *v, int64_t value)
+/**
+ * @brief Initialise the event queue behind an event variable
+ */
+void ztacx_event_queue_init(struct ztacx_event_queue *q)
 {
-	return ztacx_variable_value_set(v, &value);
+	k_msgq_init(&q->msgq, (char *)q->buf, sizeof(struct ztacx_event), ARRAY_SIZE(q->buf));
+	atomic_set(&q->posted, 0);
+	atomic_set(&q->overflows, 0);
+	atomic_set(&q->unmatched, 0);
 }
 
-int ztacx_variable_value_inc_int64(struct ztacx_variable *v)
+/**
+ * @brief Queue an event, stamped with the current uptime
+ *
+ * May be called from an ISR.  Returns -ENOSPC (and counts an overflow)
+ * if the consumer has fallen a whole queue behind.
+ */
+int ztacx_variable_value_post_event(struct ztacx_variable *v, uint32_t event)
 {
-	int64_t val_int64 = ztacx_variable_value_get_int64(v) + 1;
-	return ztacx_variable_value_set_int64(v, val_int64);
+	struct ztacx_event_queue *q = v->value.val_event;
+	struct ztacx_event ev = {.event = event, .timestamp_ms = k_uptime_get_32()};
+
+	if (!q) {
+		return -ENODEV;
+	}
+	if (k_msgq_put(&q->msgq, &ev, K_NO_WAIT) != 0) {
+		atomic_inc(&q->overflows);
+		LOG_WRN("Event queue " ZTACX_VARIABLE_NAME_FMT " overflow, event %08x lost",
+			ZTACX_VARIABLE_NAME_ARG(v), event);
+		return -ENOSPC;
+	}
+	atomic_inc(&q->posted);
+	ztacx_variable_notify(v);
+	return 0;
 }
 
+/**
+ * @brief Queue an event (events are queued, never overwritten)
+ */
 int ztacx_variable_value_set_event(struct ztacx_variable *v, uint32_t event)
 {
-	if (v->value.val_event) {
-		k_event_set(v->value.val_event, event);
-		return 0;
-	}
-	return -ENODEV;
+	return ztacx_variable_value_post_event(v, event);
 }
 
-int ztacx_variable_value_post_event(struct ztacx_variable *v, uint32_t event)
+/**
+ * @brief Take the oldest event from the queue of an event variable
+ *
+ * Pass K_NO_WAIT to poll.  Returns -EAGAIN (or -ENOMSG when polling) if
+ * no event arrived within the timeout.
+ */
+int ztacx_variable_value_get_event(struct ztacx_variable *v, struct ztacx_event *event_r, k_timeout_t timeout)
 {
-	if (v->value.val_event) {
-		k_event_post(v->value.val_event, event);
-		return 0;
+	struct ztacx_event_queue *q = v->value.val_event;
+
+	if (!q) {
+		return -ENODEV;
 	}
-	return -ENODEV;
+	return k_msgq_get(&q->msgq, event_r, timeout);
 }
 
+/**
+ * @brief Wait for an event with any bit in mask, returning those bits
+ *
+ * Events with no bits in mask are consumed while waiting, and counted
+ * in the queue's unmatched count; give each consumer its own event
+ * variable if they must all see every event.  Returns 0 if no matching
+ * event arrives within the (overall) timeout.  Use @ref
+ * ztacx_variable_value_get_event for the timestamp.
+ */
 uint32_t ztacx_variable_value_wait_event(struct ztacx_variable *v, uint32_t mask, k_timeout_t timeout)
 {
-	if (v->value.val_event) {
-		return k_event_wait(v->value.val_event, mask, true, timeout);
+	struct ztacx_event_queue *q = v->value.val_event;
+	k_timepoint_t end = sys_timepoint_calc(timeout);
+	struct ztacx_event ev;
+
+	if (!q) {
+		return 0;
+	}
+	while (k_msgq_get(&q->msgq, &ev, sys_timepoint_timeout(end)) == 0) {
+		if (ev.event & mask) {
+			return ev.event & mask;
+		}
+		atomic_inc(&q->unmatched);
 	}
 	return 0;
 }
 
+/**
+ * Read a 64-bit value without tearing, retrying if a writer intervened
+ */
+static int64_t ztacx_variable_read_int64(const struct ztacx_variable *v)
+{
+	atomic_val_t seq;
+	int64_t value;
+
+	do {
+		seq = atomic_get(&v->seq);
+		value = *(volatile int64_t *)&v->value.val_int64;
+	} while ((seq & 1) || (atomic_get(&v->seq) != seq));
+
+	return value;
+}
+
 bool ztacx_variable_value_get_bool(struct ztacx_variable *v)
 {
 	bool value = false;
+
+	if (v && (v->kind == ZTACX_VALUE_BOOL)) {
+		// no need for the generic path's switch and size check
+		return *(volatile bool *)&v->value.val_bool;
+	}
 	if (ztacx_variable_value_get(v, &value, sizeof(value)) != 0) {
-		LOG_ERR("Error fetching value of variable [%s]", v->name);
+		LOG_ERR("Error fetching value of variable [" ZTACX_VARIABLE_NAME_FMT "]", ZTACX_VARIABLE_NAME_ARG(v));
 	}
 	return value;
 }
@@ -783,8 +2582,12 @@ bool ztacx_variable_value_get_bool(struct ztacx_variable *v)
 uint8_t ztacx_variable_value_get_byte(struct ztacx_variable *v)
 {
 	uint8_t value = 0;
+
+	if (v && (v->kind == ZTACX_VALUE_BYTE)) {
+		return *(volatile uint8_t *)&v->value.val_byte;
+	}
 	if (ztacx_variable_value_get(v, &value, sizeof(value)) != 0) {
-		LOG_ERR("Error fetching value of variable [%s]", v->name);
+		LOG_ERR("Error fetching value of variable [" ZTACX_VARIABLE_NAME_FMT "]", ZTACX_VARIABLE_NAME_ARG(v));
 	}
 	return value;
 }
@@ -792,8 +2595,12 @@ uint8_t ztacx_variable_value_get_byte(struct ztacx_variable *v)
 uint16_t ztacx_variable_value_get_uint16(struct ztacx_variable *v)
 {
 	uint16_t value = 0;
+
+	if (v && (v->kind == ZTACX_VALUE_UINT16)) {
+		return *(volatile uint16_t *)&v->value.val_uint16;
+	}
 	if (ztacx_variable_value_get(v, &value, sizeof(value)) != 0) {
-		LOG_ERR("Error fetching value of variable [%s]", v->name);
+		LOG_ERR("Error fetching value of variable [" ZTACX_VARIABLE_NAME_FMT "]", ZTACX_VARIABLE_NAME_ARG(v));
 	}
 	return value;
 }
@@ -801,8 +2608,12 @@ uint16_t ztacx_variable_value_get_uint16(struct ztacx_variable *v)
 int16_t ztacx_variable_value_get_int16(struct ztacx_variable *v)
 {
 	int16_t value = 0;
+
+	if (v && (v->kind == ZTACX_VALUE_INT16)) {
+		return *(volatile int16_t *)&v->value.val_int16;
+	}
 	if (ztacx_variable_value_get(v, &value, sizeof(value)) != 0) {
-		LOG_ERR("Error fetching value of variable [%s]", v->name);
+		LOG_ERR("Error fetching value of variable [" ZTACX_VARIABLE_NAME_FMT "]", ZTACX_VARIABLE_NAME_ARG(v));
 	}
 	return value;
 }
@@ -810,8 +2621,12 @@ int16_t ztacx_variable_value_get_int16(struct ztacx_variable *v)
 int32_t ztacx_variable_value_get_int32(struct ztacx_variable *v)
 {
 	int32_t value = 0;
+
+	if (v && (v->kind == ZTACX_VALUE_INT32)) {
+		return *(volatile int32_t *)&v->value.val_int32;
+	}
 	if (ztacx_variable_value_get(v, &value, sizeof(value)) != 0) {
-		LOG_ERR("Error fetching value of variable [%s]", v->name);
+		LOG_ERR("Error fetching value of variable [" ZTACX_VARIABLE_NAME_FMT "]", ZTACX_VARIABLE_NAME_ARG(v));
 	}
 	return value;
 }
@@ -819,81 +2634,143 @@ int32_t ztacx_variable_value_get_int32(struct ztacx_variable *v)
 int64_t ztacx_variable_value_get_int64(struct ztacx_variable *v)
 {
 	int64_t value = 0;
+
+	if (v && (v->kind == ZTACX_VALUE_INT64)) {
+		return ztacx_variable_read_int64(v);
+	}
 	if (ztacx_variable_value_get(v, &value, sizeof(value)) != 0) {
-		LOG_ERR("Error fetching value of variable [%s]", v->name);
+		LOG_ERR("Error fetching value of variable [" ZTACX_VARIABLE_NAME_FMT "]", ZTACX_VARIABLE_NAME_ARG(v));
 	}
 	return value;
 }
 
+/**
+ * @brief Borrow a pointer to the value of an inline string variable
+ *
+ * No copy is made, so the caller must finish with the string and then
+ * call @ref ztacx_variable_value_borrow_valid with the returned token;
+ * if that returns false a writer intervened and the string read may be
+ * torn.  Only variables declared with @ref ZTACX_STRING_INLINE can be
+ * borrowed (heap strings are freed when replaced); NULL is returned
+ * otherwise.
+ */
+const char *ztacx_variable_value_borrow_string(const struct ztacx_variable *v, atomic_val_t *token_r)
+{
+	atomic_val_t seq;
+
+	if (!v || (v->kind != ZTACX_VALUE_STRING) || !v->capacity || !token_r) {
+		return NULL;
+	}
+	do {
+		seq = atomic_get(&v->seq);
+	} while (seq & 1);
+
+	*token_r = seq;
+	return v->value.val_string;
+}
+
+bool ztacx_variable_value_borrow_valid(const struct ztacx_variable *v, atomic_val_t token)
+{
+	compiler_barrier();
+	return atomic_get(&v->seq) == token;
+}
+
+
+#if CONFIG_ZTACX_VARIABLE_DEBUG
+#define ZTACX_VARIABLE_TRACE_GET(...) LOG_DBG(__VA_ARGS__)
+#else
+#define ZTACX_VARIABLE_TRACE_GET(...) do { } while (0)
+#endif
+
 /**
  * Extract a value from ztacx_variable into a pointer
  */
 int ztacx_variable_value_get(const struct ztacx_variable *v, void *value_r, int value_size)
 {
+	k_spinlock_key_t key;
+	int rc = 0;
+
 	if (!v) {
 		return -EINVAL;
 	}
 
 	switch (v->kind) {
 	case ZTACX_VALUE_STRING:
-		if ((value_size<1) || strlen(v->value.val_string) >= value_size) {
+		if (value_size<1) {
 			// no room for return value
 			return -E2BIG;
 		}
+		key = k_spin_lock(&ztacx_value_lock);
 		if (v->value.val_string==NULL) {
 			// empty value => empty string
 			((char *)value_r)[0]='\0';
-			return 0;
 		}
-		// copy the value string into the return buffer
-		strncpy(value_r, v->value.val_string, value_size);
-		LOG_DBG("GET %s => [%s]", v->name, v->value.val_string);
+		else if (strlen(v->value.val_string) >= value_size) {
+			// no room for return value
+			rc = -E2BIG;
+		}
+		else {
+			// copy the value string into the return buffer
+			strncpy(value_r, v->value.val_string, value_size);
+		}
+		k_spin_unlock(&ztacx_value_lock, key);
+		if (rc == 0) {
+			ZTACX_VARIABLE_TRACE_GET("GET " ZTACX_VARIABLE_NAME_FMT " => [%s]", ZTACX_VARIABLE_NAME_ARG(v), (char *)value_r);
+		}
 		break;
 	case ZTACX_VALUE_BOOL:
-		*(bool *)value_r = v->value.val_bool;
-		LOG_DBG("GET %s => %c", v->name, v->value.val_bool?'T':'F');
+		*(bool *)value_r = *(volatile bool *)&v->value.val_bool;
+		ZTACX_VARIABLE_TRACE_GET("GET " ZTACX_VARIABLE_NAME_FMT " => %c", ZTACX_VARIABLE_NAME_ARG(v), (*(bool *)value_r)?'T':'F');
 		break;
 	case ZTACX_VALUE_BYTE:
-		*(uint8_t *)value_r = v->value.val_byte;
-		LOG_DBG("GET %s => %d", v->name, (int)v->value.val_byte);
+		*(uint8_t *)value_r = *(volatile uint8_t *)&v->value.val_byte;
+		ZTACX_VARIABLE_TRACE_GET("GET " ZTACX_VARIABLE_NAME_FMT " => %d", ZTACX_VARIABLE_NAME_ARG(v), (int)*(uint8_t *)value_r);
 		break;
 	case ZTACX_VALUE_UINT16:
-		*(uint16_t *)value_r = v->value.val_uint16;
-		LOG_DBG("GET %s => %d", v->name, (int)v->value.val_uint16);
+		*(uint16_t *)value_r = *(volatile uint16_t *)&v->value.val_uint16;
+		ZTACX_VARIABLE_TRACE_GET("GET " ZTACX_VARIABLE_NAME_FMT " => %d", ZTACX_VARIABLE_NAME_ARG(v), (int)*(uint16_t *)value_r);
 		break;
 	case ZTACX_VALUE_INT16:
-		*(int16_t *)value_r = v->value.val_int16;
-		LOG_DBG("GET %s => %d", v->name, (int)v->value.val_int16);
+		*(int16_t *)value_r = *(volatile int16_t *)&v->value.val_int16;
+		ZTACX_VARIABLE_TRACE_GET("GET " ZTACX_VARIABLE_NAME_FMT " => %d", ZTACX_VARIABLE_NAME_ARG(v), (int)*(int16_t *)value_r);
 		break;
 	case ZTACX_VALUE_INT32:
-		*(int32_t *)value_r = v->value.val_int32;
-		LOG_DBG("GET %s => %d", v->name, (int)v->value.val_int32);
+		*(int32_t *)value_r = *(volatile int32_t *)&v->value.val_int32;
+		ZTACX_VARIABLE_TRACE_GET("GET " ZTACX_VARIABLE_NAME_FMT " => %d", ZTACX_VARIABLE_NAME_ARG(v), (int)*(int32_t *)value_r);
 		break;
 	case ZTACX_VALUE_INT64:
-		*(int64_t *)value_r = v->value.val_int64;
-		LOG_DBG("GET %s => %d", v->name, (int)v->value.val_int64);
+		*(int64_t *)value_r = ztacx_variable_read_int64(v);
+		ZTACX_VARIABLE_TRACE_GET("GET " ZTACX_VARIABLE_NAME_FMT " => %lld", ZTACX_VARIABLE_NAME_ARG(v), (long long)*(int64_t *)value_r);
+		break;
+	case ZTACX_VALUE_EVENT:
+		// the oldest queued event, left in the queue for its consumer
+		if (value_size < sizeof(struct ztacx_event)) {
+			return -E2BIG;
+		}
+		if (!v->value.val_event) {
+			return -ENODEV;
+		}
+		rc = k_msgq_peek(&v->value.val_event->msgq, value_r);
 		break;
 	default:
 		LOG_ERR("Unhandled variable type %d", (int)v->kind);
 		return -EINVAL;
 	}
-	return 0;
+	return rc;
 }
 
 /**
- * Look up a variable by name from the settings list
+ * Look up a variable by name from the variables index
  */
 struct ztacx_variable *ztacx_variable_find(const char *name)
 {
-	sys_slist_t *list = &ztacx_variables;
-	struct ztacx_variable *v;
-	SYS_SLIST_FOR_EACH_CONTAINER(list, v, node) {
-		if (strcmp(v->name, name) == 0) {
-			return v;
-		}
+	struct ztacx_variable *v = ztacx_variable_index_find(&ztacx_variables_index, name);
+
+	if (!v) {
+		// callers (eg ZTACX_VAR_FIND) report a miss if it matters
+		LOG_DBG("no variable named '%s' found", name);
 	}
-	LOG_WRN("no variable named '%s' found", name);
-	return NULL;
+	return v;
 }
 
 int ztacx_variable_get(const char *name, void *value_r, int value_size)
@@ -912,7 +2789,11 @@ int ztacx_variable_set(const char *name, void *value)
 	return ztacx_variable_value_set(v, value);
 }
 
-
+/**
+ * @brief Set the single legacy on-change work item of a variable
+ *
+ * Prefer @ref ztacx_variable_subscribe, which allows many observers.
+ */
 int ztacx_variable_ptr_set_onchange(struct ztacx_variable *v, struct k_work *work)
 {
 	if (v->on_change) {
@@ -930,3 +2811,96 @@ int ztacx_variable_set_onchange(const char *name, struct k_work *work)
 	if (!v) return -ENOENT;
 	return ztacx_variable_ptr_set_onchange(v, work);
 }
+
+/**
+ * @brief Trigger the change notifications of a variable
+ *
+ * Called by the value setters; may be called from ISR context.
+ * Re-scheduling an already pending subscriber is a no-op, which is
+ * what coalesces a burst of changes into one callback.
+ */
+void ztacx_variable_notify(struct ztacx_variable *v)
+{
+	struct ztacx_subscriber *sub;
+	k_spinlock_key_t key;
+
+	if (v->on_change) {
+		LOG_DBG("Trigger on-change for " ZTACX_VARIABLE_NAME_FMT, ZTACX_VARIABLE_NAME_ARG(v));
+		k_work_submit_to_queue(ztacx_work_queue(ZTACX_WORK_INTERACTIVE), v->on_change);
+	}
+
+	key = k_spin_lock(&ztacx_subscriber_lock);
+	SYS_SLIST_FOR_EACH_CONTAINER(&v->subscribers, sub, node) {
+		int64_t delay = 0;
+
+		atomic_inc(&sub->changes);
+		if (sub->min_interval_ms && sub->last_run) {
+			delay = sub->last_run + sub->min_interval_ms - k_uptime_get();
+			if (delay < 0) {
+				delay = 0;
+			}
+		}
+		k_work_schedule_for_queue(ztacx_work_queue(ZTACX_WORK_INTERACTIVE), &sub->work, K_MSEC(delay));
+	}
+	k_spin_unlock(&ztacx_subscriber_lock, key);
+}
+
+static void ztacx_subscriber_work(struct k_work *work)
+{
+	struct ztacx_subscriber *sub = CONTAINER_OF(k_work_delayable_from_work(work),
+						    struct ztacx_subscriber, work);
+	int changes = (int)atomic_set(&sub->changes, 0);
+
+	if (changes == 0) {
+		return;
+	}
+	sub->last_run = k_uptime_get();
+	sub->cb(sub, changes);
+}
+
+/**
+ * @brief Subscribe to changes of a variable
+ *
+ * @param v the variable to watch
+ * @param sub caller-owned subscription, which must outlive the subscription
+ * @param cb function to call (from the ztacx interactive work queue) after a change
+ * @param min_interval_ms minimum time between callbacks, 0 for no limit
+ */
+int ztacx_variable_subscribe(struct ztacx_variable *v, struct ztacx_subscriber *sub, ztacx_subscriber_cb_t cb, uint32_t min_interval_ms)
+{
+	k_spinlock_key_t key;
+
+	if (!v || !sub || !cb) {
+		return -EINVAL;
+	}
+	k_work_init_delayable(&sub->work, ztacx_subscriber_work);
+	sub->variable = v;
+	sub->cb = cb;
+	sub->min_interval_ms = min_interval_ms;
+	sub->last_run = 0;
+	atomic_set(&sub->changes, 0);
+
+	key = k_spin_lock(&ztacx_subscriber_lock);
+	sys_slist_append(&v->subscribers, &sub->node);
+	k_spin_unlock(&ztacx_subscriber_lock, key);
+	return 0;
+}
+
+int ztacx_variable_unsubscribe(struct ztacx_subscriber *sub)
+{
+	k_spinlock_key_t key;
+	bool found;
+
+	if (!sub || !sub->variable) {
+		return -EINVAL;
+	}
+	key = k_spin_lock(&ztacx_subscriber_lock);
+	found = sys_slist_find_and_remove(&sub->variable->subscribers, &sub->node);
+	k_spin_unlock(&ztacx_subscriber_lock, key);
+	if (!found) {
+		return -ENOENT;
+	}
+	k_work_cancel_delayable(&sub->work);
+	sub->variable = NULL;
+	return 0;
+}
@@ -41,7 +41,7 @@ enum battery_value_index {
 	VALUE_MILLIVOLTS,
 	VALUE_NOTIFY,
 };
-static struct ztacx_variable battery_values[]={
+static ZTACX_VARIABLES_DEFINE(battery_values) = {
 	{"battery_ok", ZTACX_VALUE_BOOL, {.val_bool=false}},
 	{"battery_level_percent", ZTACX_VALUE_BYTE, {.val_byte=0}},
 	{"battery_millivolts", ZTACX_VALUE_UINT16, {.val_uint16=0}},
@@ -50,7 +50,8 @@ static struct ztacx_variable battery_values[]={
 
 
 static int16_t battery_samples[BUFFER_SIZE];
-static struct k_work_delayable battery_work;
+static struct ztacx_leaf_work battery_work;
+static struct ztacx_publish battery_publish;
 
 const struct bt_gatt_attr *battery_millivolt_attr = NULL;
 
@@ -80,6 +81,12 @@ static struct adc_sequence battery_asp = {
 
 
 void battery_read(struct k_work *work);
+
+static void battery_schedule(void)
+{
+	uint32_t period_ms = MSEC_PER_SEC * battery_settings[SETTING_READ_INTERVAL_SEC].value.val_uint16;
+	ztacx_leaf_work_set_period(&battery_work, period_ms, ZTACX_PERIODIC_SLACK(period_ms));
+}
 int cmd_ztacx_battery(const struct shell *shell, size_t argc, char **argv);
 
 int ztacx_battery_init(struct ztacx_leaf *leaf)
@@ -90,8 +97,10 @@ int ztacx_battery_init(struct ztacx_leaf *leaf)
 		return -ENOENT;
 	}
 
-	ztacx_settings_register(battery_settings, ARRAY_SIZE(battery_settings));
-	ztacx_variables_register(battery_values, ARRAY_SIZE(battery_values));
+	ztacx_settings_register_leaf(leaf, battery_settings, ARRAY_SIZE(battery_settings));
+	// the last reading stands until the first read after a wake
+	ztacx_variable_retain(&battery_values[VALUE_LEVEL_PERCENT]);
+	ztacx_variable_retain(&battery_values[VALUE_MILLIVOLTS]);
 
 	memset(battery_samples, 0, sizeof(battery_samples));
 
@@ -120,8 +129,8 @@ int ztacx_battery_init(struct ztacx_leaf *leaf)
 
 int ztacx_battery_start(struct ztacx_leaf *leaf)
 {
-	k_work_init_delayable(&battery_work, battery_read);
-	k_work_schedule(&battery_work, K_NO_WAIT);
+	ztacx_leaf_work_init(leaf, &battery_work, battery_read);
+	battery_schedule();
 
 	return 0;
 }
@@ -161,14 +170,10 @@ void battery_read(struct k_work *work)
 		LOG_INF("Zephyr millivolt conversion is %d", val);
 
 
-		int delta = abs(val - battery_values[VALUE_MILLIVOLTS].value.val_uint16);
-		int threshold = battery_settings[SETTING_MILLIVOLT_CHANGE_THRESHOLD].value.val_uint16;
-		bool first_reading = (battery_values[VALUE_MILLIVOLTS].value.val_uint16 == 0);
-		bool significant_change = !first_reading && (delta >= threshold);
-		if (first_reading || significant_change) {
+		battery_publish.deadband = battery_settings[SETTING_MILLIVOLT_CHANGE_THRESHOLD].value.val_uint16;
+		if (ztacx_variable_publish(&(battery_values[VALUE_MILLIVOLTS]), &battery_publish, val) > 0) {
 			uint16_t battery_millivolt_value = val;
 
-			ztacx_variable_value_set(&(battery_values[VALUE_MILLIVOLTS]), &battery_millivolt_value);
 			// 2032 presume 3340mv=full, 2240mv=flat
 			//battery_level_percent = (val - 2240) * 100 / (3340-2240);
 			// 3s 18650 presume 12300mv=full, 9600mv=flat
@@ -200,8 +205,8 @@ void battery_read(struct k_work *work)
 #endif
 
 	if (work){
-		k_work_reschedule(&battery_work,
-				  K_SECONDS(battery_settings[SETTING_READ_INTERVAL_SEC].value.val_uint16));
+		// follow any change to the read interval
+		battery_schedule();
 	}
 
 
@@ -219,6 +224,7 @@ int cmd_ztacx_battery(const struct shell *shell, size_t argc, char **argv)
 #if CONFIG_BT_GATT_CLIENT
 	bool notify = (argc > 1) && (strcmp(argv[1],"notify")==0);
 	if (notify) {
+		uint16_t battery_millivolt_value = ztacx_variable_value_get_uint16(&battery_values[VALUE_MILLIVOLTS]);
 		bt_gatt_notify(NULL, battery_millivolt_attr,
 			       &battery_millivolt_value, sizeof(battery_millivolt_value));
 	}
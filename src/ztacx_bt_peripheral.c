@@ -21,7 +21,7 @@ enum bt_peripheral_setting_index {
 };
 
 static struct ztacx_variable bt_peripheral_settings[] = {
-	{"peripheral_name", ZTACX_VALUE_STRING,{.val_string="ztacx"}},
+	{"peripheral_name", ZTACX_VALUE_STRING, ZTACX_STRING_INLINE(STRING_CHAR_MAX+1, "ztacx")},
 	{"peripheral_tx_power", ZTACX_VALUE_UINT16,{.val_uint16 = 0}},
 };
 #endif
@@ -34,7 +34,7 @@ enum peripheral_value_index {
 	VALUE_LAST_DISCONNECT, 
 };
 
-static struct ztacx_variable bt_peripheral_values[]={
+static ZTACX_VARIABLES_DEFINE(bt_peripheral_values) = {
 	{"bt_peripheral_ok", ZTACX_VALUE_BOOL, {.val_bool=false}},
 	{"bt_peripheral_advertising", ZTACX_VALUE_BOOL, {.val_bool=false}},
 	{"bt_peripheral_connected", ZTACX_VALUE_BOOL, {.val_bool=false}},
@@ -135,50 +135,65 @@ ssize_t bt_read_variable(struct bt_conn *conn, const struct bt_gatt_attr *attr,
 		LOG_ERR("Offset handling not implemented");
 		return -EIO;
 	}
+
+	// Take a consistent snapshot of the value, since it may be
+	// concurrently updated by a leaf's work handler
+	union ztacx_value value;
+	char value_string[STRING_CHAR_MAX+1];
 	int expect_len ;
 	switch (v->kind) {
 	case ZTACX_VALUE_STRING:
-		expect_len = strlen(v->value.val_string);
+		if (ztacx_variable_value_get(v, value_string, sizeof(value_string)) != 0) {
+			LOG_WRN("Value too long for string characteristic");
+			return -EINVAL;
+		}
+		expect_len = strlen(value_string);
 		if (len < expect_len) {
 			LOG_WRN("Unexpected length for string (%d < %d)", len, expect_len);
 		}
-		return bt_gatt_attr_read(conn, attr, buf, len, offset, v->value.val_string, strlen(v->value.val_string));
+		return bt_gatt_attr_read(conn, attr, buf, len, offset, value_string, expect_len);
 	case ZTACX_VALUE_BOOL:
 		expect_len = 1;
 		if (len < expect_len) {
 			LOG_WRN("Unexpected length for bool (%d != %d)", len, expect_len);
 		}
-		return bt_gatt_attr_read(conn, attr, buf, len, offset, &v->value.val_bool, sizeof(bool));
+		value.val_bool = ztacx_variable_value_get_bool(v);
+		return bt_gatt_attr_read(conn, attr, buf, len, offset, &value.val_bool, sizeof(bool));
 	case ZTACX_VALUE_BYTE:
 		expect_len = 1;
 		if (len < expect_len) {
 			LOG_WRN("Unexpected length for byte (%d < %d)", len, expect_len);
 		}
-		return bt_gatt_attr_read(conn, attr, buf, len, offset, &v->value.val_byte, sizeof(uint8_t));
+		value.val_byte = ztacx_variable_value_get_byte(v);
+		return bt_gatt_attr_read(conn, attr, buf, len, offset, &value.val_byte, sizeof(uint8_t));
 	case ZTACX_VALUE_UINT16:
 		expect_len = 2;
 		if (len < expect_len) {
 			LOG_WRN("Unexpected length for uint16 (%d < %d)", len, expect_len);
 		}
-		return bt_gatt_attr_read(conn, attr, buf, len, offset, &v->value.val_uint16, sizeof(uint16_t));
+		value.val_uint16 = ztacx_variable_value_get_uint16(v);
+		return bt_gatt_attr_read(conn, attr, buf, len, offset, &value.val_uint16, sizeof(uint16_t));
 	case ZTACX_VALUE_INT16:
 		expect_len = 2;
 		if (len < expect_len) {
 			LOG_WRN("Unexpected length for int16 (%d < %d)", len, expect_len);
 		}
-		return bt_gatt_attr_read(conn, attr, buf, len, offset, &v->value.val_int16, sizeof(int16_t));
+		value.val_int16 = ztacx_variable_value_get_int16(v);
+		return bt_gatt_attr_read(conn, attr, buf, len, offset, &value.val_int16, sizeof(int16_t));
 	case ZTACX_VALUE_INT32:
 		expect_len = 4;
 		if (len < expect_len) {
 			LOG_WRN("Unexpected length for int32 (%d < %d)", len, expect_len);
 		}
-		return bt_gatt_attr_read(conn, attr, buf, len, offset, &v->value.val_int32, sizeof(int32_t));
+		value.val_int32 = ztacx_variable_value_get_int32(v);
+		return bt_gatt_attr_read(conn, attr, buf, len, offset, &value.val_int32, sizeof(int32_t));
 	case ZTACX_VALUE_INT64:
 		expect_len = 8;
 		if (len < expect_len) {
 			LOG_WRN("Unexpected length for int64 (%d < %d)", len, expect_len);
 		}
-		return bt_gatt_attr_read(conn, attr, buf, len, offset, &v->value.val_int64, sizeof(int64_t));
+		value.val_int64 = ztacx_variable_value_get_int64(v);
+		return bt_gatt_attr_read(conn, attr, buf, len, offset, &value.val_int64, sizeof(int64_t));
 	default:
 		LOG_ERR("Unhandled variable kind %d", (int)v->kind);
 		return -EINVAL;
@@ -212,12 +227,19 @@ ssize_t bt_write_variable(struct bt_conn *conn, const struct bt_gatt_attr *attr,
 			return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
 		}
 
-		char *val_string = v->value.val_string;
-		if (offset+len > strlen(val_string)) {
-			val_string = realloc(val_string, offset+len);
+		// Assemble the new value on the stack so that partial
+		// writes never resize the variable's storage
+		char val_string[STRING_CHAR_MAX+1];
+		if (ztacx_variable_value_get(v, val_string, sizeof(val_string)) != 0) {
+			val_string[0] = '\0';
+		}
+		if (offset > strlen(val_string)) {
+			return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+		}
+		memcpy(val_string + offset, value_buf, len+1);
+		if (ztacx_variable_value_set_string(v, val_string) != 0) {
+			return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
 		}
-		strncpy(val_string + offset, value_buf, STRING_CHAR_MAX-offset+1);
-		ztacx_variable_value_set_string(v, val_string);
 	}
 		break;
 	case ZTACX_VALUE_BOOL: 
@@ -273,6 +295,7 @@ ssize_t bt_write_variable(struct bt_conn *conn, const struct bt_gatt_attr *attr,
 		memcpy(value + offset, buf, len);
 		ztacx_variable_value_set_int16(v, val_int16);
 	}
+		break;
 	case ZTACX_VALUE_INT32:
 	{
 		int32_t newval = ((int32_t*)buf)[0];
@@ -281,11 +304,12 @@ ssize_t bt_write_variable(struct bt_conn *conn, const struct bt_gatt_attr *attr,
 		if (offset + len > sizeof(int32_t)) {
 			return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
 		}
-		uint16_t val_int32 = ztacx_variable_value_get_int32(v);
+		int32_t val_int32 = ztacx_variable_value_get_int32(v);
 		char *value = (char *)&val_int32;
 		memcpy(value + offset, buf, len);
 		ztacx_variable_value_set_int32(v, val_int32);
 	}
+		break;
 	case ZTACX_VALUE_INT64:
 	{
 		int64_t newval = ((int64_t*)buf)[0];
@@ -294,16 +318,22 @@ ssize_t bt_write_variable(struct bt_conn *conn, const struct bt_gatt_attr *attr,
 		if (offset + len > sizeof(int64_t)) {
 			return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
 		}
-		uint64_t val_int64 = ztacx_variable_value_get_int64(v);
-		char *value = (char *)&v->value.val_int64;
+		int64_t val_int64 = ztacx_variable_value_get_int64(v);
+		char *value = (char *)&val_int64;
 		memcpy(value + offset, buf, len);
 		ztacx_variable_value_set_int64(v, val_int64);
 	}
+		break;
 	default:
 		LOG_ERR("Unhandled variable kind %d", (int)v->kind);
 		return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
 	}
 
+#if CONFIG_ZTACX_LEAF_SETTINGS
+	// a setting is persisted later on the settings work queue, not in
+	// BT RX context (-ENOENT for a state variable)
+	(void)ztacx_setting_mark_dirty(v);
+#endif
 	return len;
 }
 
@@ -319,7 +349,7 @@ int ztacx_bt_adv_register(const struct bt_data *adv_data, int adv_len, const str
 	
 	if (ztacx_variable_value_get_bool(&bt_peripheral_values[VALUE_OK]) && bt_adv_data && bt_adv_data_size) {
 		LOG_INF("Registering advertising data with bluetooth subsystem");
-		k_work_submit(&advertise_work);
+		k_work_submit_to_queue(ztacx_work_queue(ZTACX_WORK_BACKGROUND), &advertise_work);
 	}
 	else {
 		LOG_INF("Bluetooth is not ready (will advertise later)");
@@ -424,7 +454,17 @@ int ztacx_bt_characteristic_register(struct bt_gatt_service *service, const stru
 			service->attr_count ++;
 		}
 		else {
-			struct bt_gatt_attr cud = BT_GATT_CUD(v->name, BT_GATT_PERM_READ);
+			// a prefixed name is composed once, the descriptor keeps a pointer to it
+			const char *desc = v->name;
+			if (v->prefix) {
+				char name[CONFIG_ZTACX_VALUE_NAME_MAX];
+				ztacx_variable_name(v, name, sizeof(name));
+				desc = strdup(name);
+				if (!desc) {
+					return -ENOMEM;
+				}
+			}
+			struct bt_gatt_attr cud = BT_GATT_CUD(desc, BT_GATT_PERM_READ);
 			memcpy(service->attrs+service->attr_count, &cud, sizeof(struct bt_gatt_attr));
 			service->attr_count ++;
 		}
@@ -577,7 +617,7 @@ void bt_cb_disconnected(struct bt_conn *conn, uint8_t reason)
 
 	ztacx_variable_value_set_int64(&bt_peripheral_values[VALUE_LAST_DISCONNECT], k_uptime_get());
 	ztacx_variable_value_set_bool(&bt_peripheral_values[VALUE_CONNECTED], false);
-	k_work_submit(&advertise_work);
+	k_work_submit_to_queue(ztacx_work_queue(ZTACX_WORK_BACKGROUND), &advertise_work);
 }
 
 static struct bt_conn_cb conn_callbacks = {
@@ -636,7 +676,7 @@ int bt_advertise_name(const char *name)
 	}
 #endif
 	
-	k_work_submit(&advertise_work);
+	k_work_submit_to_queue(ztacx_work_queue(ZTACX_WORK_BACKGROUND), &advertise_work);
 	return 0;
 }
 
@@ -659,7 +699,10 @@ static void bt_ready(int err)
 #endif
 	
 #if CONFIG_BT_SETTINGS
-	LOG_INF("Loading bluetooth peristent state");
+	// the host applies its keys and identity only once enabled, so
+	// the bt subtree must be loaded again here: the single settings
+	// load runs before any leaf starts, before bt_enable
+	LOG_INF("Loading bluetooth persistent state");
 	settings_load_subtree("bt");
 #endif
 			
@@ -711,9 +754,8 @@ int ztacx_bt_peripheral_init(struct ztacx_leaf *leaf)
 
 #if CONFIG_ZTACX_LEAF_SETTINGS && (CONFIG_BT_DEVICE_NAME_DYNAMIC || CONFIG_BT_CTLR_TX_PWR_DYNAMIC_CONTROL)
 
-	ztacx_settings_register(bt_peripheral_settings, ARRAY_SIZE(bt_peripheral_settings));
+	ztacx_settings_register_leaf(leaf, bt_peripheral_settings, ARRAY_SIZE(bt_peripheral_settings));
 #endif
-	ztacx_variables_register(bt_peripheral_values, ARRAY_SIZE(bt_peripheral_values));
 
 	bt_conn_cb_register(&conn_callbacks);
 
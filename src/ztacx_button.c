@@ -33,7 +33,7 @@ void button_pressed(const struct device *dev, struct gpio_callback *cb,
 	k_event_post(&ztacx_button_event, ctx->event_bit);
 #endif
 	if (ctx->handler) {
-		k_work_submit(ctx->handler);
+		k_work_submit_to_queue(ztacx_work_queue(ZTACX_WORK_INTERACTIVE), ctx->handler);
 	}
 }
 
@@ -81,7 +81,8 @@ int ztacx_button_init(struct ztacx_leaf *leaf)
 	LOG_INF("Set up button at %s pin %d\n", ctx->button.port->name, ctx->button.pin);
 
 	// register a state variable or the button
-	snprintf(ctx->state.name, CONFIG_ZTACX_VALUE_NAME_MAX, "%s_state", leaf->name);
+	ctx->state.name = "state";
+	ctx->state.prefix = leaf->name;
 	ctx->state.kind = ZTACX_VALUE_BOOL;
 	ctx->state.value.val_bool = false;
 	ztacx_variables_register(&ctx->state, 1);
@@ -0,0 +1,541 @@
+#include "ztacx.h"
+
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+
+/*
+ * Counter journal
+ *
+ * Counter variables are incremented in RAM as usual.  At each
+ * checkpoint, every counter that has changed appends a 16 byte record
+ * (id, value, CRC) to the active sector of the counter_storage flash
+ * partition, so flash is only ever programmed from erased, and a
+ * sector is erased once per fill.  When the active sector is full, the
+ * current values are written to the next sector in the partition and
+ * its header (magic, sequence) is written last; the sectors are used
+ * in turn, spreading erases evenly over the partition.
+ *
+ * At boot the valid sector with the highest sequence is replayed, the
+ * last good record of each counter winning.  A record torn by reset or
+ * brownout fails its CRC and is skipped, so a counter comes back with
+ * exactly the value of its last completed write: its last checkpoint,
+ * or for an exact counter (ZTACX_COUNTER_EXACT) its last increment made
+ * through ztacx_counter_increment.
+ *
+ * If a rotation fails (eg the erase), the next ones are put off by
+ * twice as many checkpoints each time, up to
+ * ZTACX_COUNTER_BACKOFF_MAX, so that a failing sector is not erased
+ * again at every checkpoint.  The counters carry on in RAM meanwhile.
+ *
+ * Counters are identified in the journal by the hash of their name
+ * alone, so two attached counters with the same hash are refused.
+ */
+
+#define ZTACX_COUNTER_AREA FLASH_AREA_ID(counter_storage)
+#define ZTACX_COUNTER_MAGIC 0x7A636E74U
+#define ZTACX_COUNTER_HEADER_SIZE 16
+#define ZTACX_COUNTER_RECORD_SIZE 16
+#define ZTACX_COUNTER_ERASED 0xFFFFFFFFU
+#define ZTACX_COUNTER_BACKOFF_MAX 64
+
+struct ztacx_counter
+{
+	struct ztacx_variable *variable;
+	uint32_t id;
+	int64_t checkpointed;
+	bool recovered;
+	bool exact;
+};
+
+static struct ztacx_counter ztacx_counters[CONFIG_ZTACX_COUNTER_MAX];
+static int ztacx_counter_count;
+
+static const struct flash_area *ztacx_counter_fa;
+static uint32_t ztacx_counter_sectors;
+static uint32_t ztacx_counter_sector;
+static uint32_t ztacx_counter_seq;
+static uint32_t ztacx_counter_pos;
+static bool ztacx_counter_ready;
+static uint32_t ztacx_counter_backoff;
+static uint32_t ztacx_counter_backoff_left;
+
+static struct ztacx_leaf_work ztacx_counter_work;
+SYS_MUTEX_DEFINE(ztacx_counter_mutex);
+
+static struct
+{
+	uint32_t checkpoints;
+	uint32_t records;
+	uint32_t erases;
+	uint32_t torn;
+	uint32_t rotate_failures;
+	uint32_t last_checkpoint_us;
+	uint32_t max_checkpoint_us;
+} ztacx_counter_stats;
+
+static off_t ztacx_counter_offset(uint32_t sector, uint32_t pos)
+{
+	return (off_t)sector * CONFIG_ZTACX_COUNTER_SECTOR_SIZE + pos;
+}
+
+static struct ztacx_counter *ztacx_counter_find_id(uint32_t id)
+{
+	for (int i=0; i<ztacx_counter_count; i++) {
+		if (ztacx_counters[i].id == id) {
+			return &ztacx_counters[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Keep the value recovered for a counter id, until the counter is attached
+ */
+static struct ztacx_counter *ztacx_counter_slot(uint32_t id)
+{
+	struct ztacx_counter *c = ztacx_counter_find_id(id);
+
+	if (!c && (ztacx_counter_count < ARRAY_SIZE(ztacx_counters))) {
+		c = &ztacx_counters[ztacx_counter_count++];
+		c->id = id;
+	}
+	return c;
+}
+
+static int64_t ztacx_counter_value(struct ztacx_variable *v)
+{
+	return (v->kind == ZTACX_VALUE_INT32) ?
+		ztacx_variable_value_get_int32(v) : ztacx_variable_value_get_int64(v);
+}
+
+/**
+ * Find the active sector and replay its records
+ */
+static int ztacx_counter_recover(void)
+{
+	uint8_t buf[ZTACX_COUNTER_RECORD_SIZE];
+	bool found = false;
+	int err;
+
+	err = flash_area_open(ZTACX_COUNTER_AREA, &ztacx_counter_fa);
+	if (err != 0) {
+		LOG_ERR("Cannot open counter_storage partition: %d", err);
+		return err;
+	}
+	ztacx_counter_sectors = ztacx_counter_fa->fa_size / CONFIG_ZTACX_COUNTER_SECTOR_SIZE;
+	if (ztacx_counter_sectors < 2) {
+		LOG_ERR("counter_storage partition needs at least two %d byte sectors",
+			CONFIG_ZTACX_COUNTER_SECTOR_SIZE);
+		return -EINVAL;
+	}
+
+	for (uint32_t s=0; s<ztacx_counter_sectors; s++) {
+		if (flash_area_read(ztacx_counter_fa, ztacx_counter_offset(s, 0), buf, ZTACX_COUNTER_HEADER_SIZE) != 0) {
+			continue;
+		}
+		uint32_t seq = sys_get_le32(buf+4);
+		if ((sys_get_le32(buf) == ZTACX_COUNTER_MAGIC) &&
+		    (sys_get_le32(buf+8) == crc32_ieee(buf, 8)) &&
+		    (!found || ((int32_t)(seq - ztacx_counter_seq) > 0))) {
+			ztacx_counter_sector = s;
+			ztacx_counter_seq = seq;
+			found = true;
+		}
+	}
+	ztacx_counter_pos = ZTACX_COUNTER_HEADER_SIZE;
+	if (!found) {
+		// a fresh partition, the first checkpoint starts sector 0
+		LOG_INF("No counter journal, starting one");
+		ztacx_counter_sector = ztacx_counter_sectors - 1;
+		ztacx_counter_pos = CONFIG_ZTACX_COUNTER_SECTOR_SIZE;
+		return 0;
+	}
+
+	while (ztacx_counter_pos + ZTACX_COUNTER_RECORD_SIZE <= CONFIG_ZTACX_COUNTER_SECTOR_SIZE) {
+		err = flash_area_read(ztacx_counter_fa,
+				      ztacx_counter_offset(ztacx_counter_sector, ztacx_counter_pos),
+				      buf, sizeof(buf));
+		if ((err != 0) || (sys_get_le32(buf) == ZTACX_COUNTER_ERASED)) {
+			break;
+		}
+		ztacx_counter_pos += ZTACX_COUNTER_RECORD_SIZE;
+		if (sys_get_le32(buf+12) != crc32_ieee(buf, 12)) {
+			ztacx_counter_stats.torn++;
+			continue;
+		}
+		struct ztacx_counter *c = ztacx_counter_slot(sys_get_le32(buf));
+		if (c) {
+			c->checkpointed = (int64_t)sys_get_le64(buf+4);
+			c->recovered = true;
+		}
+	}
+	LOG_INF("Counter journal sector %u seq %u, %d counters recovered",
+		ztacx_counter_sector, ztacx_counter_seq, ztacx_counter_count);
+	return 0;
+}
+
+static int ztacx_counter_write_record(uint32_t sector, uint32_t pos, uint32_t id, int64_t value)
+{
+	uint8_t rec[ZTACX_COUNTER_RECORD_SIZE];
+
+	sys_put_le32(id, rec);
+	sys_put_le64((uint64_t)value, rec+4);
+	sys_put_le32(crc32_ieee(rec, 12), rec+12);
+	ztacx_counter_stats.records++;
+	return flash_area_write(ztacx_counter_fa, ztacx_counter_offset(sector, pos), rec, sizeof(rec));
+}
+
+/**
+ * Start the next sector with the current value of every counter
+ *
+ * The header is written last, so until it is the previous sector
+ * remains the active one.
+ */
+static int ztacx_counter_rotate(int64_t *values)
+{
+	uint32_t sector = (ztacx_counter_sector + 1) % ztacx_counter_sectors;
+	uint32_t pos = ZTACX_COUNTER_HEADER_SIZE;
+	uint8_t header[ZTACX_COUNTER_HEADER_SIZE];
+	int err;
+
+	err = flash_area_erase(ztacx_counter_fa, ztacx_counter_offset(sector, 0), CONFIG_ZTACX_COUNTER_SECTOR_SIZE);
+	if (err != 0) {
+		return err;
+	}
+	ztacx_counter_stats.erases++;
+	for (int i=0; i<ztacx_counter_count; i++) {
+		struct ztacx_counter *c = &ztacx_counters[i];
+		int64_t value = c->variable ? values[i] : c->checkpointed;
+
+		if (pos + ZTACX_COUNTER_RECORD_SIZE > CONFIG_ZTACX_COUNTER_SECTOR_SIZE) {
+			return -ENOSPC;
+		}
+		err = ztacx_counter_write_record(sector, pos, c->id, value);
+		if (err != 0) {
+			return err;
+		}
+		pos += ZTACX_COUNTER_RECORD_SIZE;
+	}
+
+	memset(header, 0xFF, sizeof(header));
+	sys_put_le32(ZTACX_COUNTER_MAGIC, header);
+	sys_put_le32(ztacx_counter_seq + 1, header+4);
+	sys_put_le32(crc32_ieee(header, 8), header+8);
+	err = flash_area_write(ztacx_counter_fa, ztacx_counter_offset(sector, 0), header, sizeof(header));
+	if (err != 0) {
+		return err;
+	}
+
+	ztacx_counter_sector = sector;
+	ztacx_counter_seq++;
+	ztacx_counter_pos = pos;
+	for (int i=0; i<ztacx_counter_count; i++) {
+		if (ztacx_counters[i].variable) {
+			ztacx_counters[i].checkpointed = values[i];
+		}
+	}
+	return 0;
+}
+
+/**
+ * Read every attached counter, returning how many differ from the journal
+ *
+ * Called with the counter mutex held.
+ */
+static int ztacx_counter_snapshot(int64_t *values)
+{
+	int changed = 0;
+
+	for (int i=0; i<ztacx_counter_count; i++) {
+		struct ztacx_counter *c = &ztacx_counters[i];
+
+		if (c->variable) {
+			values[i] = ztacx_counter_value(c->variable);
+			if (values[i] != c->checkpointed) {
+				changed++;
+			}
+		}
+	}
+	return changed;
+}
+
+/**
+ * Append a record for each changed counter, rotating if the sector is full
+ *
+ * Called with the counter mutex held.
+ *
+ * @return -EAGAIN if a rotation is put off after a failed one
+ */
+static int ztacx_counter_append(int64_t *values, int changed)
+{
+	int err = 0;
+
+	if (ztacx_counter_pos + changed * ZTACX_COUNTER_RECORD_SIZE > CONFIG_ZTACX_COUNTER_SECTOR_SIZE) {
+		if (ztacx_counter_backoff_left) {
+			ztacx_counter_backoff_left--;
+			return -EAGAIN;
+		}
+		err = ztacx_counter_rotate(values);
+		if (err != 0) {
+			ztacx_counter_stats.rotate_failures++;
+			ztacx_counter_backoff = CLAMP(ztacx_counter_backoff * 2, 1, ZTACX_COUNTER_BACKOFF_MAX);
+			ztacx_counter_backoff_left = ztacx_counter_backoff;
+			LOG_WRN("Counter journal rotation failed (%d), next try in %u checkpoints",
+				err, ztacx_counter_backoff);
+		}
+		else {
+			ztacx_counter_backoff = 0;
+		}
+		return err;
+	}
+	for (int i=0; (err == 0) && (i<ztacx_counter_count); i++) {
+		struct ztacx_counter *c = &ztacx_counters[i];
+
+		if (!c->variable || (values[i] == c->checkpointed)) {
+			continue;
+		}
+		err = ztacx_counter_write_record(ztacx_counter_sector, ztacx_counter_pos, c->id, values[i]);
+		// a failed write may have programmed part of the slot, so skip it either way
+		ztacx_counter_pos += ZTACX_COUNTER_RECORD_SIZE;
+		if (err == 0) {
+			c->checkpointed = values[i];
+		}
+	}
+	return err;
+}
+
+/**
+ * @brief Write the value of every counter that has changed to the journal
+ *
+ * Runs periodically (CONFIG_ZTACX_COUNTER_CHECKPOINT_MS), and should
+ * be called before a planned reset or power off.
+ */
+int ztacx_counter_checkpoint(void)
+{
+	int64_t values[CONFIG_ZTACX_COUNTER_MAX];
+	uint32_t start = k_cycle_get_32();
+	int changed;
+	int err;
+
+	if (!ztacx_counter_ready) {
+		return -ENODEV;
+	}
+	while (sys_mutex_lock(&ztacx_counter_mutex, K_MSEC(500)) != 0) {
+		LOG_WRN("ztacx counter mutex is held too long");
+	}
+	changed = ztacx_counter_snapshot(values);
+	if (!changed) {
+		sys_mutex_unlock(&ztacx_counter_mutex);
+		return 0;
+	}
+	err = ztacx_counter_append(values, changed);
+
+	uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+	ztacx_counter_stats.checkpoints++;
+	ztacx_counter_stats.last_checkpoint_us = us;
+	ztacx_counter_stats.max_checkpoint_us = MAX(ztacx_counter_stats.max_checkpoint_us, us);
+	sys_mutex_unlock(&ztacx_counter_mutex);
+
+	if ((err != 0) && (err != -EAGAIN)) {
+		LOG_ERR("Counter checkpoint failed: %d", err);
+	}
+	return err;
+}
+
+/**
+ * @brief Add to a counter variable, journalling it now if it is exact
+ *
+ * For a counter attached with ZTACX_COUNTER_EXACT the new value is in
+ * flash when this returns 0, at the cost of a 16 byte record (and a
+ * flash write) per call; use it for low-rate counters such as boots
+ * or faults.  Other counters (and variables that are not counters) are
+ * just incremented, as with a get and set.
+ *
+ * @return -EAGAIN if the journal is full and its rotation is put off
+ * after a failed one; the value is incremented in RAM regardless
+ */
+int ztacx_counter_increment(struct ztacx_variable *v, int64_t delta)
+{
+	int64_t values[CONFIG_ZTACX_COUNTER_MAX];
+	struct ztacx_counter *c;
+	int64_t value;
+	int err;
+
+	if (!v || ((v->kind != ZTACX_VALUE_INT32) && (v->kind != ZTACX_VALUE_INT64))) {
+		return -EINVAL;
+	}
+	while (sys_mutex_lock(&ztacx_counter_mutex, K_MSEC(500)) != 0) {
+		LOG_WRN("ztacx counter mutex is held too long");
+	}
+	value = ztacx_counter_value(v) + delta;
+	if (v->kind == ZTACX_VALUE_INT32) {
+		int32_t value32 = (int32_t)value;
+		err = ztacx_variable_value_set(v, &value32);
+	}
+	else {
+		err = ztacx_variable_value_set_int64(v, value);
+	}
+	c = ztacx_counter_find_id(v->hash);
+	if ((err == 0) && ztacx_counter_ready && c && (c->variable == v) && c->exact) {
+		err = ztacx_counter_append(values, ztacx_counter_snapshot(values));
+		if (err != 0) {
+			LOG_ERR("Counter " ZTACX_VARIABLE_NAME_FMT " journal write failed: %d",
+				ZTACX_VARIABLE_NAME_ARG(v), err);
+		}
+	}
+	sys_mutex_unlock(&ztacx_counter_mutex);
+	return err;
+}
+
+static void ztacx_counter_checkpoint_work(struct k_work *work)
+{
+	ztacx_counter_checkpoint();
+}
+
+/**
+ * @brief Make a counter variable persistent
+ *
+ * The variable (INT32 or INT64) is set to the value recovered from the
+ * journal, if any, and is journalled from then on.  Call from leaf
+ * init, before the counter is first incremented.
+ *
+ * A ZTACX_COUNTER_CHECKPOINT counter is written at each checkpoint, so
+ * an unplanned reset (eg brownout) loses at most the increments made in
+ * the last CONFIG_ZTACX_COUNTER_CHECKPOINT_MS; planned resets and
+ * system off checkpoint first and lose none.  A ZTACX_COUNTER_EXACT
+ * counter incremented with @ref ztacx_counter_increment loses none.
+ *
+ * @return -EEXIST if another counter (of the same name, or whose name
+ * has the same hash) is already attached
+ */
+int ztacx_counter_attach_mode(struct ztacx_variable *v, enum ztacx_counter_mode mode)
+{
+	struct ztacx_counter *c;
+	int err = 0;
+
+	if (!v || ((v->kind != ZTACX_VALUE_INT32) && (v->kind != ZTACX_VALUE_INT64))) {
+		return -EINVAL;
+	}
+	while (sys_mutex_lock(&ztacx_counter_mutex, K_MSEC(500)) != 0) {
+		LOG_WRN("ztacx counter mutex is held too long");
+	}
+	if (!ztacx_counter_ready) {
+		err = ztacx_counter_recover();
+		if (err != 0) {
+			sys_mutex_unlock(&ztacx_counter_mutex);
+			return err;
+		}
+		ztacx_counter_ready = true;
+		ztacx_leaf_work_init_named(NULL, &ztacx_counter_work, ztacx_counter_checkpoint_work, "counter");
+		ztacx_counter_work.work_class = ZTACX_WORK_BACKGROUND;
+		ztacx_leaf_work_set_period(&ztacx_counter_work, CONFIG_ZTACX_COUNTER_CHECKPOINT_MS,
+					   ZTACX_PERIODIC_SLACK(CONFIG_ZTACX_COUNTER_CHECKPOINT_MS));
+	}
+
+	c = ztacx_counter_slot(v->hash);
+	if (!c) {
+		sys_mutex_unlock(&ztacx_counter_mutex);
+		LOG_ERR("Counter table is full, cannot persist " ZTACX_VARIABLE_NAME_FMT,
+			ZTACX_VARIABLE_NAME_ARG(v));
+		return -ENOMEM;
+	}
+	if (c->variable && (c->variable != v)) {
+		// the journal would mix up their values
+		sys_mutex_unlock(&ztacx_counter_mutex);
+		LOG_ERR("Counter " ZTACX_VARIABLE_NAME_FMT " has the same id as " ZTACX_VARIABLE_NAME_FMT
+			", cannot persist it", ZTACX_VARIABLE_NAME_ARG(v), ZTACX_VARIABLE_NAME_ARG(c->variable));
+		return -EEXIST;
+	}
+	c->variable = v;
+	c->exact = (mode == ZTACX_COUNTER_EXACT);
+	if (c->recovered) {
+		if (v->kind == ZTACX_VALUE_INT32) {
+			int32_t value = (int32_t)c->checkpointed;
+			err = ztacx_variable_value_set(v, &value);
+		}
+		else {
+			err = ztacx_variable_value_set_int64(v, c->checkpointed);
+		}
+	}
+	else {
+		c->checkpointed = ztacx_counter_value(v);
+	}
+	sys_mutex_unlock(&ztacx_counter_mutex);
+
+	LOG_INF("Counter " ZTACX_VARIABLE_NAME_FMT " is persistent%s, value %lld",
+		ZTACX_VARIABLE_NAME_ARG(v), c->exact ? " (exact)" : "", (long long)c->checkpointed);
+	return err;
+}
+
+int ztacx_counter_attach(struct ztacx_variable *v)
+{
+	return ztacx_counter_attach_mode(v, ZTACX_COUNTER_CHECKPOINT);
+}
+
+#if CONFIG_ZTEST
+/**
+ * @brief Forget the journal state and the counters, as a reset would
+ *
+ * For tests.  The counter variables keep their values in RAM; the
+ * next attach recovers from flash.
+ */
+void ztacx_counter_reset(void)
+{
+	while (sys_mutex_lock(&ztacx_counter_mutex, K_MSEC(500)) != 0) {
+		LOG_WRN("ztacx counter mutex is held too long");
+	}
+	if (ztacx_counter_ready) {
+		ztacx_leaf_work_cancel(&ztacx_counter_work);
+		flash_area_close(ztacx_counter_fa);
+	}
+	memset(ztacx_counters, 0, sizeof(ztacx_counters));
+	memset(&ztacx_counter_stats, 0, sizeof(ztacx_counter_stats));
+	ztacx_counter_count = 0;
+	ztacx_counter_fa = NULL;
+	ztacx_counter_sectors = 0;
+	ztacx_counter_sector = 0;
+	ztacx_counter_seq = 0;
+	ztacx_counter_pos = 0;
+	ztacx_counter_ready = false;
+	ztacx_counter_backoff = 0;
+	ztacx_counter_backoff_left = 0;
+	sys_mutex_unlock(&ztacx_counter_mutex);
+}
+#endif
+
+#if CONFIG_SHELL
+int cmd_ztacx_counter(const struct shell *shell, size_t argc, char **argv)
+{
+	if ((argc > 1) && (strcmp(argv[1], "checkpoint") == 0)) {
+		return ztacx_counter_checkpoint();
+	}
+	if (!ztacx_counter_ready) {
+		shell_print(shell, "No counters are persistent");
+		return 0;
+	}
+	shell_print(shell, "Journal sector %u/%u seq %u, %u/%u bytes used",
+		    ztacx_counter_sector, ztacx_counter_sectors, ztacx_counter_seq,
+		    ztacx_counter_pos, CONFIG_ZTACX_COUNTER_SECTOR_SIZE);
+	shell_print(shell, "checkpoints %u, records %u, erases %u, torn %u, failed rotations %u "
+		    "(next in %u), last %uus, max %uus",
+		    ztacx_counter_stats.checkpoints, ztacx_counter_stats.records,
+		    ztacx_counter_stats.erases, ztacx_counter_stats.torn,
+		    ztacx_counter_stats.rotate_failures, ztacx_counter_backoff_left,
+		    ztacx_counter_stats.last_checkpoint_us, ztacx_counter_stats.max_checkpoint_us);
+	for (int i=0; i<ztacx_counter_count; i++) {
+		struct ztacx_counter *c = &ztacx_counters[i];
+
+		if (c->variable) {
+			shell_print(shell, "  " ZTACX_VARIABLE_NAME_FMT " = %lld (%s %lld)",
+				    ZTACX_VARIABLE_NAME_ARG(c->variable),
+				    (long long)ztacx_counter_value(c->variable),
+				    c->exact ? "exact, journal" : "checkpoint", (long long)c->checkpointed);
+		}
+		else {
+			shell_print(shell, "  id %08x = %lld (not attached)", c->id, (long long)c->checkpointed);
+		}
+	}
+	return 0;
+}
+#endif
@@ -27,7 +27,7 @@ enum dac_value_index {
 	VALUE_LEVEL,
 };
 
-static struct ztacx_variable dac_values[]={
+static ZTACX_VARIABLES_DEFINE(dac_values) = {
 	{"dac_ok", ZTACX_VALUE_BOOL, {.val_bool=false}},
 #if !CONFIG_ZTACX_LEAF_SETTINGS
 	{"dac_bits", ZTACX_VALUE_INT32,{.val_int32=CONFIG_ZTACX_DAC_BITS}},
@@ -56,9 +56,8 @@ int ztacx_dac_init(struct ztacx_leaf *leaf)
 {
 	LOG_INF("dac_init");
 #if CONFIG_ZTACX_LEAF_SETTINGS
-	ztacx_settings_register(dac_settings, ARRAY_SIZE(dac_settings));
+	ztacx_settings_register_leaf(leaf, dac_settings, ARRAY_SIZE(dac_settings));
 #endif
-	ztacx_variables_register(dac_values, ARRAY_SIZE(dac_values));
 
 	if (!dac_dev) {
 		dac_dev = device_get_binding(CONFIG_ZTACX_DAC_DEVICE);
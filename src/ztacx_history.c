@@ -0,0 +1,592 @@
+#include "ztacx.h"
+
+#include <zephyr/sys/byteorder.h>
+
+/*
+ * Variable history
+ *
+ * Each history is a ring of fixed-size blocks.  A block records the
+ * time and value of its first sample, then the difference from each
+ * sample to the next as a zigzag LEB128 varint, so a slowly changing
+ * value costs one byte per sample.  Samples are taken at a fixed
+ * interval by the periodic scheduler, so their timestamps are implied;
+ * if a sample is late or early by more than half an interval (eg the
+ * queue was blocked) a new block is started at the true time.
+ *
+ * Each block keeps the count, min, max and sum of its samples, so a
+ * window query decodes at most the one block that straddles the start
+ * of the window.
+ */
+
+struct ztacx_history_block
+{
+	int64_t sum;
+	uint32_t start_ms;
+	int32_t first;
+	int32_t min;
+	int32_t max;
+	uint16_t count;
+	uint8_t used;
+	uint8_t data[CONFIG_ZTACX_HISTORY_BLOCK_BYTES];
+};
+
+struct ztacx_history
+{
+	struct ztacx_leaf_work work;
+	struct ztacx_variable *variable;
+	uint32_t interval_ms;
+	int32_t last;
+	uint16_t block_count;
+	uint16_t head;
+	uint16_t used;
+	sys_snode_t node;
+	char name[CONFIG_ZTACX_VALUE_NAME_MAX];
+	struct ztacx_history_block block[];
+};
+
+struct ztacx_history_acc
+{
+	int count;
+	int32_t min;
+	int32_t max;
+	int64_t sum;
+	uint32_t first_ms;
+	uint32_t last_ms;
+};
+
+static sys_slist_t ztacx_histories;
+static struct k_spinlock ztacx_history_lock;
+
+static int ztacx_history_put_delta(uint8_t *p, int max, int64_t delta)
+{
+	uint64_t z = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+	int n = 0;
+
+	do {
+		if (n >= max) {
+			return -ENOSPC;
+		}
+		p[n] = z & 0x7F;
+		z >>= 7;
+		if (z) {
+			p[n] |= 0x80;
+		}
+		n++;
+	} while (z);
+	return n;
+}
+
+static int ztacx_history_get_delta(const uint8_t *p, int len, int64_t *delta_r)
+{
+	uint64_t z = 0;
+	int n = 0;
+
+	for (int shift = 0; n < len; shift += 7) {
+		z |= (uint64_t)(p[n] & 0x7F) << shift;
+		if (!(p[n++] & 0x80)) {
+			*delta_r = (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+			return n;
+		}
+	}
+	return -EINVAL;
+}
+
+/**
+ * Read a numeric variable as a history sample
+ */
+static int ztacx_history_value(struct ztacx_variable *v, int32_t *value_r)
+{
+	switch (v->kind) {
+	case ZTACX_VALUE_BOOL:
+		*value_r = ztacx_variable_value_get_bool(v);
+		break;
+	case ZTACX_VALUE_BYTE:
+		*value_r = ztacx_variable_value_get_byte(v);
+		break;
+	case ZTACX_VALUE_UINT16:
+		*value_r = ztacx_variable_value_get_uint16(v);
+		break;
+	case ZTACX_VALUE_INT16:
+		*value_r = ztacx_variable_value_get_int16(v);
+		break;
+	case ZTACX_VALUE_INT32:
+		*value_r = ztacx_variable_value_get_int32(v);
+		break;
+	case ZTACX_VALUE_INT64:
+		*value_r = CLAMP(ztacx_variable_value_get_int64(v), INT32_MIN, INT32_MAX);
+		break;
+	default:
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static void ztacx_history_block_start(struct ztacx_history_block *b, uint32_t now, int32_t value)
+{
+	b->start_ms = now;
+	b->first = value;
+	b->min = value;
+	b->max = value;
+	b->sum = value;
+	b->count = 1;
+	b->used = 0;
+}
+
+/**
+ * Add a sample to the newest block, or start a new one, with the history lock held
+ */
+static void ztacx_history_append(struct ztacx_history *h, uint32_t now, int32_t value)
+{
+	struct ztacx_history_block *b = &h->block[h->head];
+
+	if (h->used == 0) {
+		h->used = 1;
+		ztacx_history_block_start(b, now, value);
+		h->last = value;
+		return;
+	}
+
+	uint32_t expected = b->start_ms + b->count * h->interval_ms;
+	int32_t error = (int32_t)(now - expected);
+
+	if ((abs(error) <= (int32_t)(h->interval_ms / 2)) && (b->count < UINT16_MAX)) {
+		int n = ztacx_history_put_delta(b->data + b->used, sizeof(b->data) - b->used,
+						(int64_t)value - h->last);
+		if (n > 0) {
+			b->used += n;
+			b->count++;
+			b->min = MIN(b->min, value);
+			b->max = MAX(b->max, value);
+			b->sum += value;
+			h->last = value;
+			return;
+		}
+	}
+
+	// the block is full (or the sample is off the block's timeline),
+	// start the next one, overwriting the oldest
+	h->head = (h->head + 1) % h->block_count;
+	h->used = MIN(h->used + 1, h->block_count);
+	ztacx_history_block_start(&h->block[h->head], now, value);
+	h->last = value;
+}
+
+static void ztacx_history_sample(struct k_work *work)
+{
+	struct ztacx_history *h = CONTAINER_OF(ztacx_leaf_work_get(work), struct ztacx_history, work);
+	int32_t value;
+
+	if (ztacx_history_value(h->variable, &value) != 0) {
+		return;
+	}
+
+	k_spinlock_key_t key = k_spin_lock(&ztacx_history_lock);
+	ztacx_history_append(h, k_uptime_get_32(), value);
+	k_spin_unlock(&ztacx_history_lock, key);
+}
+
+static inline bool ztacx_history_in_window(uint32_t t, uint32_t cutoff, bool all)
+{
+	return all || ((int32_t)(t - cutoff) >= 0);
+}
+
+/**
+ * Decode the samples of a block that fall in a window, oldest first
+ */
+static void ztacx_history_block_decode(const struct ztacx_history_block *b, uint32_t interval_ms,
+				       uint32_t cutoff, bool all, ztacx_history_cb_t cb, void *arg)
+{
+	int32_t value = b->first;
+	uint32_t t = b->start_ms;
+	int pos = 0;
+
+	for (int i=0; i<b->count; i++) {
+		if (i > 0) {
+			int64_t delta;
+			int n = ztacx_history_get_delta(b->data + pos, b->used - pos, &delta);
+
+			if (n < 0) {
+				return;
+			}
+			pos += n;
+			value += (int32_t)delta;
+			t += interval_ms;
+		}
+		if (ztacx_history_in_window(t, cutoff, all)) {
+			cb(t, value, arg);
+		}
+	}
+}
+
+static void ztacx_history_acc_sample(uint32_t timestamp_ms, int32_t value, void *arg)
+{
+	struct ztacx_history_acc *acc = arg;
+
+	if (acc->count == 0) {
+		acc->min = value;
+		acc->max = value;
+		acc->last_ms = timestamp_ms;
+	}
+	acc->count++;
+	acc->min = MIN(acc->min, value);
+	acc->max = MAX(acc->max, value);
+	acc->sum += value;
+	if ((int32_t)(timestamp_ms - acc->last_ms) > 0) {
+		acc->last_ms = timestamp_ms;
+	}
+	if ((acc->count == 1) || ((int32_t)(timestamp_ms - acc->first_ms) < 0)) {
+		acc->first_ms = timestamp_ms;
+	}
+}
+
+static inline struct ztacx_history_block *ztacx_history_block_nth_newest(struct ztacx_history *h, int n)
+{
+	return &h->block[(h->head + h->block_count - n) % h->block_count];
+}
+
+/**
+ * @brief Summarise the samples of the last window_ms (0 for all history)
+ *
+ * Whole blocks are summarised from their headers; only the block that
+ * straddles the start of the window is decoded.
+ */
+int ztacx_history_window(struct ztacx_history *h, uint32_t window_ms, struct ztacx_history_summary *summary_r)
+{
+	struct ztacx_history_acc acc = {0};
+	uint32_t cutoff = k_uptime_get_32() - window_ms;
+	bool all = (window_ms == 0);
+
+	if (!h || !summary_r) {
+		return -EINVAL;
+	}
+
+	k_spinlock_key_t key = k_spin_lock(&ztacx_history_lock);
+	for (int n=0; n<h->used; n++) {
+		struct ztacx_history_block *b = ztacx_history_block_nth_newest(h, n);
+		uint32_t end_ms = b->start_ms + (b->count - 1) * h->interval_ms;
+
+		if (!ztacx_history_in_window(end_ms, cutoff, all)) {
+			break;
+		}
+		if (!ztacx_history_in_window(b->start_ms, cutoff, all)) {
+			ztacx_history_block_decode(b, h->interval_ms, cutoff, all,
+						   ztacx_history_acc_sample, &acc);
+			break;
+		}
+		if (acc.count == 0) {
+			acc.min = b->min;
+			acc.max = b->max;
+			acc.last_ms = end_ms;
+		}
+		acc.count += b->count;
+		acc.min = MIN(acc.min, b->min);
+		acc.max = MAX(acc.max, b->max);
+		acc.sum += b->sum;
+		acc.first_ms = b->start_ms;
+	}
+	k_spin_unlock(&ztacx_history_lock, key);
+
+	summary_r->count = acc.count;
+	summary_r->min = acc.min;
+	summary_r->max = acc.max;
+	summary_r->mean = acc.count ? (int32_t)(acc.sum / acc.count) : 0;
+	summary_r->first_ms = acc.first_ms;
+	summary_r->last_ms = acc.last_ms;
+	return 0;
+}
+
+/**
+ * @brief Call cb for each sample of the last window_ms (0 for all history), oldest first
+ *
+ * Each block is copied out under the lock and decoded without it, so
+ * cb may block (eg print to the shell).
+ */
+int ztacx_history_foreach(struct ztacx_history *h, uint32_t window_ms, ztacx_history_cb_t cb, void *arg)
+{
+	struct ztacx_history_block b;
+	uint32_t cutoff = k_uptime_get_32() - window_ms;
+	bool all = (window_ms == 0);
+	bool started = false;
+	uint32_t prev_start = 0;
+	int used;
+
+	if (!h || !cb) {
+		return -EINVAL;
+	}
+
+	k_spinlock_key_t key = k_spin_lock(&ztacx_history_lock);
+	used = h->used;
+	k_spin_unlock(&ztacx_history_lock, key);
+
+	for (int n=used-1; n>=0; n--) {
+		key = k_spin_lock(&ztacx_history_lock);
+		b = *ztacx_history_block_nth_newest(h, n);
+		k_spin_unlock(&ztacx_history_lock, key);
+
+		// skip a block the sampler recycled while we were printing
+		if (started && ((int32_t)(b.start_ms - prev_start) < 0)) {
+			continue;
+		}
+		started = true;
+		prev_start = b.start_ms;
+		ztacx_history_block_decode(&b, h->interval_ms, cutoff, all, cb, arg);
+	}
+	return 0;
+}
+
+/* Write a block as in the frame at ZTACX_HISTORY_MAGIC, 11 bytes and its deltas */
+static size_t ztacx_history_block_put(const struct ztacx_history_block *b, uint8_t *p)
+{
+	sys_put_le32(b->start_ms, p);
+	sys_put_le32((uint32_t)b->first, p+4);
+	sys_put_le16(b->count, p+8);
+	p[10] = b->used;
+	memcpy(p+11, b->data, b->used);
+	return 11 + b->used;
+}
+
+/**
+ * @brief Encode a history, compressed as stored, in the frame described at @ref ZTACX_HISTORY_MAGIC
+ *
+ * @return the frame length, or -ENOSPC if the buffer is too small
+ */
+int ztacx_history_encode(struct ztacx_history *h, uint8_t *buf, size_t buf_max)
+{
+	size_t pos = 12;
+	int rc = 0;
+
+	if (!h || (buf_max < pos)) {
+		return -ENOSPC;
+	}
+
+	k_spinlock_key_t key = k_spin_lock(&ztacx_history_lock);
+	buf[0] = ZTACX_HISTORY_MAGIC;
+	buf[1] = ZTACX_HISTORY_VERSION;
+	sys_put_le32(h->variable->hash, buf+2);
+	sys_put_le32(h->interval_ms, buf+6);
+	sys_put_le16(h->used, buf+10);
+	for (int n=h->used-1; n>=0; n--) {
+		const struct ztacx_history_block *b = ztacx_history_block_nth_newest(h, n);
+
+		if (pos + 11 + b->used > buf_max) {
+			rc = -ENOSPC;
+			break;
+		}
+		pos += ztacx_history_block_put(b, buf+pos);
+	}
+	k_spin_unlock(&ztacx_history_lock, key);
+
+	return (rc < 0) ? rc : pos;
+}
+
+/**
+ * @brief Encode the history of a variable as snapshot records
+ *
+ * One record of kind ZTACX_SNAPSHOT_KIND_HISTORY per block, oldest
+ * first (see @ref ZTACX_SNAPSHOT_MAGIC).
+ *
+ * @param count_r incremented by the number of records
+ * @return the length of the records, 0 if the variable has no history,
+ * or -ENOSPC if the buffer is too small
+ */
+int ztacx_history_encode_records(const struct ztacx_variable *v, uint8_t *buf, size_t buf_max, int *count_r)
+{
+	struct ztacx_history *h;
+	struct ztacx_history *found = NULL;
+	size_t pos = 0;
+	int rc = 0;
+
+	k_spinlock_key_t key = k_spin_lock(&ztacx_history_lock);
+	SYS_SLIST_FOR_EACH_CONTAINER(&ztacx_histories, h, node) {
+		if (h->variable == v) {
+			found = h;
+			break;
+		}
+	}
+	for (int n=found ? found->used-1 : -1; n>=0; n--) {
+		const struct ztacx_history_block *b = ztacx_history_block_nth_newest(found, n);
+		size_t len = 4 + 11 + b->used;
+
+		if (pos + ZTACX_SNAPSHOT_RECORD_HEADER_SIZE + len > buf_max) {
+			rc = -ENOSPC;
+			break;
+		}
+		sys_put_le32(v->hash, buf+pos);
+		buf[pos+4] = ZTACX_SNAPSHOT_KIND_HISTORY;
+		buf[pos+5] = len;
+		sys_put_le32(found->interval_ms, buf+pos+ZTACX_SNAPSHOT_RECORD_HEADER_SIZE);
+		ztacx_history_block_put(b, buf+pos+ZTACX_SNAPSHOT_RECORD_HEADER_SIZE+4);
+		pos += ZTACX_SNAPSHOT_RECORD_HEADER_SIZE + len;
+		(*count_r)++;
+	}
+	k_spin_unlock(&ztacx_history_lock, key);
+
+	return (rc < 0) ? rc : pos;
+}
+
+struct ztacx_history *ztacx_history_find(const char *name)
+{
+	struct ztacx_history *h;
+	struct ztacx_history *result = NULL;
+
+	k_spinlock_key_t key = k_spin_lock(&ztacx_history_lock);
+	SYS_SLIST_FOR_EACH_CONTAINER(&ztacx_histories, h, node) {
+		if (ztacx_variable_name_eq(h->variable, name)) {
+			result = h;
+			break;
+		}
+	}
+	k_spin_unlock(&ztacx_history_lock, key);
+	return result;
+}
+
+/**
+ * @brief Start keeping the history of a numeric variable
+ *
+ * The variable is sampled every interval_ms.  Enough blocks are
+ * allocated to hold at least depth samples while successive samples
+ * differ by less than 8192 (more if they change more slowly).
+ *
+ * @return the history, or NULL if the variable is not numeric or
+ * there is no memory.  Attaching an already attached variable returns
+ * the existing history.
+ */
+struct ztacx_history *ztacx_history_attach(struct ztacx_variable *v, uint32_t interval_ms, uint32_t depth)
+{
+	struct ztacx_history *h;
+	int32_t value;
+
+	if (!v || (interval_ms == 0) || (depth == 0)) {
+		return NULL;
+	}
+	if (ztacx_history_value(v, &value) != 0) {
+		LOG_ERR("Variable " ZTACX_VARIABLE_NAME_FMT " is not numeric, cannot keep history",
+			ZTACX_VARIABLE_NAME_ARG(v));
+		return NULL;
+	}
+
+	k_spinlock_key_t key = k_spin_lock(&ztacx_history_lock);
+	SYS_SLIST_FOR_EACH_CONTAINER(&ztacx_histories, h, node) {
+		if (h->variable == v) {
+			k_spin_unlock(&ztacx_history_lock, key);
+			return h;
+		}
+	}
+	k_spin_unlock(&ztacx_history_lock, key);
+
+	uint32_t blocks = DIV_ROUND_UP(depth, CONFIG_ZTACX_HISTORY_BLOCK_BYTES/2 + 1) + 1;
+	if (blocks > UINT16_MAX) {
+		return NULL;
+	}
+	size_t size = sizeof(struct ztacx_history) + blocks * sizeof(struct ztacx_history_block);
+
+	h = calloc(1, size);
+	if (!h) {
+		LOG_ERR("No memory for history of " ZTACX_VARIABLE_NAME_FMT " (%d bytes)",
+			ZTACX_VARIABLE_NAME_ARG(v), (int)size);
+		return NULL;
+	}
+	h->variable = v;
+	h->interval_ms = interval_ms;
+	h->block_count = blocks;
+	ztacx_variable_name(v, h->name, sizeof(h->name));
+
+	ztacx_leaf_work_init_named(NULL, &h->work, ztacx_history_sample, h->name);
+	h->work.work_class = ZTACX_WORK_BACKGROUND;
+
+	key = k_spin_lock(&ztacx_history_lock);
+	sys_slist_append(&ztacx_histories, &h->node);
+	k_spin_unlock(&ztacx_history_lock, key);
+
+	LOG_INF("History of %s every %u ms in %u blocks (%d bytes)",
+		h->name, interval_ms, blocks, (int)size);
+	ztacx_leaf_work_set_period(&h->work, interval_ms, ZTACX_PERIODIC_SLACK(interval_ms));
+	return h;
+}
+
+#if CONFIG_SHELL
+static void ztacx_history_print_sample(uint32_t timestamp_ms, int32_t value, void *arg)
+{
+	const struct shell *shell = arg;
+
+	shell_print(shell, "%u,%d", timestamp_ms, value);
+}
+
+static void ztacx_history_print_summary(const struct shell *shell, struct ztacx_history *h, uint32_t window_ms)
+{
+	struct ztacx_history_summary s;
+	struct ztacx_history_summary stored;
+	size_t bytes = sizeof(struct ztacx_history) + h->block_count * sizeof(struct ztacx_history_block);
+
+	ztacx_history_window(h, window_ms, &s);
+	ztacx_history_window(h, 0, &stored);
+	// memory per stored sample, to compare with a plain array of samples
+	int centibytes = stored.count ? (int)((bytes * 100) / stored.count) : 0;
+
+	shell_print(shell, "%-28s %8u %7d %7d %7d %7d %6d %3d.%02d", h->name, h->interval_ms,
+		    s.count, s.min, s.max, s.mean, (int)bytes, centibytes / 100, centibytes % 100);
+}
+
+/**
+ * Implementation of the "ztacx history" CLI component
+ */
+int cmd_ztacx_history(const struct shell *shell, size_t argc, char **argv)
+{
+	struct ztacx_history *h;
+
+	if (argc < 2) {
+		shell_print(shell, "%-28s %8s %7s %7s %7s %7s %6s %6s", "variable", "interval",
+			    "samples", "min", "max", "mean", "bytes", "B/smpl");
+		SYS_SLIST_FOR_EACH_CONTAINER(&ztacx_histories, h, node) {
+			ztacx_history_print_summary(shell, h, 0);
+		}
+		shell_print(shell, "(a plain array needs 4 B/smpl, or 8 with timestamps)");
+		return 0;
+	}
+
+	if ((argc > 4) && (strcmp(argv[2], "attach") == 0)) {
+		struct ztacx_variable *v = ztacx_variable_find(argv[1]);
+
+		if (!v) {
+			shell_print(shell, "No variable named '%s'", argv[1]);
+			return -ENOENT;
+		}
+		h = ztacx_history_attach(v, atoi(argv[3]), atoi(argv[4]));
+		if (!h) {
+			shell_print(shell, "Cannot keep history of '%s'", argv[1]);
+			return -EINVAL;
+		}
+		return 0;
+	}
+
+	h = ztacx_history_find(argv[1]);
+	if (!h) {
+		shell_print(shell, "No history of '%s'", argv[1]);
+		return -ENOENT;
+	}
+
+	if ((argc > 2) && (strcmp(argv[2], "dump") == 0)) {
+		uint32_t window_ms = (argc > 3) ? atoi(argv[3]) * 1000 : 0;
+
+		ztacx_history_foreach(h, window_ms, ztacx_history_print_sample, (void *)shell);
+	}
+	else if ((argc > 2) && (strcmp(argv[2], "encode") == 0)) {
+		static uint8_t frame[CONFIG_ZTACX_SNAPSHOT_SHELL_BUFFER];
+		int len = ztacx_history_encode(h, frame, sizeof(frame));
+
+		if (len < 0) {
+			shell_print(shell, "History encode failed (%d)", len);
+			return len;
+		}
+		shell_hexdump(shell, frame, len);
+	}
+	else {
+		uint32_t window_ms = (argc > 2) ? atoi(argv[2]) * 1000 : 60000;
+
+		shell_print(shell, "%-28s %8s %7s %7s %7s %7s %6s %6s", "variable", "interval",
+			    "samples", "min", "max", "mean", "bytes", "B/smpl");
+		ztacx_history_print_summary(shell, h, window_ms);
+	}
+	return 0;
+}
+#endif
@@ -14,13 +14,13 @@
 #define INVALID_LEVEL INT32_MAX
 
 enum ims_setting_index {
-	SETTING_READ_INTERVAL_USEC = 0,
-	SETTING_CHANGE_THRESHOLD,
+	ZTACX_TYPED_INDEX(SETTING_READ_INTERVAL_USEC, int32),
+	ZTACX_TYPED_INDEX(SETTING_CHANGE_THRESHOLD, int32),
 };
 
 static struct ztacx_variable ims_settings[] = {
-	{"ims_read_interval_usec", ZTACX_VALUE_INT32,{.val_int32=CONFIG_ZTACX_IMS_READ_INTERVAL_USEC}},
-	{"ims_change_threshold", ZTACX_VALUE_INT32,{.val_int32=CONFIG_ZTACX_IMS_CHANGE_THRESHOLD}},
+	ZTACX_TYPED_ENTRY(SETTING_READ_INTERVAL_USEC, int32, "ims_read_interval_usec", CONFIG_ZTACX_IMS_READ_INTERVAL_USEC),
+	ZTACX_TYPED_ENTRY(SETTING_CHANGE_THRESHOLD, int32, "ims_change_threshold", CONFIG_ZTACX_IMS_CHANGE_THRESHOLD),
 };
 
 enum ims_value_index {
@@ -37,7 +37,7 @@ enum ims_value_index {
 	VALUE_SAMPLES,
 };
 
-static struct ztacx_variable ims_values[]={
+static ZTACX_VARIABLES_DEFINE(ims_values) = {
 	{"ims_ok", ZTACX_VALUE_BOOL, {.val_bool=false}},
 	{"ims_notify", ZTACX_VALUE_BOOL, {.val_bool=false}},
 	{"ims_level_x", ZTACX_VALUE_INT32, {.val_int32=INVALID_LEVEL}},
@@ -51,8 +51,20 @@ static struct ztacx_variable ims_values[]={
 	{"ims_samples", ZTACX_VALUE_INT64, {.val_int64=0}},
 };
 
+ZTACX_USE_VAR_AS(ims_read_interval_usec, int32);
+ZTACX_USE_VAR_AS(ims_change_threshold, int32);
+
 static const struct device *ims_dev = DEVICE_DT_GET(DT_ALIAS(accel0));
-static struct k_work_delayable ims_work;
+static struct ztacx_leaf_work ims_work;
+
+enum ims_axis {
+	AXIS_X = 0,
+	AXIS_Y,
+	AXIS_Z,
+	AXIS_M,
+	AXIS_MAX
+};
+static struct ztacx_publish ims_publish[AXIS_MAX];
 
 void ims_read(struct k_work *work);
 int cmd_ztacx_ims(const struct shell *shell, size_t argc, char **argv);
@@ -70,10 +82,11 @@ int ztacx_ims_init(struct ztacx_leaf *leaf)
 		return -ENODEV;
 	}
 
-	ztacx_settings_register(ims_settings, ARRAY_SIZE(ims_settings));
-	ztacx_variables_register(ims_values, ARRAY_SIZE(ims_values));
+	ztacx_settings_register_leaf(leaf, ims_settings, ARRAY_SIZE(ims_settings));
+	ims_read_interval_usec = ZTACX_TYPED_VAR(ims_settings, SETTING_READ_INTERVAL_USEC, int32);
+	ims_change_threshold = ZTACX_TYPED_VAR(ims_settings, SETTING_CHANGE_THRESHOLD, int32);
 
-	int32_t threshold = ztacx_variable_value_get_int32(&ims_settings[SETTING_CHANGE_THRESHOLD]);
+	int32_t threshold = ztacx_int32_get(ims_change_threshold);
 	LOG_INF("  IMS present on I2C as %s, change threshold %d", ims_dev->name, threshold);
 
 #if CONFIG_SHELL
@@ -83,6 +96,13 @@ int ztacx_ims_init(struct ztacx_leaf *leaf)
 				.handler=&cmd_ztacx_ims
 				}));
 #endif
+	// the sample count carries on across reset (and system off, which
+	// checkpoints the journal on the way down)
+	ztacx_counter_attach(&ims_values[VALUE_SAMPLES]);
+	// as do the peaks, through system off
+	for (int i=VALUE_PEAK_X; i<=VALUE_PEAK_M; i++) {
+		ztacx_variable_retain(&ims_values[i]);
+	}
 	ztacx_variable_value_set_bool(&ims_values[VALUE_OK],true);
 	LOG_INF("done");
 	return 0;
@@ -91,28 +111,21 @@ int ztacx_ims_init(struct ztacx_leaf *leaf)
 
 int ztacx_ims_start(struct ztacx_leaf *leaf)
 {
-	k_work_init_delayable(&ims_work, ims_read);
-	k_work_schedule(&ims_work, K_NO_WAIT);
+	ztacx_leaf_work_init(leaf, &ims_work, ims_read);
+	ztacx_leaf_work_schedule(&ims_work, K_NO_WAIT);
 
 	return 0;
 }
 
-static bool update_variable_peak(struct ztacx_variable *v, struct ztacx_variable *peak_v, int32_t level, int change_threshold)
+// called inside a batch, so must not log or block
+static bool update_variable_peak(struct ztacx_batch *batch, struct ztacx_variable *v, struct ztacx_variable *peak_v, struct ztacx_publish *p, int32_t level, int change_threshold)
 {
-	int32_t prev = ztacx_variable_value_get_int32(v);
-	int32_t change = abs(level - prev);
-	bool first_reading = (prev == INVALID_LEVEL);
-	bool significant_change = !first_reading && (change >= change_threshold);
-	if (first_reading || significant_change) {
-		ztacx_variable_value_set(v, &level);
-		//LOG_INF("IMS %s level %d (change %d > threshold %d)",
-		//v->name, (int)level, change, change_threshold);
-
-		int32_t peak_level = ztacx_variable_value_get_int32(peak_v);
+	p->deadband = change_threshold;
+	if (ztacx_batch_publish(batch, v, p, level) > 0) {
+		int32_t peak_level = peak_v->value.val_int32;
 		if (peak_level == INVALID_LEVEL || (abs(level)>peak_level)) {
-			//LOG_INF("IMS %s new peak %d", v->name, (int)level);
 			peak_level = abs(level);
-			ztacx_variable_value_set_int32(peak_v, peak_level);
+			ztacx_batch_set_int32(batch, peak_v, peak_level);
 		}
 		return true;
 	}
@@ -171,14 +184,19 @@ void ims_read(struct k_work *work)
 				    (z_cmpsps*z_cmpsps));
 		//LOG_INF("Acceleration vector magnitude is %dcm/s/s", m_cmpsps);
 
-		int change_threshold = ztacx_variable_value_get_int32(&ims_settings[SETTING_CHANGE_THRESHOLD]);
+		int change_threshold = ztacx_int32_get(ims_change_threshold);
 		bool change = false;
-
-		change |= update_variable_peak(&ims_values[VALUE_LEVEL_M], &ims_values[VALUE_PEAK_M], m_cmpsps, change_threshold);
-		change |= update_variable_peak(&ims_values[VALUE_LEVEL_X], &ims_values[VALUE_PEAK_X], x_cmpsps, change_threshold);
-		change |= update_variable_peak(&ims_values[VALUE_LEVEL_Y], &ims_values[VALUE_PEAK_Y], y_cmpsps, change_threshold);
-		change |= update_variable_peak(&ims_values[VALUE_LEVEL_Z], &ims_values[VALUE_PEAK_Z], z_cmpsps, change_threshold);
-		ztacx_variable_value_inc_int64(&ims_values[VALUE_SAMPLES]);
+		struct ztacx_batch batch;
+
+		// update the whole vector as one, so readers never see a
+		// half-updated sample, and subscribers are notified once
+		ztacx_batch_begin(&batch);
+		change |= update_variable_peak(&batch, &ims_values[VALUE_LEVEL_M], &ims_values[VALUE_PEAK_M], &ims_publish[AXIS_M], m_cmpsps, change_threshold);
+		change |= update_variable_peak(&batch, &ims_values[VALUE_LEVEL_X], &ims_values[VALUE_PEAK_X], &ims_publish[AXIS_X], x_cmpsps, change_threshold);
+		change |= update_variable_peak(&batch, &ims_values[VALUE_LEVEL_Y], &ims_values[VALUE_PEAK_Y], &ims_publish[AXIS_Y], y_cmpsps, change_threshold);
+		change |= update_variable_peak(&batch, &ims_values[VALUE_LEVEL_Z], &ims_values[VALUE_PEAK_Z], &ims_publish[AXIS_Z], z_cmpsps, change_threshold);
+		ztacx_batch_inc_int64(&batch, &ims_values[VALUE_SAMPLES]);
+		ztacx_batch_commit(&batch);
 
 #if 0 // CONFIG_BT_GATT_CLIENT
 		if (change && ztacx_variable_value_get_bool(&ims_values[VALUE_NOTIFY])) {
@@ -188,8 +206,8 @@ void ims_read(struct k_work *work)
 	}
 	
 	if (work){
-		k_work_reschedule(&ims_work,
-				  K_USEC(ztacx_variable_value_get_int32(&ims_settings[SETTING_READ_INTERVAL_USEC])));
+		ztacx_leaf_work_reschedule(&ims_work,
+				  K_USEC(ztacx_int32_get(ims_read_interval_usec)));
 	}
 
 	return;
@@ -19,7 +19,7 @@ enum kp_value_index {
 };
 
 static struct ztacx_variable kp_default_settings[] = {
-	{"bus", ZTACX_VALUE_STRING,{.val_string=CONFIG_ZTACX_KP_BUS}},
+	{"bus", ZTACX_VALUE_STRING, ZTACX_STRING_INLINE(16, CONFIG_ZTACX_KP_BUS)},
 	{"addr" , ZTACX_VALUE_UINT16,{.val_uint16 = CONFIG_ZTACX_KP_ADDR}},
 	{"interval" , ZTACX_VALUE_INT32,{.val_int32 = CONFIG_ZTACX_KP_INTERVAL}}
 };
@@ -47,6 +47,12 @@ struct ztacx_kp_context ztacx_kp_kp0_context = {
 	.values_count = ARRAY_SIZE(ztacx_kp_kp0_values)
 };
 
+static void kp_schedule(struct ztacx_kp_context *context)
+{
+	uint32_t period_ms = MAX(CTX_SETTING(INTERVAL).value.val_int32, 0);
+	ztacx_leaf_work_set_period(&context->scan, period_ms, ZTACX_PERIODIC_SLACK(period_ms));
+}
+
 static int _kp_write(struct ztacx_kp_context *context, uint8_t val)
 {
 	char buf[1] = {val};
@@ -125,10 +131,10 @@ int ztacx_kp_init(struct ztacx_leaf *leaf)
 	}
 
 	if (context->settings && context->settings_count) {
-		ztacx_settings_register(context->settings, context->settings_count);
+		ztacx_settings_register_leaf(leaf, context->settings, context->settings_count);
 	}
 
-	k_event_init(&context->event);
+	ztacx_event_queue_init(&context->event);
 	context->values[VALUE_EVENT].value.val_event = &context->event;
 
 	if (context->values && context->values_count) {
@@ -180,8 +186,8 @@ int ztacx_kp_start(struct ztacx_leaf *leaf)
 {
 	LOG_INF("start");
 	struct ztacx_kp_context *context = leaf->context;
-	k_work_init_delayable(&(context->scan), kp_scan);
-	k_work_schedule(&context->scan, K_NO_WAIT);
+	ztacx_leaf_work_init(leaf, &context->scan, kp_scan);
+	kp_schedule(context);
 
 	return 0;
 }
@@ -190,7 +196,7 @@ int ztacx_kp_stop(struct ztacx_leaf *leaf)
 {
 	LOG_INF("stop");
 	struct ztacx_kp_context *context = leaf->context;
-	k_work_cancel_delayable(&context->scan);
+	ztacx_leaf_work_cancel(&context->scan);
 	return 0;
 }
 
@@ -228,8 +234,7 @@ static int cmd_ztacx_kp(const struct shell *shell, size_t argc, char **argv)
 
 	if ((argc > 1) && (strcmp(argv[1], "scan")==0)) {
 		LOG_INF("Doing immediate scan");
-		k_work_cancel_delayable(&context->scan);
-		k_work_reschedule(&context->scan, K_NO_WAIT);
+		ztacx_leaf_work_reschedule(&context->scan, K_NO_WAIT);
 	}
 	else if ((argc > 1) && (strcmp(argv[1], "show")==0)) {
 		LOG_INF("Showing leaf status");
@@ -288,23 +293,13 @@ static int cmd_ztacx_kp(const struct shell *shell, size_t argc, char **argv)
 }
 #endif
 
-static int kp_leaf_compare_scan(const struct ztacx_leaf *leaf, void *compare)
-{
-	struct ztacx_kp_context *context = leaf->context;
-	if (&context->scan == compare) {
-		return 0;
-	}
-	return -1;
-}
-
 static void kp_scan(struct k_work *work)
 {
-	struct ztacx_leaf *leaf = ztacx_leaf_find("kp", work, kp_leaf_compare_scan);
-	if (!leaf || !leaf->context) {
+	struct ztacx_kp_context *context = ZTACX_LEAF_WORK_CONTEXT(work);
+	if (!context) {
 		LOG_ERR("kp not found");
 		return;
 	}
-	struct ztacx_kp_context *context = leaf->context;
 	uint8_t kp_was = CTX_VALUE(PINS).value.val_byte;
 	uint8_t kp_new = 0xFF;
 
@@ -319,20 +314,19 @@ static void kp_scan(struct k_work *work)
 			if (was==new) continue;
 			if (new==0) {
 				LOG_INF("Button %d press", bit);
-				ztacx_variable_value_set_event(
+				ztacx_variable_value_post_event(
 					&CTX_VALUE(EVENT),
 					KP_EVENT_PRESS|(1<<bit));
 			}
 			else {
 				LOG_DBG("Button %d release", bit);
-				ztacx_variable_value_set_event(
+				ztacx_variable_value_post_event(
 					&CTX_VALUE(EVENT),
 					KP_EVENT_RELEASE|(1<<bit));
 			}
 		}
 	}
 
-	if (!work) return;
-
-	k_work_schedule(&context->scan, K_MSEC(CTX_SETTING(INTERVAL).value.val_int32));
+	// follow any change to the scan interval
+	kp_schedule(context);
 }
@@ -98,7 +98,7 @@ int ztacx_led_init(struct ztacx_leaf *leaf)
 
 #if CONFIG_ZTACX_LEAF_SETTINGS
 	if (context->settings && context->settings_count) {
-		ztacx_settings_register(context->settings, context->settings_count);
+		ztacx_settings_register_leaf(leaf, context->settings, context->settings_count);
 	}
 #endif
 	if (context->values && context->values_count) {
@@ -147,10 +147,10 @@ int ztacx_led_init(struct ztacx_leaf *leaf)
 int ztacx_led_start(struct ztacx_leaf *leaf)
 {
 	struct ztacx_led_context *context = leaf->context;
-	k_work_init_delayable(&(context->ledoff), turn_led_off);
-	k_work_init_delayable(&(context->ledon), turn_led_on);
+	ztacx_leaf_work_init_named(leaf, &context->ledoff, turn_led_off, "ledoff");
+	ztacx_leaf_work_init_named(leaf, &context->ledon, turn_led_on, "ledon");
 
-	k_work_schedule(&context->ledon, K_NO_WAIT);
+	ztacx_leaf_work_schedule(&context->ledon, K_NO_WAIT);
 
 	return 0;
 }
@@ -158,8 +158,8 @@ int ztacx_led_start(struct ztacx_leaf *leaf)
 int ztacx_led_stop(struct ztacx_leaf *leaf)
 {
 	struct ztacx_led_context *context = leaf->context;
-	k_work_cancel_delayable(&context->ledon);
-	k_work_cancel_delayable(&context->ledoff);
+	ztacx_leaf_work_cancel(&context->ledon);
+	ztacx_leaf_work_cancel(&context->ledoff);
 	gpio_pin_set_dt(context->gpio, 0);
 	return 0;
 }
@@ -195,10 +195,10 @@ static int cmd_ztacx_led(const struct shell *shell, size_t argc, char **argv)
 
 
 	if ((argc > 2) && (strcmp(argv[2], "on")==0)) {
-		k_work_reschedule(&context->ledon, K_NO_WAIT);
+		ztacx_leaf_work_reschedule(&context->ledon, K_NO_WAIT);
 	}
 	else if ((argc > 2) && (strcmp(argv[2], "off")==0)) {
-		k_work_reschedule(&context->ledoff, K_NO_WAIT);
+		ztacx_leaf_work_reschedule(&context->ledoff, K_NO_WAIT);
 	}
 	else if ((argc > 3) && (strcmp(argv[2], "duty")==0)) {
 		ztacx_variable_value_set_string(&CTX_SETTING(DUTY), argv[3]);
@@ -214,77 +214,54 @@ static int cmd_ztacx_led(const struct shell *shell, size_t argc, char **argv)
 }
 #endif
 
-static int led_leaf_compare_ledon(const struct ztacx_leaf *leaf, void *compare) 
-{
-	struct ztacx_led_context *context = leaf->context;
-	if (&context->ledon == compare) {
-		return 0;
-	}
-	return -1;
-}
-
-static int led_leaf_compare_ledoff(const struct ztacx_leaf *leaf, void *compare) 
-{
-	struct ztacx_led_context *context = leaf->context;
-	if (&context->ledoff == compare) {
-		return 0;
-	}
-	return -1;
-}
-
 static void turn_led_on(struct k_work *work)
 {
-	struct ztacx_leaf *leaf = ztacx_leaf_find("led", work, led_leaf_compare_ledon);
-	if (!leaf || !leaf->context) return;
-	struct ztacx_led_context *context = leaf->context;
+	struct ztacx_led_context *context = ZTACX_LEAF_WORK_CONTEXT(work);
+	if (!context) return;
 
 	gpio_pin_set_dt(context->gpio, 1);
-	if (!work) return;
-	
+
 	if (ztacx_variable_value_get_bool(&CTX_VALUE(BLINK))) {
 		// when the identify option is set, fixed 100/100 blink
-		k_work_schedule(&context->ledoff, K_MSEC(100));
+		ztacx_leaf_work_schedule(&context->ledoff, K_MSEC(100));
 	}
 	else {
 		int duty = ztacx_variable_value_get_byte(&CTX_SETTING(DUTY));
 		int cycle = ztacx_variable_value_get_uint16(&CTX_SETTING(CYCLE));
 		if (duty == 100) {
 			// degenerate case, always on
-			k_work_schedule(&(context->ledon), K_MSEC(cycle));
+			ztacx_leaf_work_schedule(&context->ledon, K_MSEC(cycle));
 		}
 		else {
 			// otherwise, use defined cycle and duty
 			int delay = cycle * duty / 100;
-			k_work_schedule(&context->ledoff, K_MSEC(delay));
+			ztacx_leaf_work_schedule(&context->ledoff, K_MSEC(delay));
 		}
 	}
 }
 
 static void turn_led_off(struct k_work *work)
 {
-	struct ztacx_leaf *leaf = ztacx_leaf_find("led", work, led_leaf_compare_ledoff);
-	if (!leaf || !leaf->context) return;
-	struct ztacx_led_context *context = leaf->context;
+	struct ztacx_led_context *context = ZTACX_LEAF_WORK_CONTEXT(work);
+	if (!context) return;
 
 	gpio_pin_set_dt(context->gpio, 0);
-	if (!work) return;
-	
 
 	if (ztacx_variable_value_get_bool(&context->values[VALUE_BLINK])) {
 		// when the identify option is set, fixed 100/100 blink
-		k_work_schedule(&context->ledon, K_MSEC(100));
+		ztacx_leaf_work_schedule(&context->ledon, K_MSEC(100));
 	}
 	else {
 		int duty = ztacx_variable_value_get_byte(&CTX_SETTING(DUTY));
 		int cycle = ztacx_variable_value_get_uint16(&CTX_SETTING(CYCLE));
 		if (duty == 0) {
 			// degenerate case, always off
-			k_work_schedule(&context->ledoff, K_MSEC(cycle));
+			ztacx_leaf_work_schedule(&context->ledoff, K_MSEC(cycle));
 		}
 		else {
 			// otherwise, use defined cycle and duty
 			int delay = cycle * (100-duty) / 100;
-			k_work_schedule(&context->ledon, K_MSEC(delay));
+			ztacx_leaf_work_schedule(&context->ledon, K_MSEC(delay));
 		}
 	}
 }
@@ -33,7 +33,7 @@ static struct ztacx_variable ztacx_led_strip_settings[] = {
 static struct ztacx_variable ztacx_led_strip_values[] = {
 	{.name="led_strip_ok",     .kind=ZTACX_VALUE_BOOL },
 	{.name="led_strip_cursor", .kind=ZTACX_VALUE_UINT16,.value={.val_uint16=0}},
-	{.name="led_strip_color",  .kind=ZTACX_VALUE_STRING},
+	{.name="led_strip_color",  .kind=ZTACX_VALUE_STRING, ZTACX_STRING_INLINE(24, "")},
 	{.name="led_strip_blink",  .kind=ZTACX_VALUE_BOOL },
 	{.name="led_strip_lit",    .kind=ZTACX_VALUE_BOOL }
 };
@@ -129,11 +129,12 @@ int ztacx_led_strip_init(struct ztacx_leaf *leaf)
 	if (!context) {
 		LOG_INF("Use default led string context");
 		context = &ztacx_led_strip_context;
+		leaf->context = context;
 	}
 
 #if CONFIG_ZTACX_LEAF_SETTINGS
 	if (context->settings && context->settings_count) {
-		ztacx_settings_register(context->settings, context->settings_count);
+		ztacx_settings_register_leaf(leaf, context->settings, context->settings_count);
 	}
 #endif
 	if (context->values && context->values_count) {
@@ -145,7 +146,7 @@ int ztacx_led_strip_init(struct ztacx_leaf *leaf)
 		return -ENODEV;
 	}
 
-	k_work_init_delayable(&(context->refresh), ztacx_led_strip_refresh);
+	ztacx_leaf_work_init(leaf, &context->refresh, ztacx_led_strip_refresh);
 	k_work_init(&led_strip_cursor_onchange, ztacx_led_strip_cursor_onchange);
 	k_work_init(&led_strip_color_onchange, ztacx_led_strip_color_onchange);
 	ztacx_led_strip_values[VALUE_CURSOR].on_change = &led_strip_cursor_onchange;
@@ -162,16 +163,10 @@ int ztacx_led_strip_init(struct ztacx_leaf *leaf)
 
 	LOG_INF("LED string ready, %s (i2s) with %d pixels", context->dev->name, STRIP_NUM_PIXELS);
 
-	// test pattern at init
-	for (int i=ARRAY_SIZE(colors); i >= 0; i--) {
-		memcpy(&context->pixels[0], &colors[i-1], sizeof(struct led_rgb));
-		int rc = led_strip_update_rgb(context->dev, context->pixels, STRIP_NUM_PIXELS);
-		if (rc) {
-			LOG_ERR("couldn't update strip: %d", rc);
-		}
-		k_sleep(K_MSEC(100));
-	}
-	ztacx_led_strip_off(context);
+	// test pattern at init, stepped by the refresh work rather than
+	// sleeping here, so as not to hold up the initialisation of other leaves
+	context->test_step = ARRAY_SIZE(colors);
+	ztacx_leaf_work_schedule(&context->refresh, K_NO_WAIT);
 
 	return 0;
 }
@@ -223,7 +218,7 @@ int ztacx_led_strip_start(struct ztacx_leaf *leaf)
 {
 	struct ztacx_led_strip_context *context = leaf->context;
 
-	k_work_schedule(&context->refresh, K_SECONDS(1));
+	ztacx_leaf_work_schedule(&context->refresh, K_SECONDS(1));
 	context->cursor = ztacx_variable_value_get_uint16(&(ztacx_led_strip_values[VALUE_CURSOR]));
 
 	return 0;
@@ -232,7 +227,7 @@ int ztacx_led_strip_start(struct ztacx_leaf *leaf)
 int ztacx_led_strip_stop(struct ztacx_leaf *leaf)
 {
 	struct ztacx_led_strip_context *context = leaf->context;
-	k_work_cancel_delayable(&context->refresh);
+	ztacx_leaf_work_cancel(&context->refresh);
 	ztacx_led_strip_off(context);
 	return 0;
 }
@@ -252,8 +247,24 @@ int ztacx_led_strip_post_sleep(struct ztacx_leaf *leaf)
 
 static void ztacx_led_strip_refresh(struct k_work *work)
 {
-	//TODO does it make sense to support multi instances?  see led class if sso
-	struct ztacx_led_strip_context *context = &ztacx_led_strip_context;
+	struct ztacx_led_strip_context *context = ZTACX_LEAF_WORK_CONTEXT(work);
+	if (!context) return;
+
+	if (context->test_step > 0) {
+		context->test_step--;
+		memcpy(&context->pixels[0], &colors[context->test_step], sizeof(struct led_rgb));
+		ztacx_led_strip_show(context);
+		ztacx_leaf_work_schedule(&context->refresh, K_MSEC(100));
+		return;
+	}
+	if (context->test_step == 0) {
+		// end of the init test pattern
+		context->test_step = -1;
+		ztacx_led_strip_off(context);
+		if (!ztacx_leaf_work_leaf(work)->running) {
+			return;
+		}
+	}
 
 #if CONFIG_ZTACX_LED_STRIP_USE_TEST_PATTERN
 	// for testing a
@@ -270,7 +281,7 @@ static void ztacx_led_strip_refresh(struct k_work *work)
 	}
 #endif
 	ztacx_led_strip_show(context);
-	k_work_schedule(&context->refresh, REFRESH_INTERVAL);
+	ztacx_leaf_work_schedule(&context->refresh, REFRESH_INTERVAL);
 }
 
 static void ztacx_led_strip_cursor_onchange(struct k_work *work)
@@ -285,17 +296,23 @@ static void ztacx_led_strip_color_onchange(struct k_work *work)
 {
 	//TODO does it make sense to support multi instances?  see led class if sso
 	struct ztacx_led_strip_context *context = &ztacx_led_strip_context;
-	const char *c = ztacx_led_strip_values[VALUE_COLOR].value.val_string;
+	struct ztacx_variable *v = &ztacx_led_strip_values[VALUE_COLOR];
+	atomic_val_t token;
+	const char *c = ztacx_variable_value_borrow_string(v, &token);
 	struct led_rgb color=RGB(0,0,0);
-	LOG_DBG("cursor=%d color=%s", context->cursor, c);
 
-	if (c==NULL) {
+	if ((c==NULL) || (c[0]=='\0')) {
 		return;
 	}
+	LOG_DBG("cursor=%d color=%s", context->cursor, c);
 	if (color_parse(c, &color) != 0) {
 		LOG_ERR("Cannot parse color nanme [%s]", c);
 		return;
 	}
+	if (!ztacx_variable_value_borrow_valid(v, token)) {
+		// color changed while parsing, the next on-change will apply it
+		return;
+	}
 	ztacx_led_strip_set(context, context->cursor, &color);
 }
 
@@ -309,10 +326,10 @@ static int cmd_ztacx_led_strip(const struct shell *shell, size_t argc, char **ar
 	struct ztacx_led_strip_context *context = &ztacx_led_strip_context;
 
 	if ((argc > 1) && (strcmp(argv[1], "on")==0)) {
-		k_work_reschedule(&context->refresh, K_NO_WAIT);
+		ztacx_leaf_work_reschedule(&context->refresh, K_NO_WAIT);
 	}
 	else if ((argc > 1) && (strcmp(argv[1], "off")==0)) {
-		k_work_cancel_delayable(&context->refresh);
+		ztacx_leaf_work_cancel(&context->refresh);
 		ztacx_led_strip_off(context);
 	}
 	else if ((argc > 3) && (strcmp(argv[1], "set")==0)) {
@@ -32,7 +32,7 @@ enum lidar_value_index {
 	VALUE_NOTIFY,
 
 };
-static struct ztacx_variable lidar_values[]={
+static ZTACX_VARIABLES_DEFINE(lidar_values) = {
 	{"lidar_ok", ZTACX_VALUE_BOOL, {.val_bool=false}},
 	{"lidar_detect", ZTACX_VALUE_BOOL, {.val_bool=false}},
 	{"lidar_distance_mm", ZTACX_VALUE_UINT16, {.val_uint16=INVALID_DISTANCE}},
@@ -42,15 +42,21 @@ static struct ztacx_variable lidar_values[]={
 
 static const struct device *lidar_dev=NULL;
 const struct bt_gatt_attr *lidar_distance_attr = NULL;
-static struct k_work_delayable lidar_work;
+static struct ztacx_leaf_work lidar_work;
+static struct ztacx_publish lidar_publish;
 
 void lidar_read(struct k_work *work);
+
+static void lidar_schedule(void)
+{
+	uint32_t period_ms = MSEC_PER_SEC * lidar_settings[SETTING_READ_INTERVAL_SEC].value.val_uint16;
+	ztacx_leaf_work_set_period(&lidar_work, period_ms, ZTACX_PERIODIC_SLACK(period_ms));
+}
 int cmd_ztacx_lidar(const struct shell *shell, size_t argc, char **argv);
 
 int ztacx_lidar_init(struct ztacx_leaf *leaf)
 {
-	ztacx_settings_register(lidar_settings, ARRAY_SIZE(lidar_settings));
-	ztacx_variables_register(lidar_values, ARRAY_SIZE(lidar_values));
+	ztacx_settings_register_leaf(leaf, lidar_settings, ARRAY_SIZE(lidar_settings));
 
 #if CONFIG_VL53L0X
 	lidar_dev = device_get_binding(DT_LABEL(DT_INST(0, st_vl53l0x)));
@@ -59,7 +65,7 @@ int ztacx_lidar_init(struct ztacx_leaf *leaf)
 #endif
 	if (!lidar_dev) {
 		LOG_ERR("  LIDAR device not present");
-		ztacx_variable_value_set_bool(lidar_values[VALUE_OK],false);
+		ztacx_variable_value_set_bool(&lidar_values[VALUE_OK],false);
 		return -ENODEV;
 	}
 
@@ -72,15 +78,15 @@ int ztacx_lidar_init(struct ztacx_leaf *leaf)
 #endif
 
 	LOG_INF("  LIDAR present on I2C as %s", lidar_dev->name);
-	ztacx_variable_value_set_bool(lidar_values[VALUE_OK],true);
+	ztacx_variable_value_set_bool(&lidar_values[VALUE_OK],true);
 	return 0;
 }
 
 
 int ztacx_lidar_start(struct ztacx_leaf *leaf)
 {
-	k_work_init_delayable(&lidar_work, lidar_read);
-	k_work_schedule(&lidar_work, K_NO_WAIT);
+	ztacx_leaf_work_init(leaf, &lidar_work, lidar_read);
+	lidar_schedule();
 
 	return 0;
 }
@@ -117,18 +123,11 @@ void lidar_read(struct k_work *work)
 	uint16_t distance_mm = (int)(sensor_value_to_double(&value)*1000);
 	LOG_DBG("LIDAR distance is %dmm\n", (int)distance_mm);
 	
-	uint16_t lidar_distance;
-	ztacx_variable_value_get(&(lidar_values[VALUE_DISTANCE_MM]), &lidar_distance, sizeof(lidar_distance));
-
-	int delta = abs(distance_mm - lidar_distance);
-	int delta_threshold = lidar_settings[SETTING_DISTANCE_CHANGE_THRESHOLD_MM].value.val_uint16;
-	bool first_reading = (lidar_values[VALUE_DISTANCE_MM].value.val_uint16 == INVALID_DISTANCE);
-	bool significant_change = !first_reading && (delta >= delta_threshold);
-	if (first_reading || significant_change) {
+	lidar_publish.deadband = lidar_settings[SETTING_DISTANCE_CHANGE_THRESHOLD_MM].value.val_uint16;
+	if (ztacx_variable_publish(&(lidar_values[VALUE_DISTANCE_MM]), &lidar_publish, distance_mm) > 0) {
 
 		bool detect = distance_mm  < lidar_settings[SETTING_DISTANCE_THRESHOLD_MM].value.val_uint16;
 		LOG_INF("LIDAR distance %d mm (%s)", distance_mm, detect?"detect":"nodetect");
-		ztacx_variable_value_set(&(lidar_values[VALUE_DISTANCE_MM]), &distance_mm);
 
 		if (detect != lidar_values[VALUE_DETECT].value.val_bool) {
 			LOG_INF("LIDAR_DETECT changed");
@@ -143,8 +142,8 @@ void lidar_read(struct k_work *work)
 	}
 
 	if (work){
-		k_work_reschedule(&lidar_work,
-				  K_SECONDS(lidar_settings[SETTING_READ_INTERVAL_SEC].value.val_uint16));
+		// follow any change to the read interval
+		lidar_schedule();
 	}
 
 
@@ -163,7 +162,7 @@ int cmd_ztacx_lidar(const struct shell *shell, size_t argc, char **argv)
 	bool notify = (argc > 1) && (strcmp(argv[1],"notify")==0);
 	if (notify) {
 		uint16_t distance = lidar_values[VALUE_DISTANCE_MM].value.val_uint16;
-		bt_gatt_notify(NULL, lidar_distance_attr, distance, sizeof(distance));
+		bt_gatt_notify(NULL, lidar_distance_attr, &distance, sizeof(distance));
 	}
 #endif
 
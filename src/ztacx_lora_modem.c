@@ -35,13 +35,13 @@ enum lorawan_setting_index {
 static struct ztacx_variable lorawan_settings[] = {
 	{"lorawan_auth_abp", ZTACX_VALUE_BOOL},
 	{"lorawan_auth_otaa", ZTACX_VALUE_BOOL},
-	{"lorawan_dev_eui", ZTACX_VALUE_STRING},
-	{"lorawan_app_key", ZTACX_VALUE_STRING},
-	{"lorawan_join_eui", ZTACX_VALUE_STRING},
-	{"lorawan_dev_addr", ZTACX_VALUE_STRING},
-	{"lorawan_nwk_skey", ZTACX_VALUE_STRING},
-	{"lorawan_app_skey", ZTACX_VALUE_STRING},
-	{"lorawan_channel_mask", ZTACX_VALUE_STRING},
+	{"lorawan_dev_eui", ZTACX_VALUE_STRING, ZTACX_STRING_INLINE(17, "")},
+	{"lorawan_app_key", ZTACX_VALUE_STRING, ZTACX_STRING_INLINE(33, "")},
+	{"lorawan_join_eui", ZTACX_VALUE_STRING, ZTACX_STRING_INLINE(17, "")},
+	{"lorawan_dev_addr", ZTACX_VALUE_STRING, ZTACX_STRING_INLINE(9, "")},
+	{"lorawan_nwk_skey", ZTACX_VALUE_STRING, ZTACX_STRING_INLINE(33, "")},
+	{"lorawan_app_skey", ZTACX_VALUE_STRING, ZTACX_STRING_INLINE(33, "")},
+	{"lorawan_channel_mask", ZTACX_VALUE_STRING, ZTACX_STRING_INLINE(25, "")},
 	{"lorawan_adr", ZTACX_VALUE_BOOL},
 	{"lorawan_send_retries", ZTACX_VALUE_UINT16},
 	{"lorawan_join_retries", ZTACX_VALUE_UINT16, {.val_uint16=10}},
@@ -59,7 +59,7 @@ int ztacx_lora_modem_init(struct ztacx_leaf *leaf)
 		return -ENODEV;
 	}
 
-	ztacx_settings_register(lorawan_settings, ARRAY_SIZE(lorawan_settings));
+	ztacx_settings_register_leaf(leaf, lorawan_settings, ARRAY_SIZE(lorawan_settings));
 
 	return rc;
 }
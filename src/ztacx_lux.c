@@ -15,7 +15,7 @@
 
 enum lux_setting_index {
 	SETTING_READ_INTERVAL_SEC = 0,
-	SETTING_CHANGE_THRESHOLD = 0,
+	SETTING_CHANGE_THRESHOLD,
 };
 
 static struct ztacx_variable lux_settings[] = {
@@ -29,22 +29,29 @@ enum lux_value_index {
 	VALUE_LEVEL,
 
 };
-static struct ztacx_variable lux_values[]={
+static ZTACX_VARIABLES_DEFINE(lux_values) = {
 	{"lux_ok", ZTACX_VALUE_BOOL, {.val_bool=false}},
 	{"lux_notify", ZTACX_VALUE_BOOL, {.val_bool=false}},
 	{"lux_level", ZTACX_VALUE_UINT16, {.val_uint16=INVALID_LEVEL}},
 };
 
 static const struct device *lux_dev=NULL;
-static struct k_work_delayable lux_work;
+const struct bt_gatt_attr *lux_value_attr = NULL;
+static struct ztacx_leaf_work lux_work;
+static struct ztacx_publish lux_publish;
 
 void lux_read(struct k_work *work);
+
+static void lux_schedule(void)
+{
+	uint32_t period_ms = MSEC_PER_SEC * lux_settings[SETTING_READ_INTERVAL_SEC].value.val_uint16;
+	ztacx_leaf_work_set_period(&lux_work, period_ms, ZTACX_PERIODIC_SLACK(period_ms));
+}
 int cmd_ztacx_lux(const struct shell *shell, size_t argc, char **argv);
 
 int ztacx_lux_init(struct ztacx_leaf *leaf)
 {
-	ztacx_settings_register(lux_settings, ARRAY_SIZE(lux_settings));
-	ztacx_variables_register(lux_values, ARRAY_SIZE(lux_values));
+	ztacx_settings_register_leaf(leaf, lux_settings, ARRAY_SIZE(lux_settings));
 
 #if CONFIG_MAX44009
 	lux_dev = device_get_binding("MAX44009");
@@ -72,8 +79,8 @@ int ztacx_lux_init(struct ztacx_leaf *leaf)
 
 int ztacx_lux_start(struct ztacx_leaf *leaf)
 {
-	k_work_init_delayable(&lux_work, lux_read);
-	k_work_schedule(&lux_work, K_NO_WAIT);
+	ztacx_leaf_work_init(leaf, &lux_work, lux_read);
+	lux_schedule();
 
 	return 0;
 }
@@ -98,16 +105,10 @@ void lux_read(struct k_work *work)
 	struct sensor_value value;
 	rc = sensor_channel_get(lux_dev, SENSOR_CHAN_LIGHT, &value);
 	int val = value.val1;
-	int prev_val = lux_values[VALUE_LEVEL].value.val_uint16;
 	LOG_INF("Raw LUX value is %.3f", (float)value.val1);
 
-	int delta = abs(val - prev_val);
-	int delta_threshold = lux_settings[SETTING_CHANGE_THRESHOLD].value.val_uint16;
-	bool first_reading = (lux_values[VALUE_LEVEL].value.val_uint16 == INVALID_LEVEL);
-	bool significant_change = !first_reading && (delta >= delta_threshold);
-	if (first_reading || significant_change) {
-
-		ztacx_variable_value_set(&(lux_values[VALUE_LEVEL]), &val);
+	lux_publish.deadband = lux_settings[SETTING_CHANGE_THRESHOLD].value.val_uint16;
+	if (ztacx_variable_publish(&(lux_values[VALUE_LEVEL]), &lux_publish, val) > 0) {
 		LOG_INF("LUX level %d", val);
 
 #if CONFIG_BT_GATT_CLIENT
@@ -119,8 +120,8 @@ void lux_read(struct k_work *work)
 	}
 	
 	if (work){
-		k_work_reschedule(&lux_work,
-				  K_SECONDS(lux_settings[SETTING_READ_INTERVAL_SEC].value.val_uint16));
+		// follow any change to the read interval
+		lux_schedule();
 	}
 
 
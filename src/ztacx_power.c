@@ -38,6 +38,8 @@ int power_off(void)
 {
 	LOG_WRN("Entering deep sleep");
 	ztacx_pre_sleep();
+	ztacx_counter_checkpoint();
+	ztacx_retained_save();
 
 	/* Above we disabled entry to deep sleep based on duration of
 	 * controlled delay.  Here we need to override that, then
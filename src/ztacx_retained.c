@@ -0,0 +1,316 @@
+#include "ztacx.h"
+#include "ztacx_settings.h"
+
+#include <zephyr/linker/section_tags.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/version.h>
+
+#if CONFIG_SOC_SERIES_NRF52X
+#include <hal/nrf_power.h>
+#endif
+
+/*
+ * Retained state image
+ *
+ * The payload is a sequence of snapshot records (see
+ * ZTACX_SNAPSHOT_MAGIC): every setting, then each retained variable.
+ * The header guards it with a CRC over the payload, and with a build
+ * id and a hash of the names and kinds of the variables in the image,
+ * so that an image written by a different firmware (or a different set
+ * of leaves) is never restored.
+ */
+
+#define ZTACX_RETAINED_MAGIC 0x7A726574U
+
+struct ztacx_retained_image
+{
+	uint32_t magic;
+	uint32_t build;
+	uint32_t schema;
+	uint32_t crc;
+	uint16_t len;
+	uint16_t count;
+	bool settings_complete;
+	bool settings_clean;
+	uint8_t data[CONFIG_ZTACX_RETAINED_SIZE];
+};
+
+static __noinit struct ztacx_retained_image ztacx_retained;
+
+static struct ztacx_variable *ztacx_retained_vars[CONFIG_ZTACX_RETAINED_VARIABLES];
+static int ztacx_retained_var_count;
+static bool ztacx_retained_settings_done;
+static struct k_spinlock ztacx_retained_lock;
+
+/**
+ * Identify this firmware
+ *
+ * CONFIG_APP_BUILD_NUMBER when the app has one.  Otherwise a hash of
+ * the version and build time, and of where the linker put this code
+ * and the image, which moves with almost any change to the firmware.
+ */
+static uint32_t ztacx_retained_build(void)
+{
+#ifdef CONFIG_APP_BUILD_NUMBER
+	return CONFIG_APP_BUILD_NUMBER;
+#else
+	static uint32_t build;
+
+	if (!build) {
+		uintptr_t layout[] = {
+			(uintptr_t)&ztacx_retained_build,
+			(uintptr_t)&ztacx_retained,
+			(uintptr_t)&ztacx_retained_vars,
+		};
+#ifdef BUILD_VERSION
+		uint32_t hash = ztacx_name_hash(STRINGIFY(BUILD_VERSION) " " __DATE__ " " __TIME__);
+#else
+		uint32_t hash = ztacx_name_hash(KERNEL_VERSION_STRING " " __DATE__ " " __TIME__);
+#endif
+		build = crc32_ieee_update(hash, (const uint8_t *)layout, sizeof(layout)) | 1;
+	}
+	return build;
+#endif
+}
+
+/**
+ * @brief Add a variable to the retained image
+ *
+ * Call from leaf init (or app init); retained values are restored
+ * after every leaf has initialised and before any leaf starts.
+ */
+int ztacx_variable_retain(struct ztacx_variable *v)
+{
+	k_spinlock_key_t key;
+
+	if (!v) {
+		return -EINVAL;
+	}
+	key = k_spin_lock(&ztacx_retained_lock);
+	for (int i=0; i<ztacx_retained_var_count; i++) {
+		if (ztacx_retained_vars[i] == v) {
+			k_spin_unlock(&ztacx_retained_lock, key);
+			return 0;
+		}
+	}
+	if (ztacx_retained_var_count >= ARRAY_SIZE(ztacx_retained_vars)) {
+		k_spin_unlock(&ztacx_retained_lock, key);
+		LOG_ERR("Retained variable table is full, cannot retain " ZTACX_VARIABLE_NAME_FMT,
+			ZTACX_VARIABLE_NAME_ARG(v));
+		return -ENOMEM;
+	}
+	ztacx_retained_vars[ztacx_retained_var_count++] = v;
+	k_spin_unlock(&ztacx_retained_lock, key);
+	return 0;
+}
+
+/**
+ * Hash the names and kinds of everything that goes in the image
+ */
+static uint32_t ztacx_retained_schema(void)
+{
+	uint32_t schema = ZTACX_SCHEMA_INIT;
+
+#if CONFIG_ZTACX_LEAF_SETTINGS
+	struct ztacx_variable *s;
+
+	SYS_SLIST_FOR_EACH_CONTAINER(&ztacx_settings, s, node) {
+		schema = ztacx_schema_add(schema, s);
+	}
+#endif
+	for (int i=0; i<ztacx_retained_var_count; i++) {
+		schema = ztacx_schema_add(schema, ztacx_retained_vars[i]);
+	}
+	return schema;
+}
+
+static bool ztacx_retained_valid(void)
+{
+	return (ztacx_retained.magic == ZTACX_RETAINED_MAGIC) &&
+		(ztacx_retained.build == ztacx_retained_build()) &&
+		(ztacx_retained.len <= sizeof(ztacx_retained.data)) &&
+		(ztacx_retained.crc == crc32_ieee(ztacx_retained.data, ztacx_retained.len));
+}
+
+/**
+ * Keep the RAM sections holding the image powered in system off
+ *
+ * nRF52 RAM is 4KiB sections in 8KiB blocks for the first 64KiB, then
+ * (on nRF52840) 32KiB sections in block 8.
+ */
+static void ztacx_retained_power_config(void)
+{
+#if CONFIG_SOC_SERIES_NRF52X
+	uintptr_t start = (uintptr_t)&ztacx_retained - 0x20000000U;
+	uintptr_t end = start + sizeof(ztacx_retained);
+
+	for (uintptr_t off = ROUND_DOWN(start, 0x1000); off < end; off += 0x1000) {
+		uint8_t block = (off < 0x10000) ? (off / 0x2000) : 8;
+		uint8_t section = (off < 0x10000) ? ((off / 0x1000) % 2) : ((off - 0x10000) / 0x8000);
+
+		nrf_power_rampower_mask_on(NRF_POWER, block, NRF_POWER_RAMPOWER_S0RETENTION_MASK << section);
+	}
+#endif
+}
+
+static int ztacx_retained_append(size_t *pos, const struct ztacx_variable *v)
+{
+	int rc = ztacx_variable_encode_record(ztacx_retained.data + *pos,
+					      sizeof(ztacx_retained.data) - *pos, v);
+	if (rc < 0) {
+		LOG_WRN("Retained image is full at " ZTACX_VARIABLE_NAME_FMT,
+			ZTACX_VARIABLE_NAME_ARG(v));
+		return rc;
+	}
+	*pos += rc;
+	if (rc > 0) {
+		ztacx_retained.count++;
+	}
+	return 0;
+}
+
+/**
+ * @brief Write the settings and retained variables to the retained image
+ *
+ * Called on the way into system off, after the leaves' pre_sleep.
+ */
+int ztacx_retained_save(void)
+{
+	size_t pos = 0;
+	int rc = 0;
+
+	ztacx_retained.magic = 0;
+	ztacx_retained.count = 0;
+	ztacx_retained.settings_complete = false;
+	ztacx_retained.settings_clean = true;
+
+#if CONFIG_ZTACX_LEAF_SETTINGS
+	struct ztacx_variable *s;
+
+	while (sys_mutex_lock(&ztacx_settings_mutex, K_MSEC(500)) != 0) {
+		LOG_WRN("ztacx settings mutex is held too long");
+	}
+	SYS_SLIST_FOR_EACH_CONTAINER(&ztacx_settings, s, node) {
+		rc = ztacx_retained_append(&pos, s);
+		if (rc < 0) {
+			break;
+		}
+		// pre_sleep has committed them, unless the write failed
+		if (ztacx_setting_is_dirty(s)) {
+			ztacx_retained.settings_clean = false;
+		}
+	}
+	sys_mutex_unlock(&ztacx_settings_mutex);
+	ztacx_retained.settings_complete = (rc == 0);
+#endif
+	for (int i=0; (rc == 0) && (i<ztacx_retained_var_count); i++) {
+		rc = ztacx_retained_append(&pos, ztacx_retained_vars[i]);
+	}
+
+	ztacx_retained.len = pos;
+	ztacx_retained.crc = crc32_ieee(ztacx_retained.data, pos);
+	ztacx_retained.build = ztacx_retained_build();
+	ztacx_retained.schema = ztacx_retained_schema();
+	ztacx_retained.magic = ZTACX_RETAINED_MAGIC;
+	ztacx_retained_power_config();
+
+	LOG_INF("Retained %d values in %d bytes", ztacx_retained.count, ztacx_retained.len);
+	return rc;
+}
+
+static struct ztacx_variable *ztacx_retained_match(const uint8_t *rec)
+{
+	uint32_t id = sys_get_le32(rec);
+
+#if CONFIG_ZTACX_LEAF_SETTINGS
+	struct ztacx_variable *s;
+
+	SYS_SLIST_FOR_EACH_CONTAINER(&ztacx_settings, s, node) {
+		if (s->hash == id) {
+			return s;
+		}
+	}
+#endif
+	for (int i=0; i<ztacx_retained_var_count; i++) {
+		if (ztacx_retained_vars[i]->hash == id) {
+			return ztacx_retained_vars[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Restore the values in a valid retained image, and consume it
+ *
+ * @return the number of values restored, or -ENOENT if there is no
+ * valid image (eg after a cold boot)
+ */
+int ztacx_retained_restore(void)
+{
+	int timing;
+	size_t pos = 0;
+	int restored = 0;
+
+	if (!ztacx_retained_valid()) {
+		return -ENOENT;
+	}
+	if (ztacx_retained.schema != ztacx_retained_schema()) {
+		LOG_WRN("Retained image is from a different set of variables, ignored");
+		ztacx_retained_erase();
+		return -ENOENT;
+	}
+
+	timing = ztacx_timing_begin(ZTACX_TIMING_RETAINED_RESTORE, "retained");
+	while (pos + ZTACX_SNAPSHOT_RECORD_HEADER_SIZE <= ztacx_retained.len) {
+		const uint8_t *rec = ztacx_retained.data + pos;
+		size_t rec_len = ZTACX_SNAPSHOT_RECORD_HEADER_SIZE + rec[5];
+		struct ztacx_variable *v = ztacx_retained_match(rec);
+
+		if (v && (ztacx_variable_decode_record(v, rec, ztacx_retained.len - pos) > 0)) {
+#if CONFIG_ZTACX_LEAF_SETTINGS
+			// flash holds what was retained, no need to write it
+			// back; a setting whose write failed stays dirty
+			if (ztacx_retained.settings_clean) {
+				(void)ztacx_setting_mark_saved(v);
+			}
+#endif
+			restored++;
+		}
+		pos += rec_len;
+	}
+	ztacx_retained_settings_done = ztacx_retained.settings_complete;
+	ztacx_timing_end(timing, restored);
+
+	// consumed, a later reset must not restore stale values
+	ztacx_retained_erase();
+
+	LOG_INF("Restored %d values from retained RAM", restored);
+	return restored;
+}
+
+/**
+ * @brief True if every setting was restored from the retained image
+ */
+bool ztacx_retained_settings_restored(void)
+{
+	return ztacx_retained_settings_done;
+}
+
+void ztacx_retained_erase(void)
+{
+	memset(&ztacx_retained, 0, offsetof(struct ztacx_retained_image, data));
+}
+
+#if CONFIG_SHELL
+void ztacx_retained_show(const struct shell *shell)
+{
+	shell_print(shell, "Retained image: %s, build %u, %u values in %u/%u bytes%s",
+		    ztacx_retained_valid() ? "valid" : "none",
+		    ztacx_retained.build, ztacx_retained.count, ztacx_retained.len,
+		    (unsigned)sizeof(ztacx_retained.data),
+		    ztacx_retained.settings_complete ? ", all settings" : "");
+	shell_print(shell, "%d variables retained, settings %s restored at boot",
+		    ztacx_retained_var_count, ztacx_retained_settings_done ? "were" : "were not");
+}
+#endif
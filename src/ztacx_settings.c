@@ -1,6 +1,7 @@
 #include "ztacx.h"
 #include "ztacx_settings.h"
 #include <zephyr/settings/settings.h>
+#include <zephyr/sys/crc.h>
 
 #ifdef CONFIG_MCUMGR_CMD_FS_MGMT
 #include <zephyr/fs/fs.h>
@@ -56,8 +57,127 @@ static struct fs_mount_t littlefs_mnt = {
 #endif
 
 sys_slist_t ztacx_settings;
+ZTACX_VARIABLE_INDEX_DEFINE(ztacx_settings_index, CONFIG_ZTACX_SETTING_INDEX_BUCKETS);
 SYS_MUTEX_DEFINE(ztacx_settings_mutex);
 
+/*
+ * Write-back state of a setting
+ *
+ * Kept beside the registered settings, rather than in struct
+ * ztacx_variable, so that state variables do not pay for it.
+ */
+struct ztacx_setting_state
+{
+	uint32_t saved_crc;
+	uint8_t flags;
+};
+
+/* value has changed since it was last written to flash */
+#define ZTACX_SETTING_DIRTY BIT(0)
+/* saved_crc holds the CRC of the value in flash */
+#define ZTACX_SETTING_SAVED BIT(1)
+/* loaded from a key of an earlier layout, which is to be deleted */
+#define ZTACX_SETTING_LEGACY BIT(2)
+
+/*
+ * Each registered array of settings is a group, holding their
+ * write-back state.  Settings registered by a leaf are stored as
+ * app/<leaf>/<name>, others (group without a name) as app/<name>.  The
+ * one settings_load() pass at start (after any retained restore)
+ * routes each key to its leaf's group; a leaf that registers after
+ * that has just its own subtree loaded.  Keys of leaves that are not
+ * in use are skipped without a lookup.
+ */
+struct ztacx_settings_group
+{
+	sys_snode_t node;
+	const char *name;
+	struct ztacx_variable *settings;
+	int count;
+	bool loaded;
+	struct ztacx_setting_state state[];
+};
+static sys_slist_t ztacx_settings_groups;
+static bool ztacx_settings_subsys_started;
+static bool ztacx_settings_loaded;
+static struct settings_handler settings_handler;
+static struct ztacx_settings_group *ztacx_settings_leaf_of(const struct ztacx_variable *s);
+static struct ztacx_setting_state *ztacx_setting_state(const struct ztacx_variable *s);
+static void ztacx_setting_key(const struct ztacx_variable *s, char *buf, size_t size);
+static void ztacx_setting_legacy_delete(struct ztacx_variable *s);
+static void ztacx_setting_dirty(struct ztacx_setting_state *st);
+
+/*
+ * Write-back of changed settings
+ *
+ * Changes are marked dirty and written to flash by a dedicated low
+ * priority work queue, so that neither the thread that made the change
+ * (eg Bluetooth RX, or the shell) nor the leaf work queues wait on a
+ * flash erase.  Dirty settings are written once they have been quiet
+ * for CONFIG_ZTACX_SETTINGS_FLUSH_DELAY_MS (but no later than
+ * CONFIG_ZTACX_SETTINGS_FLUSH_MAX_MS after the first change), or when
+ * a commit is requested, or before sleep.
+ */
+K_THREAD_STACK_DEFINE(ztacx_settings_stack, CONFIG_ZTACX_SETTINGS_STACK_SIZE);
+static struct k_work_q ztacx_settings_workq;
+static bool ztacx_settings_workq_started;
+static void ztacx_settings_flush_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(ztacx_settings_flush_work, ztacx_settings_flush_handler);
+static void ztacx_settings_commit_handler(struct k_work *work);
+static K_WORK_DEFINE(ztacx_settings_commit_work, ztacx_settings_commit_handler);
+
+/*
+ * flags, dirty_since and the change and request stats are also
+ * changed from the setter's (or requester's) context
+ */
+static struct k_spinlock ztacx_settings_dirty_lock;
+static int64_t ztacx_settings_dirty_since;
+
+struct ztacx_settings_request
+{
+	ztacx_settings_done_cb_t cb;
+	void *user_data;
+	uint32_t queued;
+};
+K_MSGQ_DEFINE(ztacx_settings_requests, sizeof(struct ztacx_settings_request),
+	      CONFIG_ZTACX_SETTINGS_QUEUE_DEPTH, 4);
+
+static struct
+{
+	uint32_t changes;
+	uint32_t writes;
+	uint32_t skipped;
+	uint32_t failures;
+	uint32_t flushes;
+	uint32_t last_flush_us;
+	uint32_t max_flush_us;
+	uint32_t requests;
+	uint32_t rejected;
+	uint32_t queue_max;
+	uint32_t max_wait_us;
+} ztacx_settings_stats;
+
+#if CONFIG_ZTACX_SETTINGS_IMAGE
+/*
+ * Settings image
+ *
+ * A header (magic, version, little-endian record count, schema hash
+ * and CRC of the records) followed by a snapshot record (see
+ * ZTACX_SNAPSHOT_MAGIC) per setting.  Records carry the setting's id,
+ * and are matched by it when loaded.
+ */
+#define ZTACX_SETTINGS_IMAGE_KEY "ztacx/image"
+#define ZTACX_SETTINGS_IMAGE_MAGIC 0x53
+#define ZTACX_SETTINGS_IMAGE_VERSION 1
+#define ZTACX_SETTINGS_IMAGE_HEADER_SIZE 12
+
+static uint8_t ztacx_settings_image[CONFIG_ZTACX_SETTINGS_IMAGE_SIZE];
+static uint32_t ztacx_settings_image_crc;
+static uint32_t ztacx_settings_image_schema;
+static bool ztacx_settings_image_loaded;
+static bool ztacx_settings_image_legacy;
+#endif
+
 #if CONFIG_SETTINGS_RUNTIME
 int ztacx_settings_runtime_load(void)
 {
@@ -99,14 +219,221 @@ int ztacx_settings_runtime_load(void)
 }
 #endif
 
+#if CONFIG_ZTACX_SETTINGS_IMAGE
+static uint32_t ztacx_settings_schema(void)
+{
+	struct ztacx_variable *s;
+	uint32_t schema = ZTACX_SCHEMA_INIT;
+
+	SYS_SLIST_FOR_EACH_CONTAINER(&ztacx_settings, s, node) {
+		schema = ztacx_schema_add(schema, s);
+	}
+	return schema;
+}
+
+/**
+ * Mark every setting dirty, so that the next flush writes the image
+ */
+static void ztacx_settings_image_rewrite(void)
+{
+	struct ztacx_settings_group *g;
+
+	SYS_SLIST_FOR_EACH_CONTAINER(&ztacx_settings_groups, g, node) {
+		for (int i=0; i<g->count; i++) {
+			ztacx_setting_dirty(&g->state[i]);
+		}
+	}
+}
+
+static int ztacx_settings_image_read(const char *key, size_t len, settings_read_cb read_cb, void *cb_arg, void *param)
+{
+	ssize_t *len_r = param;
+
+	if (key) {
+		// below the image key, not the image
+		return 0;
+	}
+	if (len > sizeof(ztacx_settings_image)) {
+		*len_r = -E2BIG;
+		return 0;
+	}
+	*len_r = read_cb(cb_arg, ztacx_settings_image, len);
+	return 0;
+}
+
+/**
+ * Load the settings image, with one read
+ *
+ * Each record is matched to its setting by id through the settings
+ * index, so the order of registration does not matter; settings that
+ * are not in the image keep their defaults.  If the set of settings
+ * has changed since the image was written, it is rewritten.
+ *
+ * Called with the settings mutex held.
+ *
+ * @param g if not NULL, restore only the settings of this group (a
+ * leaf that registered after the load at start)
+ * @return the number of settings restored, or a negative error code
+ */
+static int ztacx_settings_image_load(const struct ztacx_settings_group *g)
+{
+	const uint8_t *buf = ztacx_settings_image;
+	ssize_t len = -ENOENT;
+	size_t pos = ZTACX_SETTINGS_IMAGE_HEADER_SIZE;
+	uint32_t schema;
+	bool changed;
+	int count;
+	int restored = 0;
+
+	settings_load_subtree_direct(ZTACX_SETTINGS_IMAGE_KEY, ztacx_settings_image_read, &len);
+	if (len < 0) {
+		LOG_INF("no settings image (%d)", (int)len);
+		return len;
+	}
+	if ((len < ZTACX_SETTINGS_IMAGE_HEADER_SIZE) ||
+	    (buf[0] != ZTACX_SETTINGS_IMAGE_MAGIC) || (buf[1] != ZTACX_SETTINGS_IMAGE_VERSION) ||
+	    (sys_get_le32(buf+8) != crc32_ieee(buf+pos, len-pos))) {
+		LOG_WRN("settings image is not valid, ignored");
+		return -EINVAL;
+	}
+	count = sys_get_le16(buf+2);
+	schema = sys_get_le32(buf+4);
+	changed = (schema != ztacx_settings_schema());
+	if (changed) {
+		LOG_WRN("settings have changed since the image was written");
+	}
+
+	for (int i=0; (i<count) && (pos + ZTACX_SNAPSHOT_RECORD_HEADER_SIZE <= len); i++) {
+		const uint8_t *rec = buf + pos;
+		struct ztacx_variable *target = ztacx_variable_index_find_id(&ztacx_settings_index,
+									     sys_get_le32(rec));
+
+		if (g && target && (ztacx_settings_leaf_of(target) != g)) {
+			// already loaded, and may have changed since
+			target = NULL;
+		}
+		if (target && (ztacx_variable_decode_record(target, rec, len - pos) > 0)) {
+			restored++;
+		}
+		pos += ZTACX_SNAPSHOT_RECORD_HEADER_SIZE + rec[5];
+	}
+	if (g) {
+		LOG_INF("restored %d settings of %s from image", restored, g->name);
+		return restored;
+	}
+
+	ztacx_settings_image_crc = sys_get_le32(buf+8);
+	ztacx_settings_image_schema = schema;
+	ztacx_settings_image_loaded = true;
+	if (changed) {
+		ztacx_settings_image_rewrite();
+	}
+	LOG_INF("restored %d of %d settings from image", restored, count);
+	return restored;
+}
+
+/**
+ * Write all the settings as one image, unless flash already holds it
+ *
+ * Called with the settings mutex held.
+ */
+static int ztacx_settings_image_save(void)
+{
+	uint8_t *buf = ztacx_settings_image;
+	size_t pos = ZTACX_SETTINGS_IMAGE_HEADER_SIZE;
+	struct ztacx_variable *s;
+	uint32_t schema = ZTACX_SCHEMA_INIT;
+	uint32_t crc;
+	int count = 0;
+	int err;
+
+	SYS_SLIST_FOR_EACH_CONTAINER(&ztacx_settings, s, node) {
+		int rc = ztacx_variable_encode_record(buf + pos, sizeof(ztacx_settings_image) - pos, s);
+		if (rc < 0) {
+			LOG_ERR("Settings do not fit in CONFIG_ZTACX_SETTINGS_IMAGE_SIZE");
+			return rc;
+		}
+		pos += rc;
+		count++;
+		schema = ztacx_schema_add(schema, s);
+	}
+	crc = crc32_ieee(buf + ZTACX_SETTINGS_IMAGE_HEADER_SIZE, pos - ZTACX_SETTINGS_IMAGE_HEADER_SIZE);
+	if (ztacx_settings_image_loaded && !ztacx_settings_image_legacy &&
+	    (crc == ztacx_settings_image_crc) && (schema == ztacx_settings_image_schema)) {
+		ztacx_settings_stats.skipped++;
+		return 0;
+	}
+
+	buf[0] = ZTACX_SETTINGS_IMAGE_MAGIC;
+	buf[1] = ZTACX_SETTINGS_IMAGE_VERSION;
+	sys_put_le16(count, buf+2);
+	sys_put_le32(schema, buf+4);
+	sys_put_le32(crc, buf+8);
+	err = settings_save_one(ZTACX_SETTINGS_IMAGE_KEY, buf, pos);
+	if (err != 0) {
+		LOG_ERR("Settings image save failed: %d", err);
+		ztacx_settings_stats.failures++;
+		return err;
+	}
+	ztacx_settings_stats.writes++;
+	ztacx_settings_image_crc = crc;
+	ztacx_settings_image_schema = schema;
+	ztacx_settings_image_loaded = true;
+	LOG_INF("Saved settings image, %d settings in %d bytes", count, (int)pos);
+
+	if (ztacx_settings_image_legacy) {
+		char key[64];
+
+		SYS_SLIST_FOR_EACH_CONTAINER(&ztacx_settings, s, node) {
+			ztacx_setting_key(s, key, sizeof(key));
+			settings_delete(key);
+			ztacx_setting_legacy_delete(s);
+		}
+		ztacx_settings_image_legacy = false;
+	}
+	return 0;
+}
+#endif
+
 int ztacx_settings_load()
 {
 	LOG_INF("load settings");
 
+	// settings restored with the retained image are newer than flash,
+	// the app handler ignores its keys (see settings_handle_set)
+	bool retained = ztacx_retained_settings_restored();
+
+	while (sys_mutex_lock(&ztacx_settings_mutex, K_MSEC(500)) != 0) {
+		LOG_WRN("ztacx settings mutex is held too long");
+	}
 	if (IS_ENABLED(CONFIG_SETTINGS)) {
-		LOG_INF("load flash settings");
-		settings_load();
+		LOG_INF("load flash settings%s", retained ? " (app settings were retained)" : "");
+#if CONFIG_ZTACX_SETTINGS_IMAGE
+		if (!retained) {
+			int image_timing = ztacx_timing_begin(ZTACX_TIMING_SETTINGS_LOAD, "settings_image");
+			int restored = ztacx_settings_image_load(NULL);
+			ztacx_timing_end(image_timing, restored);
+		}
+#endif
+		// one pass for every leaf's settings (or the per-setting
+		// records left from before the image) and other subsystems'
+		int timing = ztacx_timing_begin(ZTACX_TIMING_SETTINGS_LOAD, "settings_load");
+		int err = settings_load();
+		ztacx_timing_end(timing, err);
+#if CONFIG_ZTACX_SETTINGS_IMAGE
+		if (!retained && (!ztacx_settings_image_loaded || ztacx_settings_image_legacy)) {
+			// write the image (and so drop any per-setting records)
+			ztacx_settings_image_rewrite();
+		}
+#endif
 	}
+	struct ztacx_settings_group *g;
+
+	SYS_SLIST_FOR_EACH_CONTAINER(&ztacx_settings_groups, g, node) {
+		g->loaded = true;
+	}
+	ztacx_settings_loaded = true;
+	sys_mutex_unlock(&ztacx_settings_mutex);
 
 #if CONFIG_SETTINGS_RUNTIME
 	LOG_INF("load runtime settings (spragged)");
@@ -134,124 +461,419 @@ int ztacx_settings_add(const char *name,
 
 	struct ztacx_variable *setting = calloc(1, sizeof(struct ztacx_variable));
 	if (!setting) return -ENOMEM;
-	strncpy(setting->name, name, sizeof(setting->name));
+	setting->name = strdup(name);
+	if (!setting->name) {
+		free(setting);
+		return -ENOMEM;
+	}
 	setting->kind = kind;
 	err = ztacx_variable_value_set(setting, value);
 	if (err < 0) {
 		LOG_ERR("ztacx_settings_add: error %d", err);
 		return err;
 	}
+	return ztacx_settings_register(setting, 1);
+}
+
+/**
+ * Register an array of settings as a group, with their write-back state
+ *
+ * The group is added first, so that every setting in the list has
+ * its state.  The settings mutex is recursive, so callers may hold it.
+ */
+static struct ztacx_settings_group *ztacx_settings_group_add(const char *name, struct ztacx_variable *s, int count)
+{
+	struct ztacx_settings_group *g = calloc(1, sizeof(*g) + count * sizeof(g->state[0]));
+
+	if (!g) {
+		return NULL;
+	}
+	g->name = name;
+	g->settings = s;
+	g->count = count;
+
 	while (sys_mutex_lock(&ztacx_settings_mutex, K_MSEC(500)) != 0) {
 		LOG_WRN("ztacx settings mutex is held too long");
 	}
-	sys_slist_append(&ztacx_settings, &setting->node);
+	sys_slist_append(&ztacx_settings_groups, &g->node);
+	ztacx_values_register(&ztacx_settings, &ztacx_settings_mutex, &ztacx_settings_index, s, count);
 	sys_mutex_unlock(&ztacx_settings_mutex);
-	return 0;
+	return g;
 }
 
 int ztacx_settings_register(struct ztacx_variable *s, int count)
 {
 	LOG_INF("%d", count);
-	return ztacx_values_register(&ztacx_settings, &ztacx_settings_mutex, s, count);
+	if (!ztacx_settings_group_add(NULL, s, count)) {
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+/**
+ * Initialise the settings subsystem, on first use
+ *
+ * Called with the settings mutex held.
+ */
+static void ztacx_settings_subsys_start(void)
+{
+	if (!ztacx_settings_subsys_started && IS_ENABLED(CONFIG_SETTINGS)) {
+		settings_subsys_init();
+		settings_register(&settings_handler);
+		ztacx_settings_subsys_started = true;
+	}
+}
+
+static struct ztacx_settings_group *ztacx_settings_group_find(const char *name, size_t len)
+{
+	struct ztacx_settings_group *g;
+
+	SYS_SLIST_FOR_EACH_CONTAINER(&ztacx_settings_groups, g, node) {
+		if (g->name && (strncmp(g->name, name, len) == 0) && (g->name[len] == '\0')) {
+			return g;
+		}
+	}
+	return NULL;
+}
+
+static struct ztacx_settings_group *ztacx_settings_group_of(const struct ztacx_variable *s)
+{
+	struct ztacx_settings_group *g;
+
+	SYS_SLIST_FOR_EACH_CONTAINER(&ztacx_settings_groups, g, node) {
+		if ((s >= g->settings) && (s < g->settings + g->count)) {
+			return g;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Find the group of a setting registered by a leaf
+ */
+static struct ztacx_settings_group *ztacx_settings_leaf_of(const struct ztacx_variable *s)
+{
+	struct ztacx_settings_group *g = ztacx_settings_group_of(s);
+
+	return (g && g->name) ? g : NULL;
+}
+
+/**
+ * Find the write-back state of a setting
+ *
+ * @return NULL if the variable is not a setting
+ */
+static struct ztacx_setting_state *ztacx_setting_state(const struct ztacx_variable *s)
+{
+	struct ztacx_settings_group *g = ztacx_settings_group_of(s);
+
+	return g ? &g->state[s - g->settings] : NULL;
+}
+
+/**
+ * Compose the settings key of a setting
+ *
+ * app/<leaf>/<name>, or app/<name> for settings not registered by a leaf
+ */
+static void ztacx_setting_key(const struct ztacx_variable *s, char *buf, size_t size)
+{
+	const struct ztacx_settings_group *g = ztacx_settings_leaf_of(s);
+
+	if (g) {
+		snprintf(buf, size, "app/%s/" ZTACX_VARIABLE_NAME_FMT, g->name, ZTACX_VARIABLE_NAME_ARG(s));
+	}
+	else {
+		snprintf(buf, size, "app/" ZTACX_VARIABLE_NAME_FMT, ZTACX_VARIABLE_NAME_ARG(s));
+	}
+}
+
+/**
+ * @brief Register the settings of a leaf
+ *
+ * The settings are stored under app/<leaf>/.  Their stored values are
+ * applied by the settings load at start, along with any still stored
+ * under the flat app/<name> keys of earlier firmware (which are then
+ * moved); a leaf that registers after that has its subtree loaded now.
+ */
+int ztacx_settings_register_leaf(struct ztacx_leaf *leaf, struct ztacx_variable *s, int count)
+{
+	struct ztacx_settings_group *g;
+	bool late;
+	int rc;
+
+	if (!leaf) {
+		return ztacx_settings_register(s, count);
+	}
+	LOG_INF("%s: %d", leaf->name, count);
+	while (sys_mutex_lock(&ztacx_settings_mutex, K_MSEC(500)) != 0) {
+		LOG_WRN("ztacx settings mutex is held too long");
+	}
+	g = ztacx_settings_group_add(leaf->name, s, count);
+	if (!g) {
+		sys_mutex_unlock(&ztacx_settings_mutex);
+		return -ENOMEM;
+	}
+	ztacx_settings_subsys_start();
+	late = ztacx_settings_loaded;
+
+	if (late && IS_ENABLED(CONFIG_SETTINGS)) {
+		char subtree[8+CONFIG_ZTACX_VALUE_NAME_MAX];
+		int timing = ztacx_timing_begin(ZTACX_TIMING_SETTINGS_LOAD, leaf->name);
+
+#if CONFIG_ZTACX_SETTINGS_IMAGE
+		(void)ztacx_settings_image_load(g);
+#endif
+		snprintf(subtree, sizeof(subtree), "app/%s", leaf->name);
+		rc = settings_load_subtree(subtree);
+		ztacx_timing_end(timing, rc);
+	}
+	g->loaded = late;
+	sys_mutex_unlock(&ztacx_settings_mutex);
+	return 0;
+}
+
+/**
+ * Locate the stored form of a setting's value
+ */
+static const void *ztacx_setting_value_ptr(const struct ztacx_variable *s)
+{
+	switch (s->kind) {
+	case ZTACX_VALUE_STRING:
+		return s->value.val_string;
+	case ZTACX_VALUE_BOOL:
+		return &s->value.val_bool;
+	case ZTACX_VALUE_BYTE:
+		return &s->value.val_byte;
+	case ZTACX_VALUE_UINT16:
+		return &s->value.val_uint16;
+	case ZTACX_VALUE_INT16:
+		return &s->value.val_int16;
+	case ZTACX_VALUE_INT32:
+		return &s->value.val_int32;
+	case ZTACX_VALUE_INT64:
+		return &s->value.val_int64;
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * Largest setting value that can be written or exported (strings are
+ * stored without their terminator)
+ */
+#define ZTACX_SETTING_VALUE_MAX 256
+
+/**
+ * Copy the value of a setting in its stored form, without tearing
+ *
+ * The copy is taken under the value lock (strings) or the seqlock
+ * (int64), so a concurrent setter cannot free or change it mid-write.
+ *
+ * @return the stored length, or a negative error code
+ */
+static int ztacx_setting_value_read(const struct ztacx_variable *s, void *buf, size_t size)
+{
+	int rc = ztacx_variable_value_get(s, buf, size);
+
+	if (rc != 0) {
+		return rc;
+	}
+	switch (s->kind) {
+	case ZTACX_VALUE_STRING:
+		return strlen(buf);
+	case ZTACX_VALUE_BOOL:
+		return sizeof(s->value.val_bool);
+	case ZTACX_VALUE_BYTE:
+		return sizeof(s->value.val_byte);
+	case ZTACX_VALUE_UINT16:
+		return sizeof(s->value.val_uint16);
+	case ZTACX_VALUE_INT16:
+		return sizeof(s->value.val_int16);
+	case ZTACX_VALUE_INT32:
+		return sizeof(s->value.val_int32);
+	case ZTACX_VALUE_INT64:
+		return sizeof(s->value.val_int64);
+	default:
+		return -EINVAL;
+	}
+}
+
+static void ztacx_setting_flags_update(struct ztacx_setting_state *st, uint8_t set, uint8_t clear)
+{
+	k_spinlock_key_t key = k_spin_lock(&ztacx_settings_dirty_lock);
+
+	st->flags = (st->flags & ~clear) | set;
+	k_spin_unlock(&ztacx_settings_dirty_lock, key);
+}
+
+/**
+ * Delete the flat app/<name> key of a setting that is now stored per leaf
+ */
+static void ztacx_setting_legacy_delete(struct ztacx_variable *s)
+{
+	char key[64];
+
+	snprintf(key, sizeof(key), "app/" ZTACX_VARIABLE_NAME_FMT, ZTACX_VARIABLE_NAME_ARG(s));
+	if (ztacx_settings_leaf_of(s)) {
+		settings_delete(key);
+	}
+	ztacx_setting_flags_update(ztacx_setting_state(s), 0, ZTACX_SETTING_LEGACY);
 }
 
 static int settings_handle_set(const char *name, size_t len, settings_read_cb read_cb, void *cb_arg)
 {
-	LOG_INF("name=%s len=%d", name, (int)len);
+	LOG_DBG("name=%s len=%d", name, (int)len);
+
+	if (ztacx_retained_settings_restored() && !ztacx_settings_loaded) {
+		// the values restored from retained RAM are newer
+		return 0;
+	}
 
 	const char *next;
-	size_t next_len;
 	int rc = 0;
-	//char desc[132];
-	sys_slist_t *list = &ztacx_settings;
 	struct ztacx_variable *s;
-	SYS_SLIST_FOR_EACH_CONTAINER(list, s, node) {
-		if (settings_name_steq(name, s->name, &next) && !next) {
-			//LOG_INF("Found setting record of kind %d for %s", s->kind, name);
-			switch (s->kind) {
-			case ZTACX_VALUE_STRING:
-				if (s->value.val_string==NULL) {
-					//LOG_INF("Allocate string space %d", len+1);
-					
-					s->value.val_string=calloc(1,len+1);
-				}
-				else if (len != strlen(s->value.val_string)) {
-					//LOG_INF("Reallocate string space to fit %d", len+1);
-					s->value.val_string = realloc(s->value.val_string, len+1);
-				}
-				if (s->value.val_string==NULL) {
-					LOG_ERR("Allocation failed");
-					return -ENOMEM;
-				}
-				read_cb(cb_arg, s->value.val_string, len);
-				s->value.val_string[len]='\0';
-				break;
-			case ZTACX_VALUE_BOOL:
-				if (len != sizeof(s->value.val_bool)) {
-					LOG_ERR("Incorrect size %s:%d",name,len);
-					return -EINVAL;
-				}
-				read_cb(cb_arg, &s->value.val_bool, len);
-				break;
-			case ZTACX_VALUE_BYTE:
-				if (len != sizeof(s->value.val_byte)) {
-					LOG_ERR("Incorrect size %s:%d",name,len);
-					return -EINVAL;
-				}
-				read_cb(cb_arg, &s->value.val_byte, len);
-				break;
-			case ZTACX_VALUE_UINT16:
-				if (len != sizeof(s->value.val_uint16)) {
-					LOG_ERR("Incorrect size %s:%d",name,len);
-					return -EINVAL;
-				}
-				read_cb(cb_arg, &s->value.val_uint16, len);
-				break;
-			case ZTACX_VALUE_INT16:
-				if (len != sizeof(s->value.val_int16)) {
-					LOG_ERR("Incorrect size %s:%d",name,len);
-					return -EINVAL;
-				}
-				read_cb(cb_arg, &s->value.val_int16, len);
-				break;
-			case ZTACX_VALUE_INT32:
-				if (len != sizeof(s->value.val_int32)) {
-					LOG_ERR("Incorrect size %s:%d",name,len);
-					return -EINVAL;
-				}
-				read_cb(cb_arg, &s->value.val_int32, len);
-				break;
-			case ZTACX_VALUE_INT64:
-				if (len != sizeof(s->value.val_int64)) {
-					LOG_ERR("Incorrect size %s:%d",name,len);
-					return -EINVAL;
-				}
-				read_cb(cb_arg, &s->value.val_int64, len);
-				break;
-			default:
-				LOG_ERR("Unhandled setting type %s:%d",name,(int)s->kind);
-				rc = -EINVAL;
-				break;
-			}
-			/*
-			if (rc == 0) {
-				ztacx_variable_describe(desc, sizeof(desc), s);
-				LOG_INF("Loaded %s", desc);
-			}
-			*/
-			return rc;
+	struct ztacx_setting_state *st;
+	struct ztacx_settings_group *g = NULL;
+	bool legacy = false;
+
+	// keys are <leaf>/<name> (or <name>), resolved through the name
+	// index built at registration, so that a load is linear in the
+	// number of settings
+	size_t leaf_len = settings_name_next(name, &next);
+	if (next) {
+		g = ztacx_settings_group_find(name, leaf_len);
+		if (!g || g->loaded) {
+			// leaf not in use, or already loaded
+			return 0;
+		}
+		name = next;
+		settings_name_next(name, &next);
+		if (next) {
+			return 0;
 		}
 	}
+	s = ztacx_variable_index_find(&ztacx_settings_index, name);
+	if (!s || (g && (ztacx_settings_leaf_of(s) != g))) {
+		LOG_WRN("Unhandled setting %s", name);
+		return -ENOENT;
+	}
+	st = ztacx_setting_state(s);
+	if (!g && ztacx_settings_leaf_of(s)) {
+		// a flat key from before settings were stored per leaf
+		legacy = true;
+	}
 
-	//NOCOMMIT LOG_WRN("Unhandled setting %s", name);
-
-	next_len = settings_name_next(name, &next);
+#if CONFIG_ZTACX_SETTINGS_IMAGE
+	// a per-setting record from before the image, deleted when the image is next written
+	ztacx_settings_image_legacy = true;
+	if (ztacx_settings_image_loaded) {
+		return 0;
+	}
+#endif
+	if (legacy && (st->flags & ZTACX_SETTING_SAVED)) {
+		// the per-leaf record has been loaded, and is newer
+		ztacx_setting_flags_update(st, ZTACX_SETTING_LEGACY, 0);
+		ztacx_setting_dirty(st);
+		return 0;
+	}
 
-	if (!next) {
-		LOG_ERR("returing ENOENT");
-		return -ENOENT;
+	switch (s->kind) {
+	case ZTACX_VALUE_STRING:
+		if (s->capacity) {
+			// inline storage, read in place
+			if (len >= s->capacity) {
+				LOG_ERR("Stored value for %s exceeds capacity %d",
+					name, (int)s->capacity);
+				return -E2BIG;
+			}
+			atomic_inc(&s->seq);
+			read_cb(cb_arg, s->value.val_string, len);
+			s->value.val_string[len]='\0';
+			atomic_inc(&s->seq);
+			break;
+		}
+		if (s->value.val_string==NULL) {
+			//LOG_INF("Allocate string space %d", len+1);
+			
+			s->value.val_string=calloc(1,len+1);
+		}
+		else if (len != strlen(s->value.val_string)) {
+			//LOG_INF("Reallocate string space to fit %d", len+1);
+			s->value.val_string = realloc(s->value.val_string, len+1);
+		}
+		if (s->value.val_string==NULL) {
+			LOG_ERR("Allocation failed");
+			return -ENOMEM;
+		}
+		read_cb(cb_arg, s->value.val_string, len);
+		s->value.val_string[len]='\0';
+		break;
+	case ZTACX_VALUE_BOOL:
+		if (len != sizeof(s->value.val_bool)) {
+			LOG_ERR("Incorrect size %s:%d",name,len);
+			return -EINVAL;
+		}
+		read_cb(cb_arg, &s->value.val_bool, len);
+		break;
+	case ZTACX_VALUE_BYTE:
+		if (len != sizeof(s->value.val_byte)) {
+			LOG_ERR("Incorrect size %s:%d",name,len);
+			return -EINVAL;
+		}
+		read_cb(cb_arg, &s->value.val_byte, len);
+		break;
+	case ZTACX_VALUE_UINT16:
+		if (len != sizeof(s->value.val_uint16)) {
+			LOG_ERR("Incorrect size %s:%d",name,len);
+			return -EINVAL;
+		}
+		read_cb(cb_arg, &s->value.val_uint16, len);
+		break;
+	case ZTACX_VALUE_INT16:
+		if (len != sizeof(s->value.val_int16)) {
+			LOG_ERR("Incorrect size %s:%d",name,len);
+			return -EINVAL;
+		}
+		read_cb(cb_arg, &s->value.val_int16, len);
+		break;
+	case ZTACX_VALUE_INT32:
+		if (len != sizeof(s->value.val_int32)) {
+			LOG_ERR("Incorrect size %s:%d",name,len);
+			return -EINVAL;
+		}
+		read_cb(cb_arg, &s->value.val_int32, len);
+		break;
+	case ZTACX_VALUE_INT64:
+		if (len != sizeof(s->value.val_int64)) {
+			LOG_ERR("Incorrect size %s:%d",name,len);
+			return -EINVAL;
+		}
+		read_cb(cb_arg, &s->value.val_int64, len);
+		break;
+	default:
+		LOG_ERR("Unhandled setting type %s:%d",name,(int)s->kind);
+		rc = -EINVAL;
+		break;
 	}
-	return 0;
+	/*
+	if (rc == 0) {
+		ztacx_variable_describe(desc, sizeof(desc), s);
+		LOG_INF("Loaded %s", desc);
+	}
+	*/
+	if ((rc == 0) && legacy) {
+		// write it under the per-leaf key, and delete the flat key
+		ztacx_setting_flags_update(st, ZTACX_SETTING_LEGACY, ZTACX_SETTING_SAVED);
+		ztacx_setting_dirty(st);
+	}
+	else if (rc == 0) {
+		// remember what flash holds, so that writing it back is
+		// skipped (but a flat key read first must still be deleted)
+		st->saved_crc = crc32_ieee((const uint8_t *)ztacx_setting_value_ptr(s), len);
+		ztacx_setting_flags_update(st, ZTACX_SETTING_SAVED,
+					   (st->flags & ZTACX_SETTING_LEGACY) ? 0 : ZTACX_SETTING_DIRTY);
+	}
+	return rc;
 }
 
 static int settings_handle_commit(void)
@@ -267,32 +889,17 @@ static int settings_handle_export(int (*cb)(const char *name,
 
 	sys_slist_t *list = &ztacx_settings;
 	struct ztacx_variable *s;
+	char s_name[64];
+	char value[ZTACX_SETTING_VALUE_MAX] __aligned(8);
+
 	SYS_SLIST_FOR_EACH_CONTAINER(list, s, node) {
-		switch (s->kind) {
-		case ZTACX_VALUE_STRING:
-			(void)cb(s->name, s->value.val_string, strlen(s->value.val_string));
-			break;
-		case ZTACX_VALUE_BOOL:
-			(void)cb(s->name, &s->value.val_bool, sizeof(s->value.val_bool));
-			break;
-		case ZTACX_VALUE_BYTE:
-			(void)cb(s->name, &s->value.val_byte, sizeof(s->value.val_byte));
-			break;
-		case ZTACX_VALUE_UINT16:
-			(void)cb(s->name, &s->value.val_uint16, sizeof(s->value.val_uint16));
-			break;
-		case ZTACX_VALUE_INT16:
-			(void)cb(s->name, &s->value.val_int16, sizeof(s->value.val_int16));
-			break;
-		case ZTACX_VALUE_INT32:
-			(void)cb(s->name, &s->value.val_int32, sizeof(s->value.val_int32));
-			break;
-		case ZTACX_VALUE_INT64:
-			(void)cb(s->name, &s->value.val_int64, sizeof(s->value.val_int64));
-			break;
-		default:
-			LOG_WRN("Unhandled type for setting %s", s->name);
+		ztacx_setting_key(s, s_name, sizeof(s_name));
+		int len = ztacx_setting_value_read(s, value, sizeof(value));
+		if (len < 0) {
+			LOG_WRN("Cannot export setting %s: %d", s_name, len);
+			continue;
 		}
+		(void)cb(s_name, value, len);
 	}
 
 	return 0;
@@ -333,6 +940,16 @@ static int _print_setting(const char *key, size_t len, settings_read_cb read_cb,
 /**
  * Implementation of the "app settings" CLI component
  */
+static void ztacx_settings_commit_done(int rc, void *user_data)
+{
+	if (rc != 0) {
+		LOG_ERR("Settings commit failed: error %d", rc);
+	}
+	else {
+		LOG_INF("Settings committed");
+	}
+}
+
 int cmd_ztacx_settings(const struct shell *shell, size_t argc, char **argv)
 {
 	LOG_INF("cmd_ztacx_settings argc=%d argv[1]=%s", argc, (argc>1)?argv[1]:"");
@@ -405,13 +1022,32 @@ int cmd_ztacx_settings(const struct shell *shell, size_t argc, char **argv)
 		ztacx_variable_describe(desc,sizeof(desc), s);
 		shell_print(shell, "%s", desc);
 	}
+	else if ((argc == 2) && (strcmp(argv[1], "commit")==0)) {
+		int err = ztacx_settings_commit_async(ztacx_settings_commit_done, NULL);
+		if (err != 0) {
+			shell_print(shell, "Settings commit not queued: error %d", err);
+			return err;
+		}
+	}
+	else if ((argc == 2) && (strcmp(argv[1], "stats")==0)) {
+		shell_print(shell, "changes %u, writes %u, skipped %u, failed %u",
+			    ztacx_settings_stats.changes, ztacx_settings_stats.writes,
+			    ztacx_settings_stats.skipped, ztacx_settings_stats.failures);
+		shell_print(shell, "writes saved %u, flushes %u, last %uus, max %uus",
+			    ztacx_settings_stats.changes - MIN(ztacx_settings_stats.changes,
+							       ztacx_settings_stats.writes),
+			    ztacx_settings_stats.flushes, ztacx_settings_stats.last_flush_us,
+			    ztacx_settings_stats.max_flush_us);
+		shell_print(shell, "commit requests %u, rejected %u, queue max %u/%u, max wait %uus",
+			    ztacx_settings_stats.requests, ztacx_settings_stats.rejected,
+			    ztacx_settings_stats.queue_max, CONFIG_ZTACX_SETTINGS_QUEUE_DEPTH,
+			    ztacx_settings_stats.max_wait_us);
+	}
 	else if (strcmp(argv[1], "unretain")==0) {
-#if CONFIG_APP_RETENTION
-		retained_erase();
-#endif
+		ztacx_retained_erase();
 	}
 	else {
-		shell_print(shell, "app settings <setup|list|load|save|set|unretain>\n");
+		shell_print(shell, "app settings <setup|list|load|save|set|commit|stats|unretain>\n");
 	}
 
 	return 0;
@@ -424,10 +1060,11 @@ int ztacx_settings_init(struct ztacx_leaf *leaf)
 {
 	LOG_INF("");
 
-	if (IS_ENABLED(CONFIG_SETTINGS)) {
-		settings_subsys_init();
-		settings_register(&settings_handler);
+	while (sys_mutex_lock(&ztacx_settings_mutex, K_MSEC(500)) != 0) {
+		LOG_WRN("ztacx settings mutex is held too long");
 	}
+	ztacx_settings_subsys_start();
+	sys_mutex_unlock(&ztacx_settings_mutex);
 
 #if CONFIG_STATS
 	int stats_err = STATS_INIT_AND_REG(app_stats, STATS_SIZE_32, "app_stats");
@@ -461,6 +1098,15 @@ int ztacx_settings_init(struct ztacx_leaf *leaf)
 	fs_mgmt_register_group();
 #endif
 
+	if (!ztacx_settings_workq_started) {
+		struct k_work_queue_config cfg = {.name = "ztacx_settings"};
+
+		k_work_queue_start(&ztacx_settings_workq, ztacx_settings_stack,
+				   K_THREAD_STACK_SIZEOF(ztacx_settings_stack),
+				   CONFIG_ZTACX_SETTINGS_PRIORITY, &cfg);
+		ztacx_settings_workq_started = true;
+	}
+
 #if CONFIG_SHELL
 	ztacx_shell_cmd_register(((struct shell_static_entry){
 				.syntax="settings",
@@ -469,6 +1115,12 @@ int ztacx_settings_init(struct ztacx_leaf *leaf)
 				}));
 #endif
 
+	// every other leaf has registered its settings by now (this leaf
+	// depends on all of them), and none has started, so load here
+	// for their start to see the stored values.  A retained image
+	// is newer than flash, and is restored first.
+	ztacx_retained_restore();
+	ztacx_settings_load();
 
 	LOG_INF("done");
 	return 0;
@@ -478,7 +1130,11 @@ int ztacx_settings_start(struct ztacx_leaf *leaf)
 {
 	LOG_INF("");
 
-	ztacx_settings_load();
+	if (ztacx_settings_dirty_since) {
+		// changed before the leaf was initialised
+		k_work_reschedule_for_queue(&ztacx_settings_workq, &ztacx_settings_flush_work,
+					    K_MSEC(CONFIG_ZTACX_SETTINGS_FLUSH_DELAY_MS));
+	}
 	return 0;
 }
 
@@ -491,73 +1147,326 @@ int settings_loop(void) {
 
 
 /**
- * Look up a setting by name from the settings list
+ * Look up a setting by name from the settings index
  */
 struct ztacx_variable *ztacx_setting_find(const char *name)
 {
-	sys_slist_t *list = &ztacx_settings;
-	struct ztacx_variable *s;
-	SYS_SLIST_FOR_EACH_CONTAINER(list, s, node) {
-		if (strcmp(s->name, name) == 0) {
-			return s;
+	struct ztacx_variable *s = ztacx_variable_index_find(&ztacx_settings_index, name);
+
+	if (!s) {
+		// callers (eg ZTACX_SETTING_FIND) report a miss if it matters
+		LOG_DBG("no setting named '%s' found", name);
+	}
+	return s;
+}
+
+
+
+/**
+ * Write one setting to flash, unless flash already holds its value
+ *
+ * Called with the settings mutex held.
+ */
+static int ztacx_setting_save(struct ztacx_variable *s, struct ztacx_setting_state *st)
+{
+	char key[64];
+	char value[ZTACX_SETTING_VALUE_MAX] __aligned(8);
+	int len = ztacx_setting_value_read(s, value, sizeof(value));
+	uint32_t crc;
+	int err;
+
+	if (len < 0) {
+		LOG_ERR("Cannot save setting " ZTACX_VARIABLE_NAME_FMT ": %d",
+			ZTACX_VARIABLE_NAME_ARG(s), len);
+		return len;
+	}
+	crc = crc32_ieee((const uint8_t *)value, len);
+	if ((st->flags & ZTACX_SETTING_SAVED) && (st->saved_crc == crc)) {
+		ztacx_settings_stats.skipped++;
+		return 0;
+	}
+
+	ztacx_setting_key(s, key, sizeof(key));
+	err = settings_save_one(key, value, len);
+	if (err != 0) {
+		LOG_ERR("Settings save failed for %s: %d", key, err);
+		ztacx_settings_stats.failures++;
+		return err;
+	}
+	st->saved_crc = crc;
+	ztacx_setting_flags_update(st, ZTACX_SETTING_SAVED, 0);
+	ztacx_settings_stats.writes++;
+
+	char desc[132];
+	ztacx_variable_describe(desc,sizeof(desc), s);
+	LOG_INF("Saved %s", desc);
+	return 0;
+}
+
+/**
+ * Write all dirty settings to flash
+ *
+ * Runs on the settings work queue (or before sleep).
+ */
+static int ztacx_settings_flush(void)
+{
+	struct ztacx_settings_group *g;
+	uint32_t start = k_cycle_get_32();
+	k_spinlock_key_t key;
+	int count = 0;
+	int rc = 0;
+
+	while (sys_mutex_lock(&ztacx_settings_mutex, K_MSEC(500)) != 0) {
+		LOG_WRN("ztacx settings mutex is held too long");
+	}
+	key = k_spin_lock(&ztacx_settings_dirty_lock);
+	ztacx_settings_dirty_since = 0;
+	k_spin_unlock(&ztacx_settings_dirty_lock, key);
+
+	SYS_SLIST_FOR_EACH_CONTAINER(&ztacx_settings_groups, g, node) {
+		for (int i=0; i<g->count; i++) {
+			struct ztacx_setting_state *st = &g->state[i];
+			bool dirty;
+
+			key = k_spin_lock(&ztacx_settings_dirty_lock);
+			dirty = st->flags & ZTACX_SETTING_DIRTY;
+			st->flags &= ~ZTACX_SETTING_DIRTY;
+			k_spin_unlock(&ztacx_settings_dirty_lock, key);
+			if (!dirty) {
+				continue;
+			}
+			count++;
+#if !CONFIG_ZTACX_SETTINGS_IMAGE
+			int err = ztacx_setting_save(&g->settings[i], st);
+			if (err != 0) {
+				// left dirty, for the next flush
+				ztacx_setting_flags_update(st, ZTACX_SETTING_DIRTY, 0);
+				rc = err;
+			}
+			else if (st->flags & ZTACX_SETTING_LEGACY) {
+				ztacx_setting_legacy_delete(&g->settings[i]);
+			}
+#endif
 		}
 	}
-	LOG_WRN("no setting named '%s' found", name);
-	return NULL;
+#if CONFIG_ZTACX_SETTINGS_IMAGE
+	// the image is written whole
+	if (count && ((rc = ztacx_settings_image_save()) != 0)) {
+		SYS_SLIST_FOR_EACH_CONTAINER(&ztacx_settings_groups, g, node) {
+			for (int i=0; i<g->count; i++) {
+				ztacx_setting_flags_update(&g->state[i], ZTACX_SETTING_DIRTY, 0);
+			}
+		}
+	}
+#endif
+	if (count) {
+		uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+
+		ztacx_settings_stats.flushes++;
+		ztacx_settings_stats.last_flush_us = us;
+		ztacx_settings_stats.max_flush_us = MAX(ztacx_settings_stats.max_flush_us, us);
+		LOG_DBG("flushed %d settings in %uus", count, us);
+	}
+	sys_mutex_unlock(&ztacx_settings_mutex);
+	return rc;
 }
 
+static void ztacx_settings_flush_handler(struct k_work *work)
+{
+	if (ztacx_settings_flush() != 0) {
+		k_work_reschedule_for_queue(&ztacx_settings_workq, &ztacx_settings_flush_work,
+					    K_MSEC(CONFIG_ZTACX_SETTINGS_FLUSH_MAX_MS));
+	}
+}
 
+/**
+ * Flush for every queued commit request, then report to each requester
+ *
+ * Requests are taken before the flush, so that every change made
+ * before a request was queued is written before it completes.
+ */
+static void ztacx_settings_commit_handler(struct k_work *work)
+{
+	struct ztacx_settings_request req[CONFIG_ZTACX_SETTINGS_QUEUE_DEPTH];
+	int count = 0;
+	int rc;
+
+	while ((count < ARRAY_SIZE(req)) &&
+	       (k_msgq_get(&ztacx_settings_requests, &req[count], K_NO_WAIT) == 0)) {
+		uint32_t wait_us = k_cyc_to_us_floor32(k_cycle_get_32() - req[count].queued);
+		k_spinlock_key_t key = k_spin_lock(&ztacx_settings_dirty_lock);
+
+		ztacx_settings_stats.max_wait_us = MAX(ztacx_settings_stats.max_wait_us, wait_us);
+		k_spin_unlock(&ztacx_settings_dirty_lock, key);
+		count++;
+	}
+	k_work_cancel_delayable(&ztacx_settings_flush_work);
+	rc = ztacx_settings_flush();
+	for (int i=0; i<count; i++) {
+		if (req[i].cb) {
+			req[i].cb(rc, req[i].user_data);
+		}
+	}
+}
 
 /**
- * Store a value (from string) into a ztacx_setting
+ * Mark a setting dirty, and schedule the write on the settings work queue
  */
-int ztacx_setting_set(struct ztacx_variable *s, const char *value)
+static void ztacx_setting_dirty(struct ztacx_setting_state *st)
+{
+	int64_t now = k_uptime_get();
+	int64_t delay;
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&ztacx_settings_dirty_lock);
+	st->flags |= ZTACX_SETTING_DIRTY;
+	ztacx_settings_stats.changes++;
+	if (!ztacx_settings_dirty_since) {
+		ztacx_settings_dirty_since = now;
+	}
+	delay = CLAMP(ztacx_settings_dirty_since + CONFIG_ZTACX_SETTINGS_FLUSH_MAX_MS - now,
+		      0, CONFIG_ZTACX_SETTINGS_FLUSH_DELAY_MS);
+	k_spin_unlock(&ztacx_settings_dirty_lock, key);
+
+	if (!ztacx_settings_workq_started) {
+		// the start phase schedules the flush
+		return;
+	}
+	k_work_reschedule_for_queue(&ztacx_settings_workq, &ztacx_settings_flush_work, K_MSEC(delay));
+}
+
+/**
+ * @brief Note that a setting has changed and should be written to flash
+ *
+ * Returns at once, from any context.  The write is done on the
+ * settings work queue, never in the caller's thread (eg Bluetooth RX).
+ * It is deferred (see CONFIG_ZTACX_SETTINGS_FLUSH_DELAY_MS) so that a
+ * run of changes costs one write; with a delay of 0 it is queued at
+ * once.  Use @ref ztacx_settings_commit_async to learn the result.
+ *
+ * @return -ENOENT if the variable is not a setting
+ */
+int ztacx_setting_mark_dirty(struct ztacx_variable *s)
 {
+	struct ztacx_setting_state *st;
+
 	if (!s) {
 		return -EINVAL;
 	}
-	int err;
-	char key[64];
-	snprintf(key, sizeof(key), "app/%s", s->name);
+	st = ztacx_setting_state(s);
+	if (!st) {
+		// eg a typed handle to a state variable
+		return -ENOENT;
+	}
+	ztacx_setting_dirty(st);
+	return 0;
+}
 
-	err = ztacx_variable_value_set_string(s, value);
-	if (err != 0) {
-		return err;
+/**
+ * @brief True if a change to a setting is waiting to be written
+ */
+bool ztacx_setting_is_dirty(const struct ztacx_variable *s)
+{
+	struct ztacx_setting_state *st = s ? ztacx_setting_state(s) : NULL;
+
+	return st && (st->flags & ZTACX_SETTING_DIRTY);
+}
+
+/**
+ * @brief Note that flash holds the current value of a setting
+ *
+ * For values restored from a copy of what was written (eg the retained
+ * image), so that writing them back is skipped.
+ *
+ * @return -ENOENT if the variable is not a setting
+ */
+int ztacx_setting_mark_saved(struct ztacx_variable *s)
+{
+	char value[ZTACX_SETTING_VALUE_MAX] __aligned(8);
+	struct ztacx_setting_state *st;
+	int len;
+
+	if (!s) {
+		return -EINVAL;
+	}
+	st = ztacx_setting_state(s);
+	if (!st) {
+		return -ENOENT;
+	}
+	len = ztacx_setting_value_read(s, value, sizeof(value));
+	if (len < 0) {
+		return len;
 	}
+	st->saved_crc = crc32_ieee((const uint8_t *)value, len);
+	ztacx_setting_flags_update(st, ZTACX_SETTING_SAVED, ZTACX_SETTING_DIRTY);
+	return 0;
+}
 
-	switch (s->kind) {
-	case ZTACX_VALUE_STRING:
-		err = settings_save_one(key, (const void *)s->value.val_string, strlen(s->value.val_string));
-		break;
-	case ZTACX_VALUE_BOOL:
-		err = settings_save_one(key, (const void *)&s->value.val_bool, sizeof(s->value.val_bool));
-		break;
-	case ZTACX_VALUE_BYTE:
-		err = settings_save_one(key, (const void *)&s->value.val_byte, sizeof(s->value.val_byte));
-		break;
-	case ZTACX_VALUE_UINT16:
-		err = settings_save_one(key, (const void *)&s->value.val_uint16, sizeof(s->value.val_uint16));
-		break;
-	case ZTACX_VALUE_INT16:
-		err = settings_save_one(key, (const void *)&s->value.val_int16, sizeof(s->value.val_int16));
-		break;
-	case ZTACX_VALUE_INT32:
-		err = settings_save_one(key, (const void *)&s->value.val_int32, sizeof(s->value.val_int32));
-		break;
-	case ZTACX_VALUE_INT64:
-		err = settings_save_one(key, (const void *)&s->value.val_int64, sizeof(s->value.val_int64));
-		break;
-	default:
-		LOG_ERR("Unhandled setting type %d", (int)s->kind);
+/**
+ * @brief Request that changed settings be written to flash now
+ *
+ * Returns at once.  The optional callback is called from the settings
+ * work queue with the result once the write is complete.
+ *
+ * @return 0 if the request was queued, -EBUSY if the request queue is full
+ */
+int ztacx_settings_commit_async(ztacx_settings_done_cb_t cb, void *user_data)
+{
+	struct ztacx_settings_request req = {.cb=cb, .user_data=user_data, .queued=k_cycle_get_32()};
+	k_spinlock_key_t key;
+	int rc;
+
+	if (!ztacx_settings_workq_started) {
+		return -EAGAIN;
+	}
+	rc = k_msgq_put(&ztacx_settings_requests, &req, K_NO_WAIT);
+	key = k_spin_lock(&ztacx_settings_dirty_lock);
+	if (rc != 0) {
+		ztacx_settings_stats.rejected++;
+	}
+	else {
+		ztacx_settings_stats.requests++;
+		ztacx_settings_stats.queue_max = MAX(ztacx_settings_stats.queue_max,
+						     k_msgq_num_used_get(&ztacx_settings_requests));
+	}
+	k_spin_unlock(&ztacx_settings_dirty_lock, key);
+	if (rc != 0) {
+		return -EBUSY;
+	}
+	k_work_submit_to_queue(&ztacx_settings_workq, &ztacx_settings_commit_work);
+	return 0;
+}
+
+/**
+ * @brief Write any changed settings to flash, waiting for the write
+ *
+ * For use before sleep or reset; other callers should use
+ * @ref ztacx_settings_commit_async.
+ */
+int ztacx_settings_commit(void)
+{
+	k_work_cancel_delayable(&ztacx_settings_flush_work);
+	return ztacx_settings_flush();
+}
+
+int ztacx_settings_pre_sleep(struct ztacx_leaf *leaf)
+{
+	return ztacx_settings_commit();
+}
+
+/**
+ * Store a value (from string) into a ztacx_setting
+ */
+int ztacx_setting_set(struct ztacx_variable *s, const char *value)
+{
+	if (!s) {
 		return -EINVAL;
 	}
+	int err = ztacx_variable_value_set_string(s, value);
 	if (err != 0) {
-		LOG_ERR("Settings save failed: %d", err);
+		return err;
 	}
-	char desc[132];
-	ztacx_variable_describe(desc,sizeof(desc), s);
-	LOG_INF("Saved %s", desc);
-	return err;
+	return ztacx_setting_mark_dirty(s);
 }
 
 void ztacx_settings_show()
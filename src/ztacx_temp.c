@@ -25,7 +25,7 @@ enum temp_setting_index {
 
 static struct ztacx_variable temp_settings[] = {
 	{"temp_read_interval_msec", ZTACX_VALUE_INT32,{.val_int32=1000}},
-	{"temp_centidegree_change_threshold", ZTACX_VALUE_UINT16,{.val_int16 = 50}},
+	{"temp_centidegree_change_threshold", ZTACX_VALUE_UINT16,{.val_uint16 = 50}},
 };
 
 enum temp_value_index {
@@ -33,15 +33,22 @@ enum temp_value_index {
 	VALUE_CENTIDEGREE,
 	VALUE_NOTIFY,
 };
-static struct ztacx_variable temp_values[]={
+static ZTACX_VARIABLES_DEFINE(temp_values) = {
 	{"temp_ok", ZTACX_VALUE_BOOL, {.val_bool=false}},
 	{"temp_centidegree", ZTACX_VALUE_INT16, {.val_int16=0}},
 	{"temp_notify", ZTACX_VALUE_BOOL, {.val_bool=false}},
 };
 
-static struct k_work_delayable temp_work;
+static struct ztacx_leaf_work temp_work;
+static struct ztacx_publish temp_publish;
 
 void temp_read(struct k_work *work);
+
+static void temp_schedule(void)
+{
+	uint32_t period_ms = MAX(temp_settings[SETTING_READ_INTERVAL_MSEC].value.val_int32, 0);
+	ztacx_leaf_work_set_period(&temp_work, period_ms, ZTACX_PERIODIC_SLACK(period_ms));
+}
 int cmd_ztacx_temp(const struct shell *shell, size_t argc, char **argv);
 
 int ztacx_temp_init(struct ztacx_leaf *leaf)
@@ -67,8 +74,7 @@ int ztacx_temp_init(struct ztacx_leaf *leaf)
 	else {
 		LOG_INF("temp device is %p, name is %s", temp_dev, temp_dev->name);
 	}
-	ztacx_settings_register(temp_settings, ARRAY_SIZE(temp_settings));
-	ztacx_variables_register(temp_values, ARRAY_SIZE(temp_values));
+	ztacx_settings_register_leaf(leaf, temp_settings, ARRAY_SIZE(temp_settings));
 
 #if CONFIG_SHELL
 	ztacx_shell_cmd_register(((struct shell_static_entry){
@@ -87,8 +93,8 @@ int ztacx_temp_start(struct ztacx_leaf *leaf)
 {
 	LOG_DBG("");
 
-	k_work_init_delayable(&temp_work, temp_read);
-	k_work_schedule(&temp_work, K_NO_WAIT);
+	ztacx_leaf_work_init(leaf, &temp_work, temp_read);
+	temp_schedule();
 
 	return 0;
 }
@@ -144,24 +150,16 @@ void temp_read(struct k_work *work)
 #endif
 	int val = temperature * 100;
 
-	int delta = abs(val - temp_values[VALUE_CENTIDEGREE].value.val_int16);
-
-	int threshold = temp_settings[SETTING_CENTIDEGREE_CHANGE_THRESHOLD].value.val_int16;
-	static bool first_reading = true;
-	bool significant_change = !first_reading && (delta >= threshold);
-	LOG_DBG("   temp reading val=%d delta=%d (threshold=%d)", val, delta, threshold);
-
-	if (first_reading || significant_change) {
-		first_reading = false;
+	temp_publish.deadband = temp_settings[SETTING_CENTIDEGREE_CHANGE_THRESHOLD].value.val_uint16;
+	LOG_DBG("   temp reading val=%d (threshold=%d)", val, (int)temp_publish.deadband);
 
-		ztacx_variable_value_set(&(temp_values[VALUE_CENTIDEGREE]), &val);
+	if (ztacx_variable_publish(&(temp_values[VALUE_CENTIDEGREE]), &temp_publish, val) > 0) {
 		LOG_INF("temperature ~ %d cC", (int)val);
 	}
 
 	if (work){
-		int job_msec = temp_settings[SETTING_READ_INTERVAL_MSEC].value.val_int32;
-		//LOG_DBG("Next temp read in %d ms", job_msec);
-		k_work_reschedule(&temp_work, K_MSEC(job_msec));
+		// follow any change to the read interval
+		temp_schedule();
 	}
 
 	return;
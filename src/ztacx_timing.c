@@ -0,0 +1,151 @@
+#include "ztacx.h"
+
+#include <zephyr/linker/section_tags.h>
+
+/*
+ * Boot timing table
+ *
+ * Each lifecycle phase claims a record, stamped with the cycle counter
+ * when it begins and ends.  The table lives in RAM that is not cleared
+ * at reset, so that if a boot hangs and is reset by the watchdog the
+ * next boot can report how far the previous one got.
+ */
+
+#define ZTACX_TIMING_MAGIC 0x7A74696DU
+#define ZTACX_TIMING_NAME_MAX 20
+
+#ifdef CONFIG_APP_BUILD_NUMBER
+#define ZTACX_TIMING_BUILD CONFIG_APP_BUILD_NUMBER
+#else
+#define ZTACX_TIMING_BUILD 0
+#endif
+
+struct ztacx_timing_record
+{
+	char name[ZTACX_TIMING_NAME_MAX];
+	uint8_t phase;
+	bool done;
+	int16_t rc;
+	uint32_t start;
+	uint32_t cycles;
+};
+
+struct ztacx_timing_table
+{
+	uint32_t magic;
+	uint32_t build;
+	atomic_t count;
+	struct ztacx_timing_record record[CONFIG_ZTACX_BOOT_TIMING_RECORDS];
+};
+
+static __noinit struct ztacx_timing_table ztacx_timing;
+
+static const char *ztacx_timing_phase_names[ZTACX_TIMING_PHASE_MAX] = {
+	"framework",
+	"class",
+	"init",
+	"start",
+	"settings",
+	"restore",
+	"app_init",
+	"app_start",
+};
+
+/**
+ * @brief Start a new timing table, reporting on the table left by the previous boot
+ */
+void ztacx_timing_reset(void)
+{
+	if ((ztacx_timing.magic == ZTACX_TIMING_MAGIC) &&
+	    (atomic_get(&ztacx_timing.count) <= CONFIG_ZTACX_BOOT_TIMING_RECORDS)) {
+		int count = atomic_get(&ztacx_timing.count);
+
+		for (int i=0; i<count; i++) {
+			struct ztacx_timing_record *r = &ztacx_timing.record[i];
+			if (!r->done && (r->phase < ZTACX_TIMING_PHASE_MAX)) {
+				LOG_WRN("Previous boot (build %u) did not complete %s %s",
+					ztacx_timing.build, ztacx_timing_phase_names[r->phase], r->name);
+			}
+		}
+	}
+
+	memset(&ztacx_timing, 0, sizeof(ztacx_timing));
+	ztacx_timing.build = ZTACX_TIMING_BUILD;
+	ztacx_timing.magic = ZTACX_TIMING_MAGIC;
+}
+
+/**
+ * @brief Record the beginning of a lifecycle phase
+ *
+ * @return a slot to pass to @ref ztacx_timing_end, or -ENOSPC if the table is full
+ */
+int ztacx_timing_begin(enum ztacx_timing_phase phase, const char *name)
+{
+	int slot;
+
+	if (ztacx_timing.magic != ZTACX_TIMING_MAGIC) {
+		return -ENODEV;
+	}
+	slot = atomic_inc(&ztacx_timing.count);
+	if (slot >= CONFIG_ZTACX_BOOT_TIMING_RECORDS) {
+		atomic_dec(&ztacx_timing.count);
+		return -ENOSPC;
+	}
+
+	struct ztacx_timing_record *r = &ztacx_timing.record[slot];
+	strncpy(r->name, name, sizeof(r->name)-1);
+	r->phase = phase;
+	r->start = k_cycle_get_32();
+	return slot;
+}
+
+void ztacx_timing_end(int slot, int rc)
+{
+	if ((slot < 0) || (slot >= CONFIG_ZTACX_BOOT_TIMING_RECORDS)) {
+		return;
+	}
+	struct ztacx_timing_record *r = &ztacx_timing.record[slot];
+	r->cycles = k_cycle_get_32() - r->start;
+	r->rc = CLAMP(rc, INT16_MIN, INT16_MAX);
+	r->done = true;
+}
+
+#if CONFIG_SHELL
+/**
+ * @brief Print the boot timing table
+ *
+ * The raw form is one comma-separated record per line, prefixed
+ * "timing," for easy extraction from a console log:
+ * build,phase,name,start_us,duration_us,rc
+ */
+void ztacx_timing_show(const struct shell *shell, bool raw)
+{
+	int count = MIN(atomic_get(&ztacx_timing.count), CONFIG_ZTACX_BOOT_TIMING_RECORDS);
+
+	if (!raw) {
+		shell_print(shell, "Boot timing (build %u), %d records:", ztacx_timing.build, count);
+		shell_print(shell, "%-10s %-20s %10s %10s %s", "phase", "name", "start_us", "dur_us", "rc");
+	}
+	for (int i=0; i<count; i++) {
+		struct ztacx_timing_record *r = &ztacx_timing.record[i];
+		uint32_t start_us = k_cyc_to_us_floor32(r->start);
+		uint32_t dur_us = k_cyc_to_us_floor32(r->cycles);
+
+		if (raw) {
+			shell_print(shell, "timing,%u,%s,%s,%u,%u,%d", ztacx_timing.build,
+				    ztacx_timing_phase_names[r->phase], r->name,
+				    start_us, r->done?dur_us:0, (int)r->rc);
+		}
+		else if (r->done) {
+			shell_print(shell, "%-10s %-20s %10u %10u %d",
+				    ztacx_timing_phase_names[r->phase], r->name,
+				    start_us, dur_us, (int)r->rc);
+		}
+		else {
+			shell_print(shell, "%-10s %-20s %10u %10s",
+				    ztacx_timing_phase_names[r->phase], r->name,
+				    start_us, "running");
+		}
+	}
+}
+#endif
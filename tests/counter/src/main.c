@@ -0,0 +1,336 @@
+/*
+ * ztacx counter journal tests
+ *
+ * A reset is simulated by forgetting the journal state and clearing the
+ * counters in RAM, then attaching them again, as leaf init would.  The
+ * journal format is read and torn directly through the flash area.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#define __main__
+#include "ztacx.h"
+
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/ztest.h>
+
+#define JOURNAL_MAGIC 0x7A636E74U
+#define JOURNAL_HEADER_SIZE 16
+#define JOURNAL_RECORD_SIZE 16
+#define JOURNAL_SECTOR_SIZE CONFIG_ZTACX_COUNTER_SECTOR_SIZE
+
+static ZTACX_VARIABLES_DEFINE(counter_values) = {
+	{"ctr_samples", ZTACX_VALUE_INT64, {.val_int64=0}},
+	{"ctr_boots", ZTACX_VALUE_INT32, {.val_int32=0}},
+	// two names with the same 32-bit FNV-1a hash
+	{"costarring", ZTACX_VALUE_INT32, {.val_int32=0}},
+	{"liquid", ZTACX_VALUE_INT32, {.val_int32=0}},
+};
+
+#define SAMPLES (&counter_values[0])
+#define BOOTS (&counter_values[1])
+#define COLLIDE_A (&counter_values[2])
+#define COLLIDE_B (&counter_values[3])
+
+static const struct flash_area *journal_fa;
+static uint32_t journal_sectors;
+
+struct journal_state
+{
+	uint32_t sector;
+	uint32_t seq;
+	uint32_t tail;
+};
+
+static bool journal_header(uint32_t sector, uint32_t *seq_r)
+{
+	uint8_t header[JOURNAL_HEADER_SIZE];
+
+	if (flash_area_read(journal_fa, sector * JOURNAL_SECTOR_SIZE, header, sizeof(header)) != 0) {
+		return false;
+	}
+	*seq_r = sys_get_le32(header+4);
+	return (sys_get_le32(header) == JOURNAL_MAGIC) &&
+		(sys_get_le32(header+8) == crc32_ieee(header, 8));
+}
+
+/* Find the active sector, and the first free record slot in it */
+static bool journal_active(struct journal_state *st)
+{
+	uint8_t rec[JOURNAL_RECORD_SIZE];
+	bool found = false;
+
+	for (uint32_t s=0; s<journal_sectors; s++) {
+		uint32_t seq;
+
+		if (journal_header(s, &seq) && (!found || ((int32_t)(seq - st->seq) > 0))) {
+			st->sector = s;
+			st->seq = seq;
+			found = true;
+		}
+	}
+	if (!found) {
+		return false;
+	}
+	for (st->tail = JOURNAL_HEADER_SIZE; st->tail < JOURNAL_SECTOR_SIZE; st->tail += JOURNAL_RECORD_SIZE) {
+		if ((flash_area_read(journal_fa, st->sector * JOURNAL_SECTOR_SIZE + st->tail,
+				     rec, sizeof(rec)) != 0) ||
+		    (sys_get_le32(rec) == 0xFFFFFFFFU)) {
+			break;
+		}
+	}
+	return true;
+}
+
+static void journal_record(uint8_t *rec, const struct ztacx_variable *v, int64_t value)
+{
+	sys_put_le32(v->hash, rec);
+	sys_put_le64((uint64_t)value, rec+4);
+	sys_put_le32(crc32_ieee(rec, 12), rec+12);
+}
+
+/* Attach the counters, as leaf init does at boot */
+static void counter_boot(void)
+{
+	zassert_ok(ztacx_counter_attach(SAMPLES));
+	zassert_ok(ztacx_counter_attach_mode(BOOTS, ZTACX_COUNTER_EXACT));
+}
+
+/* Lose everything in RAM, then boot */
+static void counter_reset(void)
+{
+	ztacx_counter_reset();
+	ztacx_variable_value_set_int64(SAMPLES, 0);
+	ztacx_variable_value_set_int32(BOOTS, 0);
+	counter_boot();
+}
+
+static void counter_add(int64_t n)
+{
+	for (int64_t i=0; i<n; i++) {
+		ztacx_variable_value_inc_int64(SAMPLES);
+	}
+}
+
+static void *counter_setup(void)
+{
+	zassert_ok(flash_area_open(FLASH_AREA_ID(counter_storage), &journal_fa));
+	journal_sectors = journal_fa->fa_size / JOURNAL_SECTOR_SIZE;
+	return NULL;
+}
+
+/* Every test starts from an erased partition and zeroed counters */
+static void counter_before(void *fixture)
+{
+	ztacx_counter_reset();
+	zassert_ok(flash_area_erase(journal_fa, 0, journal_fa->fa_size));
+	ztacx_variable_value_set_int64(SAMPLES, 0);
+	ztacx_variable_value_set_int32(BOOTS, 0);
+	counter_boot();
+}
+
+ZTEST(counter, test_fresh_partition)
+{
+	struct journal_state st;
+
+	zassert_false(journal_active(&st), "an erased partition has a journal");
+	zassert_equal(ztacx_variable_value_get_int64(SAMPLES), 0);
+	zassert_ok(ztacx_counter_checkpoint(), "checkpoint with nothing changed");
+	zassert_false(journal_active(&st), "an unchanged checkpoint wrote to flash");
+
+	counter_add(1000);
+	zassert_ok(ztacx_counter_checkpoint());
+	zassert_true(journal_active(&st));
+	zassert_equal(st.sector, 0, "the first sector is not used first");
+
+	counter_reset();
+	zassert_equal(ztacx_variable_value_get_int64(SAMPLES), 1000);
+}
+
+/*
+ * A checkpoint counter loses exactly its increments since it was last
+ * written (by a checkpoint, or with an exact counter's increment); an
+ * exact counter loses none
+ */
+ZTEST(counter, test_loss_bound)
+{
+	counter_add(500);
+	zassert_ok(ztacx_counter_checkpoint());
+	zassert_ok(ztacx_counter_increment(BOOTS, 1));
+	zassert_ok(ztacx_counter_increment(BOOTS, 1));
+	zassert_ok(ztacx_counter_increment(BOOTS, 1));
+	counter_add(200);
+
+	counter_reset();
+	zassert_equal(ztacx_variable_value_get_int64(SAMPLES), 500);
+	zassert_equal(ztacx_variable_value_get_int32(BOOTS), 3);
+
+	// and carries on from there
+	counter_add(1);
+	zassert_ok(ztacx_counter_increment(BOOTS, 1));
+	zassert_ok(ztacx_counter_checkpoint());
+	counter_reset();
+	zassert_equal(ztacx_variable_value_get_int64(SAMPLES), 501);
+	zassert_equal(ztacx_variable_value_get_int32(BOOTS), 4);
+}
+
+/*
+ * A record torn by a reset part way through programming (half written,
+ * or fully written with bits not yet settled) is skipped, and the last
+ * good record wins.  Later records go after it.
+ */
+ZTEST(counter, test_torn_record)
+{
+	struct journal_state st;
+	uint8_t rec[JOURNAL_RECORD_SIZE];
+
+	counter_add(100);
+	zassert_ok(ztacx_counter_checkpoint());
+
+	zassert_true(journal_active(&st));
+	journal_record(rec, SAMPLES, 999);
+	zassert_ok(flash_area_write(journal_fa, st.sector * JOURNAL_SECTOR_SIZE + st.tail, rec, 8));
+	counter_reset();
+	zassert_equal(ztacx_variable_value_get_int64(SAMPLES), 100, "a half written record was used");
+
+	zassert_true(journal_active(&st));
+	journal_record(rec, SAMPLES, 999);
+	rec[12] ^= 0x01;
+	zassert_ok(flash_area_write(journal_fa, st.sector * JOURNAL_SECTOR_SIZE + st.tail, rec, sizeof(rec)));
+	counter_reset();
+	zassert_equal(ztacx_variable_value_get_int64(SAMPLES), 100, "a record with a bad CRC was used");
+
+	counter_add(5);
+	zassert_ok(ztacx_counter_checkpoint());
+	counter_reset();
+	zassert_equal(ztacx_variable_value_get_int64(SAMPLES), 105, "a record after a torn one was lost");
+}
+
+/*
+ * A rotation is complete only once the new sector's header is written;
+ * a reset before that leaves the old sector active, and the half
+ * written sector is erased again by the next rotation.
+ */
+ZTEST(counter, test_interrupted_rotation)
+{
+	struct journal_state st;
+	uint8_t rec[JOURNAL_RECORD_SIZE];
+	uint8_t header[JOURNAL_HEADER_SIZE];
+	uint32_t next;
+
+	counter_add(10);
+	zassert_ok(ztacx_counter_checkpoint());
+	zassert_true(journal_active(&st));
+	next = (st.sector + 1) % journal_sectors;
+
+	// records copied, reset before the header
+	zassert_ok(flash_area_erase(journal_fa, next * JOURNAL_SECTOR_SIZE, JOURNAL_SECTOR_SIZE));
+	journal_record(rec, SAMPLES, 777);
+	zassert_ok(flash_area_write(journal_fa, next * JOURNAL_SECTOR_SIZE + JOURNAL_HEADER_SIZE,
+				    rec, sizeof(rec)));
+	counter_reset();
+	zassert_equal(ztacx_variable_value_get_int64(SAMPLES), 10);
+
+	// header torn part way
+	memset(header, 0xFF, sizeof(header));
+	sys_put_le32(JOURNAL_MAGIC, header);
+	sys_put_le32(st.seq + 1, header+4);
+	zassert_ok(flash_area_write(journal_fa, next * JOURNAL_SECTOR_SIZE, header, 8));
+	counter_reset();
+	zassert_equal(ztacx_variable_value_get_int64(SAMPLES), 10);
+	zassert_true(journal_active(&st));
+	zassert_not_equal(st.sector, next, "a sector with a torn header became active");
+
+	// fill the old sector so that the next checkpoint rotates into the torn one
+	while (st.tail + JOURNAL_RECORD_SIZE <= JOURNAL_SECTOR_SIZE) {
+		counter_add(1);
+		zassert_ok(ztacx_counter_checkpoint());
+		zassert_true(journal_active(&st));
+	}
+	counter_add(1);
+	zassert_ok(ztacx_counter_checkpoint());
+	zassert_true(journal_active(&st));
+	zassert_equal(st.sector, next, "did not rotate into the torn sector");
+
+	int64_t expected = ztacx_variable_value_get_int64(SAMPLES);
+
+	counter_reset();
+	zassert_equal(ztacx_variable_value_get_int64(SAMPLES), expected);
+}
+
+/*
+ * Many checkpoints wrap the journal round the partition several times;
+ * every sector must be erased in turn, and values survive a reset at
+ * any point.  Prints the flash cost as throughput and endurance.
+ */
+ZTEST(counter, test_rotation_endurance)
+{
+	const int checkpoints = 2000;
+	struct journal_state st;
+	uint32_t seq_min = UINT32_MAX;
+	uint32_t seq_max = 0;
+	uint32_t start = k_uptime_get_32();
+	uint32_t ms;
+
+	for (int i=1; i<=checkpoints; i++) {
+		counter_add(i % 50 + 1);
+		if (i % 10 == 0) {
+			zassert_ok(ztacx_counter_increment(BOOTS, 1));
+		}
+		zassert_ok(ztacx_counter_checkpoint());
+		if (i % 97 == 0) {
+			int64_t samples = ztacx_variable_value_get_int64(SAMPLES);
+			int32_t boots = ztacx_variable_value_get_int32(BOOTS);
+
+			counter_reset();
+			zassert_equal(ztacx_variable_value_get_int64(SAMPLES), samples, "checkpoint %d", i);
+			zassert_equal(ztacx_variable_value_get_int32(BOOTS), boots, "checkpoint %d", i);
+		}
+	}
+	ms = k_uptime_get_32() - start;
+
+	zassert_true(journal_active(&st));
+	for (uint32_t s=0; s<journal_sectors; s++) {
+		uint32_t seq;
+
+		zassert_true(journal_header(s, &seq), "sector %u was never used", s);
+		seq_min = MIN(seq_min, seq);
+		seq_max = MAX(seq_max, seq);
+	}
+	// the sectors hold the last few rotations, one each
+	zassert_equal(seq_max - seq_min, journal_sectors - 1, "sectors were not used in turn");
+	zassert_equal(seq_max, st.seq);
+
+	TC_PRINT("%d checkpoints (%lld increments) in %u ms of flash time: %u rotations, "
+		 "%u.%02u erases per sector\n",
+		 checkpoints, ztacx_variable_value_get_int64(SAMPLES), ms, st.seq,
+		 st.seq / journal_sectors, (st.seq * 100 / journal_sectors) % 100);
+	TC_PRINT("at one checkpoint a minute, a 10000 cycle sector lasts %u days\n",
+		 (uint32_t)((uint64_t)10000 * journal_sectors * checkpoints / st.seq / (24 * 60)));
+}
+
+/*
+ * Counters are journalled by name hash alone, so a second counter with
+ * the hash of an attached one is refused, and leaves the first intact
+ */
+ZTEST(counter, test_hash_collision)
+{
+	zassert_equal(COLLIDE_A->hash, COLLIDE_B->hash, "the names do not collide");
+	zassert_ok(ztacx_counter_attach(COLLIDE_A));
+	zassert_ok(ztacx_counter_attach(COLLIDE_A), "attaching again is refused");
+	zassert_equal(ztacx_counter_attach(COLLIDE_B), -EEXIST);
+
+	zassert_ok(ztacx_counter_increment(COLLIDE_A, 7));
+	zassert_ok(ztacx_counter_increment(COLLIDE_B, 3));
+	zassert_ok(ztacx_counter_checkpoint());
+	ztacx_counter_reset();
+	ztacx_variable_value_set_int32(COLLIDE_A, 0);
+	ztacx_variable_value_set_int32(COLLIDE_B, 0);
+	counter_boot();
+	zassert_ok(ztacx_counter_attach(COLLIDE_A));
+	zassert_equal(ztacx_variable_value_get_int32(COLLIDE_A), 7);
+	zassert_equal(ztacx_variable_value_get_int32(COLLIDE_B), 0);
+}
+
+ZTEST_SUITE(counter, NULL, counter_setup, counter_before, NULL, NULL);
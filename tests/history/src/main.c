@@ -0,0 +1,207 @@
+/*
+ * ztacx history tests
+ *
+ * One simulated hour of 1 Hz samples of signals shaped like our
+ * sensors, comparing the memory per stored sample with a plain array,
+ * and the window summaries with a scan of the raw samples.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#define __main__
+#include "ztacx.h"
+
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/ztest.h>
+
+#define HIST_INTERVAL_MS 1000
+#define HIST_SAMPLES 3600
+#define HIST_SIGNALS 4
+
+/* Block header size, as documented for CONFIG_ZTACX_HISTORY_BLOCK_BYTES */
+#define HIST_BLOCK_RAM (CONFIG_ZTACX_HISTORY_BLOCK_BYTES + 32)
+
+static ZTACX_VARIABLES_DEFINE(hist_values) = {
+	{"hist_battery_mv", ZTACX_VALUE_UINT16, {.val_uint16=0}},
+	{"hist_temp_cdeg", ZTACX_VALUE_INT16, {.val_int16=0}},
+	{"hist_level_mm", ZTACX_VALUE_INT32, {.val_int32=0}},
+	{"hist_random", ZTACX_VALUE_INT32, {.val_int32=0}},
+};
+
+static uint32_t hist_lcg = 12345;
+
+static int32_t hist_random(int32_t range)
+{
+	hist_lcg = hist_lcg * 1103515245U + 12345U;
+	return (int32_t)((hist_lcg >> 8) % (2 * range + 1)) - range;
+}
+
+/* The value of each signal at sample i */
+static int32_t hist_signal(int s, int i)
+{
+	switch (s) {
+	case 0:
+		// battery: flat, falling a millivolt every few minutes
+		return 3700 - i / 300;
+	case 1:
+		// temperature: a slow triangle wave, with sensor noise
+		return 2000 + abs((i % 1200) - 600) + hist_random(3);
+	case 2:
+		// tank level: noisy, within the documented 8192 delta
+		return 50000 + hist_random(4000);
+	default:
+		// worst case, deltas outside the documented bound
+		return hist_random(1000000);
+	}
+}
+
+struct hist_scan
+{
+	int count;
+	int32_t min;
+	int32_t max;
+	int64_t sum;
+};
+
+static void hist_scan_sample(uint32_t timestamp_ms, int32_t value, void *arg)
+{
+	struct hist_scan *scan = arg;
+
+	if (scan->count == 0) {
+		scan->min = value;
+		scan->max = value;
+	}
+	scan->count++;
+	scan->min = MIN(scan->min, value);
+	scan->max = MAX(scan->max, value);
+	scan->sum += value;
+}
+
+/* A window summary must match a scan of the raw samples in the window */
+static void hist_check_window(struct ztacx_history *h, uint32_t window_ms)
+{
+	struct ztacx_history_summary summary;
+	struct hist_scan scan = {0};
+
+	zassert_ok(ztacx_history_window(h, window_ms, &summary));
+	zassert_ok(ztacx_history_foreach(h, window_ms, hist_scan_sample, &scan));
+	zassert_equal(summary.count, scan.count, "window %u count", window_ms);
+	zassert_equal(summary.min, scan.min, "window %u min", window_ms);
+	zassert_equal(summary.max, scan.max, "window %u max", window_ms);
+	zassert_equal(summary.mean, (int32_t)(scan.sum / scan.count), "window %u mean", window_ms);
+}
+
+ZTEST(history, test_memory_per_sample)
+{
+	static uint8_t frame[16384];
+	struct ztacx_history *h[HIST_SIGNALS];
+
+	for (int s=0; s<HIST_SIGNALS; s++) {
+		h[s] = ztacx_history_attach(&hist_values[s], HIST_INTERVAL_MS, HIST_SAMPLES);
+		zassert_not_null(h[s]);
+	}
+
+	for (int i=0; i<HIST_SAMPLES; i++) {
+		ztacx_variable_value_set_uint16(&hist_values[0], hist_signal(0, i));
+		ztacx_variable_value_set_int16(&hist_values[1], hist_signal(1, i));
+		ztacx_variable_value_set_int32(&hist_values[2], hist_signal(2, i));
+		ztacx_variable_value_set_int32(&hist_values[3], hist_signal(3, i));
+		k_sleep(K_MSEC(HIST_INTERVAL_MS));
+	}
+
+	for (int s=0; s<HIST_SIGNALS; s++) {
+		struct ztacx_history_summary summary;
+		int len = ztacx_history_encode(h[s], frame, sizeof(frame));
+		int blocks;
+
+		zassert_true(len > 0, "encode failed (%d)", len);
+		blocks = sys_get_le16(frame + 10);
+		zassert_ok(ztacx_history_window(h[s], 0, &summary));
+		zassert_true(summary.count > 0);
+
+		TC_PRINT("%-16s %4d samples in %2d blocks: %d.%02d RAM bytes/sample, "
+			 "%d.%02d encoded (plain array 4, or 8 with timestamps)\n",
+			 hist_values[s].name, summary.count, blocks,
+			 blocks * HIST_BLOCK_RAM / summary.count,
+			 (blocks * HIST_BLOCK_RAM * 100 / summary.count) % 100,
+			 len / summary.count, (len * 100 / summary.count) % 100);
+
+		if (s < HIST_SIGNALS-1) {
+			// within the documented bound the whole hour is kept,
+			// in less than a plain array of values
+			zassert_true(summary.count >= HIST_SAMPLES - 1, "history lost samples");
+			zassert_true(blocks * HIST_BLOCK_RAM < summary.count * sizeof(int32_t),
+				     "history is larger than an array");
+		}
+
+		hist_check_window(h[s], 0);
+		hist_check_window(h[s], 10 * 60 * 1000);
+		hist_check_window(h[s], 7 * HIST_INTERVAL_MS / 2);
+	}
+}
+
+static bool hist_only(const struct ztacx_variable *v, void *arg)
+{
+	return v == arg;
+}
+
+/*
+ * A snapshot carries the history of a variable after its value, one
+ * record per block, holding the same blocks as the history frame
+ */
+ZTEST(history, test_snapshot_records)
+{
+	static uint8_t snapshot[16384];
+	static uint8_t frame[16384];
+	struct ztacx_variable *v = &hist_values[0];
+	struct ztacx_history *h = ztacx_history_attach(v, HIST_INTERVAL_MS, 60);
+	struct ztacx_history_summary summary;
+	int len;
+	int frame_len;
+	size_t pos;
+	size_t frame_pos = 12;
+	int records = 1;
+	int samples = 0;
+
+	zassert_not_null(h);
+	for (int i=0; i<30; i++) {
+		ztacx_variable_value_set_uint16(v, hist_signal(0, i));
+		k_sleep(K_MSEC(HIST_INTERVAL_MS));
+	}
+	// clear of the next sample, so that both encodings see the same blocks
+	k_sleep(K_MSEC(HIST_INTERVAL_MS / 2));
+
+	len = ztacx_variables_encode(snapshot, sizeof(snapshot), hist_only, v);
+	zassert_true(len > 0, "snapshot encode failed (%d)", len);
+	frame_len = ztacx_history_encode(h, frame, sizeof(frame));
+	zassert_true(frame_len > 0, "history encode failed (%d)", frame_len);
+	zassert_ok(ztacx_history_window(h, 0, &summary));
+
+	zassert_equal(snapshot[0], ZTACX_SNAPSHOT_MAGIC);
+	zassert_equal(snapshot[1], ZTACX_SNAPSHOT_VERSION);
+	pos = ZTACX_SNAPSHOT_HEADER_SIZE;
+	zassert_equal(sys_get_le32(snapshot+pos), v->hash);
+	zassert_equal(snapshot[pos+4], ZTACX_VALUE_UINT16, "the value does not come first");
+	pos += ZTACX_SNAPSHOT_RECORD_HEADER_SIZE + snapshot[pos+5];
+
+	while (pos < len) {
+		const uint8_t *rec = snapshot + pos;
+		const uint8_t *block = rec + ZTACX_SNAPSHOT_RECORD_HEADER_SIZE + 4;
+		size_t block_len = rec[5] - 4;
+
+		zassert_equal(sys_get_le32(rec), v->hash);
+		zassert_equal(rec[4], ZTACX_SNAPSHOT_KIND_HISTORY);
+		zassert_equal(sys_get_le32(rec + ZTACX_SNAPSHOT_RECORD_HEADER_SIZE), HIST_INTERVAL_MS);
+		zassert_true(frame_pos + block_len <= frame_len, "more blocks than the history frame");
+		zassert_mem_equal(block, frame + frame_pos, block_len, "block %d differs", records);
+		samples += sys_get_le16(block + 8);
+		frame_pos += block_len;
+		pos += ZTACX_SNAPSHOT_RECORD_HEADER_SIZE + rec[5];
+		records++;
+	}
+	zassert_equal(pos, len, "a record overruns the snapshot");
+	zassert_equal(frame_pos, frame_len, "fewer blocks than the history frame");
+	zassert_equal(sys_get_le16(snapshot+2), records);
+	zassert_equal(samples, summary.count);
+}
+
+ZTEST_SUITE(history, NULL, NULL, NULL, NULL, NULL);
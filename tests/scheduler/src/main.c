@@ -0,0 +1,163 @@
+/*
+ * ztacx periodic scheduler tests
+ *
+ * native_sim's clock only advances while the CPU is idle or busy
+ * waiting, so run times here are exact and the simulated hours take
+ * seconds.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#define __main__
+#include "ztacx.h"
+
+#include <zephyr/ztest.h>
+
+#define SCHED_RUNS_MAX 256
+
+struct sched_item
+{
+	struct ztacx_leaf_work lw;
+	int64_t start;
+	uint32_t busy_us;
+	uint32_t overrun_run;
+	uint32_t overrun_us;
+	uint32_t runs;
+	uint32_t off_grid;
+	int64_t max_late;
+	int64_t last_run;
+	int64_t run_ticks[SCHED_RUNS_MAX];
+};
+
+/*
+ * Record each run against the item's grid of deadlines (start + n *
+ * period), then spend busy_us (or overrun_us on run overrun_run) as if
+ * reading a sensor.
+ */
+static void sched_item_run(struct k_work *work)
+{
+	struct sched_item *item = CONTAINER_OF(ztacx_leaf_work_get(work), struct sched_item, lw);
+	int64_t now = k_uptime_ticks();
+	int64_t late = (now - item->start) % item->lw.period_ticks;
+
+	if (item->runs < SCHED_RUNS_MAX) {
+		item->run_ticks[item->runs] = now;
+	}
+	if (late > item->lw.slack_ticks) {
+		item->off_grid++;
+	}
+	else {
+		item->max_late = MAX(item->max_late, late);
+	}
+	item->last_run = now;
+	item->runs++;
+
+	if (item->overrun_run && (item->runs == item->overrun_run)) {
+		k_busy_wait(item->overrun_us);
+	}
+	else if (item->busy_us) {
+		k_busy_wait(item->busy_us);
+	}
+}
+
+static void sched_item_start(struct sched_item *item, const char *name, uint32_t period_ms, uint32_t slack_ms)
+{
+	ztacx_leaf_work_init_named(NULL, &item->lw, sched_item_run, name);
+	item->start = k_uptime_ticks();
+	zassert_ok(ztacx_leaf_work_set_period(&item->lw, period_ms, slack_ms));
+}
+
+/*
+ * A 1 s item whose handler takes 30 ms, run for two simulated hours,
+ * must still run on its original grid, and an overrun of 2.5 periods
+ * must cost one late run and one skipped period, not a shifted grid.
+ */
+ZTEST(scheduler, test_no_drift)
+{
+	static struct sched_item item;
+	const uint32_t seconds = 2 * 3600;
+
+	item = (struct sched_item){
+		.busy_us = 30000,
+		.overrun_run = 100,
+		.overrun_us = 2500000,
+	};
+	sched_item_start(&item, "drift", 1000, 0);
+
+	// wake mid period, after the last run has finished
+	k_sleep(K_MSEC(seconds * 1000U + 500));
+	ztacx_leaf_work_cancel(&item.lw);
+
+	TC_PRINT("%u runs over %u s, last run %lld ticks from the grid, %u off the grid\n",
+		 item.runs, seconds,
+		 item.last_run - (item.start + (int64_t)seconds * item.lw.period_ticks),
+		 item.off_grid);
+	zassert_equal(item.last_run, item.start + (int64_t)seconds * k_ms_to_ticks_ceil32(1000),
+		      "cumulative drift");
+	zassert_equal(item.max_late, 0, "an on time run was late");
+	zassert_equal(item.off_grid, 1, "only the run delayed by the overrun may be off the grid");
+	// runs at 0..seconds, less one period swallowed by the overrun
+	zassert_equal(item.runs, seconds, "runs were lost or duplicated");
+}
+
+/*
+ * Run two 100 ms items 10 ms apart for 10 s, and count the distinct
+ * instants at which either ran.
+ */
+static void sched_pair(uint32_t slack_ms, uint32_t *runs_r, uint32_t *instants_r)
+{
+	static struct sched_item a;
+	static struct sched_item b;
+	uint32_t instants = 0;
+	int64_t last = -1;
+	uint32_t i = 0;
+	uint32_t j = 0;
+
+	a = (struct sched_item){0};
+	b = (struct sched_item){0};
+	sched_item_start(&a, "pair_a", 100, slack_ms);
+	k_sleep(K_MSEC(10));
+	sched_item_start(&b, "pair_b", 100, slack_ms);
+	k_sleep(K_SECONDS(10));
+	ztacx_leaf_work_cancel(&a.lw);
+	ztacx_leaf_work_cancel(&b.lw);
+
+	zassert_true((a.runs <= SCHED_RUNS_MAX) && (b.runs <= SCHED_RUNS_MAX));
+	zassert_equal(a.off_grid + b.off_grid, 0, "a run was later than its slack");
+
+	// both lists are in order, merge them counting distinct ticks
+	while ((i < a.runs) || (j < b.runs)) {
+		int64_t t;
+
+		if ((j >= b.runs) || ((i < a.runs) && (a.run_ticks[i] <= b.run_ticks[j]))) {
+			t = a.run_ticks[i++];
+		}
+		else {
+			t = b.run_ticks[j++];
+		}
+		if (t != last) {
+			instants++;
+			last = t;
+		}
+	}
+	*runs_r = a.runs + b.runs;
+	*instants_r = instants;
+}
+
+ZTEST(scheduler, test_coalesce)
+{
+	uint32_t runs_exact;
+	uint32_t wakeups_exact;
+	uint32_t runs;
+	uint32_t wakeups;
+
+	sched_pair(0, &runs_exact, &wakeups_exact);
+	sched_pair(20, &runs, &wakeups);
+
+	TC_PRINT("no slack: %u runs in %u wakeups; 20 ms slack: %u runs in %u wakeups\n",
+		 runs_exact, wakeups_exact, runs, wakeups);
+	zassert_equal(wakeups_exact, runs_exact, "items 10 ms apart ran together without slack");
+	zassert_true(runs >= runs_exact - 2, "runs were lost to coalescing");
+	zassert_true(wakeups <= (runs + 1) / 2 + 1, "overlapping windows were not coalesced");
+}
+
+ZTEST_SUITE(scheduler, NULL, NULL, NULL, NULL, NULL);
@@ -0,0 +1,114 @@
+/*
+ * ztacx settings tests
+ *
+ * Settings are stored in NVS on the flash simulator, then their values
+ * in RAM are cleared and ztacx_settings_load() is timed, as at boot.
+ * The ztacx.settings.nvs and ztacx.settings.image scenarios time the
+ * per-key and image storage modes.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#define __main__
+#include "ztacx.h"
+
+#include <zephyr/ztest.h>
+
+#define BENCH_SETTINGS 500
+
+static struct ztacx_variable bench_settings[BENCH_SETTINGS];
+static char bench_names[BENCH_SETTINGS][8];
+
+static uint8_t bench_value(int i)
+{
+	// never 0, the cleared value
+	return ((i * 7) % 255) + 1;
+}
+
+/*
+ * Register settings up to count, store the new ones, then load them
+ * all back into cleared values
+ */
+static void bench_load(int registered, int count)
+{
+	uint32_t start;
+	uint32_t us;
+
+	for (int i=registered; i<count; i++) {
+		snprintf(bench_names[i], sizeof(bench_names[i]), "b%03d", i);
+		bench_settings[i] = (struct ztacx_variable){
+			.name = bench_names[i],
+			.kind = ZTACX_VALUE_BYTE,
+		};
+	}
+	zassert_ok(ztacx_settings_register(&bench_settings[registered], count - registered));
+	for (int i=registered; i<count; i++) {
+		zassert_ok(ztacx_variable_value_set_byte(&bench_settings[i], bench_value(i)));
+		ztacx_setting_mark_dirty(&bench_settings[i]);
+	}
+	zassert_ok(ztacx_settings_commit());
+
+	for (int i=0; i<count; i++) {
+		bench_settings[i].value.val_byte = 0;
+	}
+	start = k_cycle_get_32();
+	zassert_ok(ztacx_settings_load());
+	us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+
+	for (int i=0; i<count; i++) {
+		zassert_equal(bench_settings[i].value.val_byte, bench_value(i),
+			      "%s was not loaded", bench_names[i]);
+	}
+	TC_PRINT("%s: %3d settings loaded in %6u us, %u.%02u us/setting\n",
+		 IS_ENABLED(CONFIG_ZTACX_SETTINGS_IMAGE) ? "image" : "per-key",
+		 count, us, us / count, (us * 100 / count) % 100);
+}
+
+/*
+ * Load time at 100, 250 and 500 settings: the per-setting cost should
+ * stay flat as the count grows.  native_sim's clock only advances for
+ * the simulated flash timing, so this is the cost of the flash traffic.
+ */
+ZTEST(settings, test_load_bench)
+{
+	static const int sizes[] = {100, 250, BENCH_SETTINGS};
+	int registered = 0;
+
+	for (int s=0; s<ARRAY_SIZE(sizes); s++) {
+		bench_load(registered, sizes[s]);
+		registered = sizes[s];
+	}
+}
+
+/*
+ * An image written before a setting was added must still restore the
+ * others, matched by id
+ */
+ZTEST(settings, test_schema_change)
+{
+	static struct ztacx_variable before[] = {
+		{"schema_a", ZTACX_VALUE_INT32, {.val_int32=0}},
+		{"schema_b", ZTACX_VALUE_INT16, {.val_int16=0}},
+	};
+	static struct ztacx_variable added[] = {
+		{"schema_c", ZTACX_VALUE_BYTE, {.val_byte=3}},
+	};
+
+	zassert_ok(ztacx_settings_register(before, ARRAY_SIZE(before)));
+	zassert_ok(ztacx_variable_value_set_int32(&before[0], 123456));
+	zassert_ok(ztacx_variable_value_set_int16(&before[1], -42));
+	ztacx_setting_mark_dirty(&before[0]);
+	ztacx_setting_mark_dirty(&before[1]);
+	zassert_ok(ztacx_settings_commit());
+
+	// as if new firmware added a setting, and rebooted
+	zassert_ok(ztacx_settings_register(added, ARRAY_SIZE(added)));
+	before[0].value.val_int32 = 0;
+	before[1].value.val_int16 = 0;
+	zassert_ok(ztacx_settings_load());
+
+	zassert_equal(before[0].value.val_int32, 123456);
+	zassert_equal(before[1].value.val_int16, -42);
+	zassert_equal(added[0].value.val_byte, 3, "a new setting lost its default");
+}
+
+ZTEST_SUITE(settings, NULL, NULL, NULL, NULL, NULL);
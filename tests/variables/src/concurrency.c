@@ -0,0 +1,152 @@
+/*
+ * Concurrent readers and writers of one variable must never see a torn
+ * (half old, half new) value.
+ *
+ * Only meaningful with the readers and the writer on different CPUs
+ * (the SMP scenario): on one CPU threads only switch at kernel calls
+ * (k_yield), never inside a get or set, so the test is skipped there.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "ztacx.h"
+
+#include <zephyr/ztest.h>
+
+#define STRESS_READERS 2
+#define STRESS_WRITES 20000
+#define STRESS_STRING_SIZE 32
+#define STRESS_STACK_SIZE 2048
+
+struct stress_reader_stats
+{
+	uint32_t reads;
+	uint32_t torn;
+	uint32_t retries;
+	uint32_t backwards;
+};
+
+static ZTACX_VARIABLES_DEFINE(stress_values) = {
+	{"stress_wide", ZTACX_VALUE_INT64, {.val_int64=0}},
+	{"stress_label", ZTACX_VALUE_STRING, ZTACX_STRING_INLINE(STRESS_STRING_SIZE, "B")},
+};
+
+static struct ztacx_variable *stress_wide;
+static struct ztacx_variable *stress_label;
+static atomic_t stress_done;
+
+static struct k_thread stress_writer_thread;
+static K_THREAD_STACK_DEFINE(stress_writer_stack, STRESS_STACK_SIZE);
+static struct k_thread stress_reader_threads[STRESS_READERS];
+static K_THREAD_STACK_ARRAY_DEFINE(stress_reader_stacks, STRESS_READERS, STRESS_STACK_SIZE);
+static struct stress_reader_stats stress_stats[STRESS_READERS];
+
+/*
+ * Write i into both halves of the int64, and a string whose length
+ * determines the character it repeats, so that a mix of two writes is
+ * always detectable.
+ */
+static void stress_writer(void *p1, void *p2, void *p3)
+{
+	char fill[STRESS_STRING_SIZE];
+
+	for (uint32_t i=1; i<=STRESS_WRITES; i++) {
+		int len = 1 + (i % (STRESS_STRING_SIZE-1));
+
+		ztacx_variable_value_set_int64(stress_wide, ((int64_t)i << 32) | i);
+		memset(fill, 'A' + (len % 26), len);
+		fill[len] = '\0';
+		ztacx_variable_value_set(stress_label, fill);
+		k_yield();
+	}
+	atomic_set(&stress_done, 1);
+}
+
+static bool stress_string_ok(const char *s)
+{
+	size_t len = strnlen(s, STRESS_STRING_SIZE);
+
+	if ((len == 0) || (len >= STRESS_STRING_SIZE)) {
+		return false;
+	}
+	for (size_t i=0; i<len; i++) {
+		if (s[i] != 'A' + (len % 26)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void stress_reader(void *p1, void *p2, void *p3)
+{
+	struct stress_reader_stats *st = p1;
+	uint32_t last = 0;
+
+	while (!atomic_get(&stress_done)) {
+		int64_t wide = ztacx_variable_value_get_int64(stress_wide);
+		char buf[STRESS_STRING_SIZE];
+		const char *borrowed;
+		atomic_val_t token;
+
+		if ((uint32_t)(wide >> 32) != (uint32_t)wide) {
+			st->torn++;
+		}
+		else if ((uint32_t)wide < last) {
+			st->backwards++;
+		}
+		last = (uint32_t)wide;
+
+		if ((ztacx_variable_value_get(stress_label, buf, sizeof(buf)) != 0) ||
+		    !stress_string_ok(buf)) {
+			st->torn++;
+		}
+
+		borrowed = ztacx_variable_value_borrow_string(stress_label, &token);
+		memcpy(buf, borrowed, sizeof(buf));
+		buf[sizeof(buf)-1] = '\0';
+		if (!ztacx_variable_value_borrow_valid(stress_label, token)) {
+			// a writer intervened, the caller is told to retry
+			st->retries++;
+		}
+		else if (!stress_string_ok(buf)) {
+			st->torn++;
+		}
+		st->reads++;
+		k_yield();
+	}
+}
+
+ZTEST(variables_concurrency, test_no_torn_reads)
+{
+	if (!IS_ENABLED(CONFIG_SMP) || (arch_num_cpus() < 2)) {
+		ztest_test_skip();
+	}
+	stress_wide = ztacx_variable_find("stress_wide");
+	stress_label = ztacx_variable_find("stress_label");
+	zassert_not_null(stress_wide);
+	zassert_not_null(stress_label);
+	atomic_set(&stress_done, 0);
+
+	for (int r=0; r<STRESS_READERS; r++) {
+		stress_stats[r] = (struct stress_reader_stats){0};
+		k_thread_create(&stress_reader_threads[r], stress_reader_stacks[r],
+				K_THREAD_STACK_SIZEOF(stress_reader_stacks[r]), stress_reader,
+				&stress_stats[r], NULL, NULL, K_PRIO_PREEMPT(5), 0, K_NO_WAIT);
+	}
+	k_thread_create(&stress_writer_thread, stress_writer_stack,
+			K_THREAD_STACK_SIZEOF(stress_writer_stack), stress_writer,
+			NULL, NULL, NULL, K_PRIO_PREEMPT(5), 0, K_NO_WAIT);
+
+	zassert_ok(k_thread_join(&stress_writer_thread, K_FOREVER));
+	for (int r=0; r<STRESS_READERS; r++) {
+		zassert_ok(k_thread_join(&stress_reader_threads[r], K_FOREVER));
+		TC_PRINT("reader %d: %u reads, %u borrow retries\n", r,
+			 stress_stats[r].reads, stress_stats[r].retries);
+		zassert_true(stress_stats[r].reads > 0, "reader %d never ran", r);
+		zassert_equal(stress_stats[r].torn, 0, "reader %d saw %u torn values", r, stress_stats[r].torn);
+		zassert_equal(stress_stats[r].backwards, 0, "reader %d saw the value go backwards", r);
+	}
+	zassert_equal(ztacx_variable_value_get_int64(stress_wide),
+		      ((int64_t)STRESS_WRITES << 32) | STRESS_WRITES);
+}
+
+ZTEST_SUITE(variables_concurrency, NULL, NULL, NULL, NULL, NULL);
@@ -0,0 +1,180 @@
+/*
+ * ztacx variable tests
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#define __main__
+#include "ztacx.h"
+
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/ztest.h>
+
+#define BENCH_VARIABLES_MAX 1000
+#define BENCH_LOOKUPS 10000
+
+static struct ztacx_variable bench_vars[BENCH_VARIABLES_MAX];
+static char bench_names[BENCH_VARIABLES_MAX][12];
+ZTACX_VARIABLE_INDEX_DEFINE(bench_index, CONFIG_ZTACX_VARIABLE_INDEX_BUCKETS);
+
+/*
+ * Name comparisons made by an indexed lookup, ie the length of the
+ * bucket chain walked up to (and including) the match
+ */
+static int bench_index_probes(const char *name)
+{
+	uint32_t hash = ztacx_name_hash(name);
+	const struct ztacx_variable *v = bench_index.bucket[hash & bench_index.mask];
+	int probes = 0;
+
+	for (; v != NULL; v = v->hash_next) {
+		probes++;
+		if ((v->hash == hash) && ztacx_variable_name_eq(v, name)) {
+			break;
+		}
+	}
+	return probes;
+}
+
+/* The lookup the index replaced, as a baseline */
+static struct ztacx_variable *bench_linear_find(int count, const char *name)
+{
+	for (int i=0; i<count; i++) {
+		if (ztacx_variable_name_eq(&bench_vars[i], name)) {
+			return &bench_vars[i];
+		}
+	}
+	return NULL;
+}
+
+static void bench_find(int count)
+{
+	uint32_t start;
+	uint64_t indexed_ns;
+	uint64_t linear_ns;
+	int probes = 0;
+	int probes_max = 0;
+
+	for (int i=0; i<count; i++) {
+		int p = bench_index_probes(bench_names[i]);
+
+		probes += p;
+		probes_max = MAX(probes_max, p);
+		zassert_equal_ptr(ztacx_variable_index_find(&bench_index, bench_names[i]), &bench_vars[i],
+				  "%s not found", bench_names[i]);
+	}
+	zassert_is_null(ztacx_variable_index_find(&bench_index, "nonesuch"));
+
+	start = k_cycle_get_32();
+	for (int i=0; i<BENCH_LOOKUPS; i++) {
+		(void)ztacx_variable_index_find(&bench_index, bench_names[(i * 7919) % count]);
+	}
+	indexed_ns = k_cyc_to_ns_floor64(k_cycle_get_32() - start);
+
+	start = k_cycle_get_32();
+	for (int i=0; i<BENCH_LOOKUPS; i++) {
+		(void)bench_linear_find(count, bench_names[(i * 7919) % count]);
+	}
+	linear_ns = k_cyc_to_ns_floor64(k_cycle_get_32() - start);
+
+	TC_PRINT("%4d variables: %3d.%02d compares/find (max %d), indexed %llu ns/find, linear %llu ns/find\n",
+		 count, probes / count, (probes * 100 / count) % 100, probes_max,
+		 indexed_ns / BENCH_LOOKUPS, linear_ns / BENCH_LOOKUPS);
+}
+
+/*
+ * Find latency at 10, 100 and 1000 variables.  The compare counts are
+ * exact everywhere; the ns figures need a cycle counter that runs while
+ * code does, which native_sim's simulated clock does not (use qemu_x86).
+ */
+ZTEST(variables, test_find_bench)
+{
+	static const int sizes[] = {10, 100, 1000};
+	int registered = 0;
+
+	for (int i=0; i<BENCH_VARIABLES_MAX; i++) {
+		snprintf(bench_names[i], sizeof(bench_names[i]), "bench_%d", i);
+		bench_vars[i] = (struct ztacx_variable){
+			.name = bench_names[i],
+			.kind = ZTACX_VALUE_INT32,
+		};
+	}
+	for (int s=0; s<ARRAY_SIZE(sizes); s++) {
+		for (; registered < sizes[s]; registered++) {
+			ztacx_variable_index_add(&bench_index, &bench_vars[registered]);
+		}
+		bench_find(sizes[s]);
+	}
+}
+
+/*
+ * A name registered twice resolves to the first registration, and
+ * adding a variable that is already indexed does not link it twice
+ */
+ZTEST(variables, test_index_duplicate)
+{
+	ZTACX_VARIABLE_INDEX_DEFINE(dup_index, 4);
+	static struct ztacx_variable dup_vars[] = {
+		{"dup_a", ZTACX_VALUE_INT32, {.val_int32=1}},
+		{"dup_b", ZTACX_VALUE_INT32, {.val_int32=2}},
+		{"dup_a", ZTACX_VALUE_INT32, {.val_int32=3}},
+		{"a", ZTACX_VALUE_INT32, {.val_int32=4}, .prefix="dup"},
+	};
+	int chained = 0;
+
+	for (int i=0; i<ARRAY_SIZE(dup_vars); i++) {
+		ztacx_variable_index_add(&dup_index, &dup_vars[i]);
+	}
+	ztacx_variable_index_add(&dup_index, &dup_vars[1]);
+
+	zassert_equal_ptr(ztacx_variable_index_find(&dup_index, "dup_a"), &dup_vars[0]);
+	zassert_equal_ptr(ztacx_variable_index_find(&dup_index, "dup_b"), &dup_vars[1]);
+	for (int b=0; b<=dup_index.mask; b++) {
+		for (struct ztacx_variable *v = dup_index.bucket[b]; v; v = v->hash_next) {
+			chained++;
+			zassert_true(chained <= 2, "a variable is indexed twice");
+		}
+	}
+	zassert_equal(chained, 2);
+}
+
+/* A leaf's worth of variables, as a battery and temperature leaf would have */
+static ZTACX_VARIABLES_DEFINE(snap_values) = {
+	{"snap_ok", ZTACX_VALUE_BOOL, {.val_bool=true}},
+	{"snap_level_percent", ZTACX_VALUE_BYTE, {.val_byte=87}},
+	{"snap_millivolts", ZTACX_VALUE_UINT16, {.val_uint16=3712}},
+	{"snap_centidegree", ZTACX_VALUE_INT16, {.val_int16=-215}},
+	{"snap_read_interval_msec", ZTACX_VALUE_INT32, {.val_int32=60000}},
+	{"snap_samples", ZTACX_VALUE_INT64, {.val_int64=1234567}},
+	{"snap_label", ZTACX_VALUE_STRING, ZTACX_STRING_INLINE(16, "kitchen")},
+};
+
+static bool snap_only(const struct ztacx_variable *v, void *arg)
+{
+	return (v >= snap_values) && (v < snap_values + ARRAY_SIZE(snap_values));
+}
+
+/*
+ * The binary snapshot of a table is smaller than the text the shell
+ * and log would show for it
+ */
+ZTEST(variables, test_snapshot_smaller_than_describe)
+{
+	uint8_t frame[256];
+	char desc[132];
+	int text_len = 0;
+	int len;
+
+	for (int i=0; i<ARRAY_SIZE(snap_values); i++) {
+		zassert_ok(ztacx_variable_describe(desc, sizeof(desc), &snap_values[i]));
+		text_len += strlen(desc);
+	}
+	len = ztacx_variables_encode(frame, sizeof(frame), snap_only, NULL);
+	zassert_true(len > 0, "encode failed (%d)", len);
+	zassert_equal(sys_get_le16(frame+2), ARRAY_SIZE(snap_values));
+
+	TC_PRINT("%d variables: %d bytes described, %d bytes encoded\n",
+		 (int)ARRAY_SIZE(snap_values), text_len, len);
+	zassert_true(len < text_len, "snapshot (%d) is not smaller than describe (%d)", len, text_len);
+}
+
+ZTEST_SUITE(variables, NULL, NULL, NULL, NULL, NULL);